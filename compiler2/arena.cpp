@@ -0,0 +1,117 @@
+#include "compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+/*
+ * Elements and their strings live for the whole run of the compiler, so rather than
+ * paying malloc's per-allocation header and rounding for every single G-code line,
+ * everything gets bump-allocated out of large zeroed chunks that are never freed.
+ *
+ * Elements get their own chunks (struct element_chunk) so that an element's id doubles
+ * as the index of its movement data in the per-field arrays of its chunk.
+ */
+
+#define ARENA_CHUNK (4 * 1024 * 1024)
+
+static char *arena_ptr;
+static size_t arena_left;
+
+size_t stat_arena_bytes;
+
+std::vector<struct element_chunk *> element_chunks;
+std::vector<struct container> containers;
+
+static unsigned int element_count;
+
+void *arena_alloc(size_t size)
+{
+    void *p;
+    size_t pad;
+
+    /* keep everything 8 byte aligned */
+    pad = (8 - ((unsigned long)arena_ptr & 7)) & 7;
+
+    if (size + pad > arena_left) {
+        size_t chunk = ARENA_CHUNK;
+        if (size > chunk)
+            chunk = size;
+        arena_ptr = (char *)calloc(1, chunk);
+        if (!arena_ptr) {
+            printf("Out of memory allocating %lu bytes\n", (unsigned long)chunk);
+            exit(EXIT_FAILURE);
+        }
+        arena_left = chunk;
+        pad = 0;
+    }
+
+    p = arena_ptr + pad;
+    arena_ptr += size + pad;
+    arena_left -= size + pad;
+    stat_arena_bytes += size + pad;
+    return p;
+}
+
+char *arena_strndup(const char *s, size_t n)
+{
+    char *p;
+
+    /* strings do not need alignment, so pack them tightly */
+    if (n + 1 > arena_left)
+        p = (char *)arena_alloc(n + 1);
+    else {
+        p = arena_ptr;
+        arena_ptr += n + 1;
+        arena_left -= n + 1;
+        stat_arena_bytes += n + 1;
+    }
+    memcpy(p, s, n);
+    p[n] = 0;
+    return p;
+}
+
+char *arena_strdup(const char *s)
+{
+    return arena_strndup(s, strlen(s));
+}
+
+static std::unordered_map<std::string_view, const char *> interned;
+
+/* returns a single shared copy for all identical strings */
+const char *intern_string(const char *s)
+{
+    auto it = interned.find(std::string_view(s));
+    if (it != interned.end())
+        return it->second;
+
+    const char *copy = arena_strdup(s);
+    interned[std::string_view(copy)] = copy;
+    return copy;
+}
+
+struct element *alloc_element(void)
+{
+    struct element *e;
+
+    if ((element_count & ELEMENT_CHUNK_MASK) == 0) {
+        struct element_chunk *chunk = (struct element_chunk *)calloc(1, sizeof(struct element_chunk));
+        if (!chunk) {
+            printf("Out of memory allocating %lu bytes\n", (unsigned long)sizeof(struct element_chunk));
+            exit(EXIT_FAILURE);
+        }
+        element_chunks.push_back(chunk);
+        stat_arena_bytes += sizeof(struct element_chunk);
+    }
+
+    e = &element_chunks.back()->elements[element_count & ELEMENT_CHUNK_MASK];
+    e->id = element_count++;
+    return e;
+}
+
+unsigned int count_elements(void)
+{
+    return element_count;
+}
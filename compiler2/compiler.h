@@ -6,70 +6,192 @@
 
 #include <vector>
 
+#include "machinetime.h"
+
 #define TYPE_RAW	0
 #define TYPE_MOVEMENT	1
 #define TYPE_CONTAINER  2
 
-struct element;
+/*
+ * The IR is sized for files with millions of lines, so it is kept compact:
+ *
+ * - struct element only holds what every element needs; it is bump allocated in
+ *   chunks of ELEMENT_CHUNK elements, and its id is its index in that pool.
+ * - The movement data (end points, arc center, feed, tool) lives next to it in the
+ *   chunk as one array per field, reached through the X1_of() style accessors.
+ * - Children and dependents are spans of element ids in two global arrays.
+ * - Bounding box, length and description are only stored for containers.
+ * - raw_gcode points straight into the mapped input file and is NOT nul terminated.
+ */
 
 struct element {
-    int type;
+    const char *raw_gcode;
+    unsigned int raw_length;
+
+    unsigned int id;
+    /* index into containers[], for TYPE_CONTAINER only */
+    unsigned int container;
+
+    /* span of this element's children inside child_store */
+    unsigned int children_start;
+    unsigned int children_count;
+
+    /* span of this element's dependents inside dependency_edges */
+    unsigned int dependents_start;
+    unsigned int dependents_count;
+
+    /* only used for diagnostics; the id of the first element this one depends on */
+    unsigned int first_depends_on;
+
     int sequence;
-    
-    /* bounding box */
-    double minX, minY, minZ, maxX, maxY, maxZ;
+    int depends_refcount;
+
+    unsigned char type;
+    char glevel;
 
-    double X1, Y1, Z1, X2, Y2, Z2;
-    double feed;
-    
-    double length;
-    double tool_diameter;
-    
     bool is_retract;
     bool is_vertical;
     bool is_positioning;
     bool is_split_already;
     bool is_barrier;
 
+    bool has_been_emitted;
+};
+
+#define ELEMENT_CHUNK_SHIFT 12
+#define ELEMENT_CHUNK (1 << ELEMENT_CHUNK_SHIFT)
+#define ELEMENT_CHUNK_MASK (ELEMENT_CHUNK - 1)
 
-    bool has_been_emitted;    
+struct element_chunk {
+    /* must stay the first member, chunk_of() relies on it */
+    struct element elements[ELEMENT_CHUNK];
 
-    char glevel;    
-    char *raw_gcode;
+    double X1[ELEMENT_CHUNK], Y1[ELEMENT_CHUNK], Z1[ELEMENT_CHUNK];
+    double X2[ELEMENT_CHUNK], Y2[ELEMENT_CHUNK], Z2[ELEMENT_CHUNK];
+    /* arc center relative to X1/Y1, for G2/G3 movements */
+    double I[ELEMENT_CHUNK], J[ELEMENT_CHUNK];
+    double feed[ELEMENT_CHUNK];
+    double tool_diameter[ELEMENT_CHUNK];
+};
+
+struct bbox {
+    double minX, minY, minZ, maxX, maxY, maxZ;
+    double length;
+};
+
+struct container {
+    struct bbox box;
     const char *description;
-    
-    std::vector<struct element *>children;
-    
-    long int depends_refcount;
+};
 
-    std::vector<struct element *>depends_on;
-    std::vector<struct element *>dependents;
+extern std::vector<struct element_chunk *> element_chunks;
+extern std::vector<struct container> containers;
+extern std::vector<unsigned int> child_store;
+extern std::vector<unsigned int> dependency_edges;
 
+static inline struct element_chunk *chunk_of(struct element *e)
+{
+    return (struct element_chunk *)(e - (e->id & ELEMENT_CHUNK_MASK));
+}
 
+static inline struct element *element_by_id(unsigned int id)
+{
+    return &element_chunks[id >> ELEMENT_CHUNK_SHIFT]->elements[id & ELEMENT_CHUNK_MASK];
+}
+
+static inline double &X1_of(struct element *e) { return chunk_of(e)->X1[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &Y1_of(struct element *e) { return chunk_of(e)->Y1[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &Z1_of(struct element *e) { return chunk_of(e)->Z1[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &X2_of(struct element *e) { return chunk_of(e)->X2[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &Y2_of(struct element *e) { return chunk_of(e)->Y2[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &Z2_of(struct element *e) { return chunk_of(e)->Z2[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &I_of(struct element *e) { return chunk_of(e)->I[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &J_of(struct element *e) { return chunk_of(e)->J[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &feed_of(struct element *e) { return chunk_of(e)->feed[e->id & ELEMENT_CHUNK_MASK]; }
+static inline double &tool_diameter_of(struct element *e) { return chunk_of(e)->tool_diameter[e->id & ELEMENT_CHUNK_MASK]; }
+
+static inline struct bbox &bbox_of_container(struct element *e) { return containers[e->container].box; }
+static inline const char *description_of(struct element *e)
+{
+    if (e->type != TYPE_CONTAINER)
+        return NULL;
+    return containers[e->container].description;
+}
+
+/* for (auto c : children(e)) ..., safe against child_store growing inside the loop */
+struct child_iterator {
+    unsigned int pos;
+    struct element *operator*() const { return element_by_id(child_store[pos]); }
+    child_iterator &operator++() { pos++; return *this; }
+    bool operator!=(const child_iterator &other) const { return pos != other.pos; }
+};
+
+struct child_range {
+    unsigned int first, last;
+    child_iterator begin() const { return { first }; }
+    child_iterator end() const { return { last }; }
 };
 
+static inline struct child_range children(struct element *e)
+{
+    return { e->children_start, e->children_start + e->children_count };
+}
+
+static inline struct element *child(struct element *e, unsigned int i)
+{
+    return element_by_id(child_store[e->children_start + i]);
+}
+
 extern double retractZ;
 
 extern int globalsequence;
 
+extern void *arena_alloc(size_t size);
+extern char *arena_strdup(const char *s);
+extern char *arena_strndup(const char *s, size_t n);
+extern const char *intern_string(const char *s);
+extern struct element *alloc_element(void);
+extern unsigned int count_elements(void);
+
 static inline struct element * new_element(int type, const char *description)
 {
     struct element *e;
-    
-    e = (struct element*)calloc(1, sizeof(struct element));
+
+    e = alloc_element();
     e->type = type;
-    
-    if (description)
-    
-    e->description = strdup(description);
+
+    if (type == TYPE_CONTAINER) {
+        struct container c = {};
+
+        if (description)
+            c.description = intern_string(description);
+        e->container = containers.size();
+        containers.push_back(c);
+    }
     e->sequence = globalsequence++;
-    
+
     return e;
 }
 
 extern struct element *parse_file(const char *filename);
 
+/* elements that are ready to be emitted, bucketed by their entry point */
+struct readyset {
+    double originX, originY;
+    double cellsize;
+    int gridX, gridY;
+    long int count;
+    std::vector<std::vector<struct element *>> cells;
+};
+
+extern void readyset_init(struct readyset *rs, struct element *parent);
+extern void readyset_insert(struct readyset *rs, struct element *e);
+extern struct element *readyset_pop_nearest(struct readyset *rs, double X, double Y, double Z);
 
+
+extern void add_child(struct element *parent, struct element *e);
+extern void set_children(struct element *parent, std::vector<struct element *> &list);
+extern void get_children(struct element *parent, std::vector<struct element *> &list);
 extern void move_children_to_element(struct element *parent, struct element *target, int startindex, int endindex);
 
 
@@ -81,17 +203,38 @@ extern void print_stats(void);
 extern int stat_pass_raw_to_movement;
 extern int stat_pass_vertical_G0;
 extern int stat_pass_split_rings;
+extern int stat_pass_arc_fit;
+extern int stat_pass_arc_fit_segments;
+extern int stat_pass_decimate;
+extern long int stat_readyset_probes;
+extern size_t stat_arena_bytes;
 
 extern void pass_raw_to_movement(struct element *e);
 extern void pass_bounding_box(struct element *e);
 extern void pass_vertical_G0(struct element *e);
 extern void pass_split_cut(struct element *e);
 extern void pass_dependencies(struct element *e);
+extern void pass_arc_fit(struct element *e);
+extern void pass_decimate(struct element *e);
+
+extern double arc_tolerance;
+extern double decimate_tolerance;
+extern double decimate_z_tolerance;
 
 extern void pass_positioning(struct element *e, struct element *prev);
 
 
 
 extern double dist3(double X1, double Y1, double Z1, double X2, double Y2, double Z2);
+extern double movement_length(struct element *e);
+extern void element_bbox(struct element *e, struct bbox *box);
+extern bool is_arc(struct element *e);
+extern int count_blocks(struct element *e);
+extern double estimate_machine_time(struct element *e);
+extern double estimate_machine_time(std::vector<struct element *> &elements);
+extern struct kinematics machine_kinematics;
+
+extern int stat_blocks_in, stat_blocks_out;
+extern double stat_time_in, stat_time_out;
 extern void declare_A_depends_on_B(struct element *A, struct element *B);
-extern bool elements_intersect(struct element *A, struct element *B);
\ No newline at end of file
+extern bool elements_intersect(struct element *A, struct element *B);
@@ -9,13 +9,13 @@
 
 void emit_TYPE_RAW(FILE *file, struct element *e)
 {
-    fprintf(file, "%s\n", e->raw_gcode);
+    fprintf(file, "%.*s\n", (int)e->raw_length, e->raw_gcode);
 }
 
 void emit_TYPE_CONTAINER(FILE *file, struct element *e)
 {
-    if (e->description)
-        fprintf(file,"(CONTAINER: %s)\n", e->description);
+    if (description_of(e))
+        fprintf(file,"(CONTAINER: %s)\n", description_of(e));
 }
 
 static bool approx3(double A, double B)
@@ -29,43 +29,77 @@ static bool approx3(double A, double B)
 static double lX, lY, lZ, lF;
 static char lG;
 static bool lValid = false;
+
+/* the output time estimate follows the blocks in the order they get written */
+static struct machinetime emitted_time;
+
+static void account_TYPE_MOVEMENT(struct element *e)
+{
+    double X1 = X1_of(e), Y1 = Y1_of(e), Z1 = Z1_of(e);
+    double feed = feed_of(e);
+
+    /* after a raw line the position is what the IR says, otherwise where the last block went */
+    if (lValid) {
+        X1 = lX;
+        Y1 = lY;
+        Z1 = lZ;
+    }
+    if (e->glevel == '0')
+        feed = 0;
+    if (is_arc(e))
+        machinetime_arc(&emitted_time, X1, Y1, Z1, X2_of(e), Y2_of(e), Z2_of(e), I_of(e), J_of(e),
+                        e->glevel == '2', feed);
+    else
+        machinetime_move(&emitted_time, X1, Y1, Z1, X2_of(e), Y2_of(e), Z2_of(e), feed);
+}
+
 void emit_TYPE_MOVEMENT(FILE *file, struct element *e)
 {
     char line[4096];
     char frag[1045];
+    double X2 = X2_of(e), Y2 = Y2_of(e), Z2 = Z2_of(e), feed = feed_of(e);
     memset(line, 0, 4096);
+
+    account_TYPE_MOVEMENT(e);
     
     if (lG != e->glevel || !lValid) {
         sprintf(frag, "G%c", e->glevel);
         strcat(line, frag);
     }
     
-    if (!lValid || !approx3(lX, e->X2)) {
-        sprintf(frag, "X%0.3f", e->X2);
+    if (!lValid || !approx3(lX, X2)) {
+        sprintf(frag, "X%0.3f", X2);
         strcat(line, frag);
     }
-    if (!lValid || !approx3(lY, e->Y2)) {
-        sprintf(frag, "Y%0.3f", e->Y2);
+    if (!lValid || !approx3(lY, Y2)) {
+        sprintf(frag, "Y%0.3f", Y2);
         strcat(line, frag);
     }
-    if (!lValid || !approx3(lZ, e->Z2)) {
-        sprintf(frag, "Z%0.3f", e->Z2);
+    if (!lValid || !approx3(lZ, Z2)) {
+        sprintf(frag, "Z%0.3f", Z2);
         strcat(line, frag);
     }
-    if ((!lValid || !approx3(lF, e->feed)) && e->glevel != '0') {
-        sprintf(frag, "F%0.0f", e->feed);
+    if (e->glevel == '2' || e->glevel == '3') {
+        sprintf(frag, "I%0.3fJ%0.3f", I_of(e), J_of(e));
         strcat(line, frag);
     }
-    if (e->raw_gcode)
-      fprintf(file, "%s\n", e->raw_gcode);
+    if ((!lValid || !approx3(lF, feed)) && e->glevel != '0') {
+        sprintf(frag, "F%0.0f", feed);
+        strcat(line, frag);
+    }
+    /* a raw line without G word would inherit the G2/G3 of a fitted arc before it */
+    if (e->raw_gcode && lValid && (lG == '2' || lG == '3') && e->raw_gcode[0] != 'G')
+      fprintf(file, "G%c%.*s\n", e->glevel, (int)e->raw_length, e->raw_gcode);
+    else if (e->raw_gcode)
+      fprintf(file, "%.*s\n", (int)e->raw_length, e->raw_gcode);
     else
       fprintf(file, "%s\n", line);
     
-    lX = e->X2;
-    lY = e->Y2;
-    lZ = e->Z2;
+    lX = X2;
+    lY = Y2;
+    lZ = Z2;
     if (e->glevel != '0')
-        lF = e->feed;
+        lF = feed;
     lValid = true;
     lG = e->glevel;
 }
@@ -91,8 +125,8 @@ static bool compare_elements_for_sort(struct element *A, struct element *B)
   if (A->depends_refcount > B->depends_refcount)
     return false;
     
-  double dA = dist3(currentX, currentY, currentZ, A->X1, A->Y1, A->Z1);
-  double dB = dist3(currentX, currentY, currentZ, B->X1, B->Y1, B->Z1);
+  double dA = dist3(currentX, currentY, currentZ, X1_of(A), Y1_of(A), Z1_of(A));
+  double dB = dist3(currentX, currentY, currentZ, X1_of(B), Y1_of(B), Z1_of(B));
     
   if (dA < dB)
     return true;
@@ -106,11 +140,24 @@ static bool compare_elements_for_sort(struct element *A, struct element *B)
     
 }
 
-static void sort_children(struct element *e)
+/*
+ * Fallback for when no child is ready; the dependency graph only points backwards
+ * so this should not happen, but if it does we keep the old "least depends-on" rule.
+ */
+static struct element *pick_least_dependent(struct element *e)
 {
-  std::sort(e->children.begin(), e->children.end(), compare_elements_for_sort);
+  struct element *best = NULL;
+  for (auto i: children(e)) {
+    if (i->has_been_emitted)
+      continue;
+    if (!best || compare_elements_for_sort(i, best))
+      best = i;
+  }
+  return best;
 }
 
+static struct readyset *ready = NULL;
+
 void __emit_gcode(FILE *file, struct element *e, int level)
 {
 
@@ -122,15 +169,15 @@ void __emit_gcode(FILE *file, struct element *e, int level)
         break;
 
     case TYPE_CONTAINER:
-        currentX = e->X1;
-        currentY = e->Y1;
-        currentZ = e->Z1;
+        currentX = X1_of(e);
+        currentY = Y1_of(e);
+        currentZ = Z1_of(e);
         emit_TYPE_CONTAINER(file, e);
         break;
     case TYPE_MOVEMENT:
-        currentX = e->X2;
-        currentY = e->Y2;
-        currentZ = e->Z2;
+        currentX = X2_of(e);
+        currentY = Y2_of(e);
+        currentZ = Z2_of(e);
         emit_TYPE_MOVEMENT(file, e);
         break;
     
@@ -139,47 +186,55 @@ void __emit_gcode(FILE *file, struct element *e, int level)
     }
     e->has_been_emitted = true;
     
-    for (auto q: e->dependents) {    
+    for (unsigned int d = 0; d < e->dependents_count; d++) {    
+      struct element *q = element_by_id(dependency_edges[e->dependents_start + d]);
       q->depends_refcount--;
+      if (ready && q->depends_refcount == 0 && !q->has_been_emitted)
+        readyset_insert(ready, q);
     }
     
     if (e->type == TYPE_CONTAINER || e->type == TYPE_RAW)
-      printf("Emiting container %i (%s)\n", e->sequence, e->description);
+      printf("Emiting container %i (%s)\n", e->sequence, description_of(e));
       
     if (level == 0) {
+      struct readyset rs;
+      long int remaining = e->children_count;
 
-      sort_children(e);
-    
-      if (e->children.size() > 0) {
+      readyset_init(&rs, e);
+      for (auto i: children(e))
+        if (i->depends_refcount == 0 && !i->has_been_emitted)
+          readyset_insert(&rs, i);
+      ready = &rs;
+
+      while (remaining > 0) {
         struct element *i;
-        i = e->children[0];
-      
-        while (!i->has_been_emitted) {
+
+        i = readyset_pop_nearest(&rs, currentX, currentY, currentZ);
+        if (!i)
+          i = pick_least_dependent(e);
+        if (!i)
+          break;
 #if 0        
-          printf("emitting sequence %i at distance %5.2f\n", i->sequence, dist3(currentX, currentY, currentZ, i->X1, i->Y1, i->Z1));
-          for (unsigned int pp = 1; pp < e->children.size() && pp < 3; pp++) {
-              struct element *qq = e->children[pp];
-              if (!qq->has_been_emitted && qq->depends_refcount < 5)
-                printf("    versus emitting sequence %i at distance %5.2f  RC %li\n", qq->sequence, dist3(currentX, currentY, currentZ, qq->X1, qq->Y1, qq->Z1), qq->depends_refcount);
-          }
+        printf("emitting sequence %i at distance %5.2f\n", i->sequence, dist3(currentX, currentY, currentZ, X1_of(i), Y1_of(i), Z1_of(i)));
 #endif        
-          __emit_gcode(file, i, level + 1);
-          sort_children(e);
-          i = e->children[0];
-        }
+        __emit_gcode(file, i, level + 1);
+        remaining--;
       }
+      ready = NULL;
     } else {
-      for (auto i: e->children)
+      for (auto i: children(e))
         __emit_gcode(file, i, level + 1);
     }
       
-    if (e->description)
-      fprintf(file, "(END GROUP %s)\n", e->description);
+    if (description_of(e))
+      fprintf(file, "(END GROUP %s)\n", description_of(e));
 }
 
 void emit_gcode(FILE *file, struct element *e)
 {
+  machinetime_init(&emitted_time, &machine_kinematics);
   __emit_gcode(file, e, 0);
+  stat_time_out = machinetime_finish(&emitted_time) / 60;
 }
 
 
@@ -202,8 +257,9 @@ static void __print_tree(struct element *e, int level, int leaf)
 {
     int i;
     int is_leaf;
+    struct bbox box;
     
-//    if (e->children.size() == 0 && leaf)
+//    if (e->children_count == 0 && leaf)
 //     return;
     
     for (i = 0; i < level; i++)
@@ -213,28 +269,30 @@ static void __print_tree(struct element *e, int level, int leaf)
     print_flags(e);
         
     printf("%s\t", type2desc[e->type]);
-    if (e->description) {
-        printf("%s\t", e->description);
+    if (description_of(e)) {
+        printf("%s\t", description_of(e));
     } 
     
     if (e->type == TYPE_MOVEMENT || e->type == TYPE_RAW)
-        printf("%s\t", e->raw_gcode);
+        printf("%.*s\t", (int)e->raw_length, e->raw_gcode ? e->raw_gcode : "");
 
-    printf("%i\t", (int) e->children.size());
+    printf("%i\t", (int) e->children_count);
     if (e->type == TYPE_CONTAINER || e->type == TYPE_RAW) 
-      printf("RC:%li\t", e->depends_refcount);
+      printf("RC:%i\t", e->depends_refcount);
     if (e->depends_refcount == 1)
-      printf("DEPS:%i\t", e->depends_on[0]->sequence);
+      printf("DEPS:%i\t", element_by_id(e->first_depends_on)->sequence);
     if (e->type == TYPE_CONTAINER) {
-      printf("BB:%1.2fx%1.2f-%1.2fx%1.2f\t", e->minX, e->minY, e->maxX, e->maxY);
+      struct bbox *box = &bbox_of_container(e);
+      printf("BB:%1.2fx%1.2f-%1.2fx%1.2f\t", box->minX, box->minY, box->maxX, box->maxY);
     }
-    printf("(%6.2f)\n", e->length);
+    element_bbox(e, &box);
+    printf("(%6.2f)\n", box.length);
     is_leaf = 1;
-    for (auto i: e->children) {
-        if (i->children.size() > 0)
+    for (auto i: children(e)) {
+        if (i->children_count > 0)
          is_leaf = 0;
     }
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         __print_tree(i, level + 1, is_leaf);
     }
 }
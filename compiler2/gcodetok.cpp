@@ -0,0 +1,245 @@
+#include "gcodetok.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+static const double pow10d[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+
+static const long long pow10l[] = { 1, 10, 100, 1000, 10000 };
+
+/* nothing a machine can reach comes near this, saturate rather than overflow */
+#define GCODE_FIXED_MAX 9000000000000000000LL
+
+static long long to_fixed(double value)
+{
+    if (value * 10000 >= GCODE_FIXED_MAX)
+        return GCODE_FIXED_MAX;
+    return (long long)(value * 10000 + 0.5);
+}
+
+bool gcode_map_file(struct gcode_map *map, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    map->data = NULL;
+    map->size = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    map->size = st.st_size;
+    if (map->size == 0) {
+        close(fd);
+        return true;
+    }
+
+#ifdef _WIN32
+    /* no mmap() on windows, just read the whole thing in */
+    char *buffer = (char *)malloc(map->size);
+    size_t done = 0;
+    while (buffer && done < map->size) {
+        ssize_t ret = read(fd, buffer + done, map->size - done);
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    map->size = done;
+    map->data = buffer;
+#else
+    void *p = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        p = NULL;
+    else
+        madvise(p, map->size, MADV_SEQUENTIAL);
+    map->data = (const char *)p;
+#endif
+    close(fd);
+
+    if (!map->data) {
+        map->size = 0;
+        return false;
+    }
+    return true;
+}
+
+void gcode_unmap_file(struct gcode_map *map)
+{
+    if (map->data) {
+#ifdef _WIN32
+        free((void *)map->data);
+#else
+        munmap((void *)map->data, map->size);
+#endif
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+/*
+ * Parses [sign]digits[.digits] into both a double and a 1/10000 fixed point value.
+ * Up to 15 significant digits the mantissa is exact, and dividing it by an exact power of ten
+ * gives the same correctly rounded result as strtod(); longer numbers take the strtod() path.
+ */
+static const char *parse_number(const char *c, const char *end, struct gcode_word *w)
+{
+    const char *start = c;
+    unsigned long long mant = 0;
+    int digits = 0, frac = 0;
+    bool neg = false, dot = false;
+
+    if (c < end && (*c == '-' || *c == '+')) {
+        neg = (*c == '-');
+        c++;
+    }
+    while (c < end) {
+        if (*c >= '0' && *c <= '9') {
+            if (digits > 0 || *c != '0')
+                digits++;
+            mant = mant * 10 + (*c - '0');
+            if (dot)
+                frac++;
+            c++;
+            continue;
+        }
+        if (*c == '.' && !dot) {
+            dot = true;
+            c++;
+            continue;
+        }
+        break;
+    }
+
+    if (digits <= 15 && frac <= 15) {
+        w->value = (double)mant / pow10d[frac];
+        if (frac <= 4 && mant <= (unsigned long long)(GCODE_FIXED_MAX / pow10l[4 - frac]))
+            w->fixed = mant * pow10l[4 - frac];
+        else
+            w->fixed = to_fixed(w->value);
+    } else {
+        char buffer[128];
+        size_t len = c - start;
+        if (len >= sizeof(buffer))
+            len = sizeof(buffer) - 1;
+        memcpy(buffer, start, len);
+        buffer[len] = 0;
+        w->value = fabs(strtod(buffer, NULL));
+        w->fixed = to_fixed(w->value);
+    }
+    if (neg) {
+        w->value = -w->value;
+        w->fixed = -w->fixed;
+    }
+    return c;
+}
+
+const char *gcode_tokenize_line(const char *cursor, const char *end, struct gcode_block *block,
+                                struct gcode_word *words, unsigned int maxwords)
+{
+    const char *c = cursor;
+    const char *eol, *next;
+
+    eol = (const char *)memchr(c, '\n', end - c);
+    if (eol) {
+        next = eol + 1;
+    } else {
+        eol = end;
+        next = end;
+    }
+    if (eol > c && eol[-1] == '\r')
+        eol--;
+
+    block->text = c;
+    block->length = eol - c;
+    block->comment = NULL;
+    block->comment_length = 0;
+    block->nwords = 0;
+    block->invalid = false;
+
+    while (c < eol) {
+        char ch = *c;
+
+        if (ch == ' ' || ch == '\t' || ch == '%') {
+            c++;
+            continue;
+        }
+        if (ch == '(') {
+            const char *close = (const char *)memchr(c, ')', eol - c);
+            if (!close)
+                close = eol;
+            if (!block->comment) {
+                block->comment = c + 1;
+                block->comment_length = close - c - 1;
+            }
+            c = close < eol ? close + 1 : eol;
+            continue;
+        }
+        if (ch == ';') {
+            if (!block->comment) {
+                block->comment = c + 1;
+                block->comment_length = eol - c - 1;
+            }
+            break;
+        }
+        if (ch >= 'a' && ch <= 'z')
+            ch = ch - 'a' + 'A';
+        if (ch >= 'A' && ch <= 'Z') {
+            struct gcode_word dummy;
+            struct gcode_word *w = &dummy;
+
+            if (block->nwords < maxwords)
+                w = &words[block->nwords++];
+            else
+                block->invalid = true;
+            w->letter = ch;
+            c = parse_number(c + 1, eol, w);
+            continue;
+        }
+        block->invalid = true;
+        c++;
+    }
+    return next;
+}
+
+void gcode_reader_init(struct gcode_reader *reader, const struct gcode_map *map)
+{
+    reader->cursor = map->data;
+    reader->end = map->data + map->size;
+    reader->linenr = 0;
+}
+
+bool gcode_next_block(struct gcode_reader *reader, struct gcode_block *block,
+                      struct gcode_word *words, unsigned int maxwords)
+{
+    if (reader->cursor >= reader->end)
+        return false;
+    reader->cursor = gcode_tokenize_line(reader->cursor, reader->end, block, words, maxwords);
+    block->linenr = ++reader->linenr;
+    return true;
+}
+
+char *gcode_block_text(const struct gcode_block *block, char *buffer, size_t size)
+{
+    size_t len = block->length;
+
+    if (len >= size)
+        len = size - 1;
+    memcpy(buffer, block->text, len);
+    buffer[len] = 0;
+    return buffer;
+}
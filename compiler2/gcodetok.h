@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+ * Zero-copy G-code tokenizer, shared between compiler2, gcodecheck and inlaycheck.
+ *
+ * The input file is mmap()ed and every line is split into words (a letter plus a
+ * number) without copying or allocating; the block points straight into the mapping.
+ */
+
+#include <stddef.h>
+
+#define GCODE_MAX_WORDS 32
+
+struct gcode_word {
+    char letter;            /* always upper case */
+    long long fixed;        /* value * 10000, exact for the usual 4 decimals, saturates when huge */
+    double value;
+};
+
+struct gcode_block {
+    const char *text;       /* start of the line, NOT nul terminated */
+    unsigned int length;    /* without the line ending */
+    unsigned int linenr;    /* 1 based */
+
+    const char *comment;    /* inside of the first (...) or ; comment, if any */
+    unsigned int comment_length;
+
+    unsigned int nwords;
+
+    bool invalid;           /* the line has characters that are not part of a word */
+};
+
+struct gcode_map {
+    const char *data;
+    size_t size;
+};
+
+struct gcode_reader {
+    const char *cursor;
+    const char *end;
+    unsigned int linenr;
+};
+
+extern bool gcode_map_file(struct gcode_map *map, const char *filename);
+extern void gcode_unmap_file(struct gcode_map *map);
+
+extern const char *gcode_tokenize_line(const char *cursor, const char *end, struct gcode_block *block,
+                                       struct gcode_word *words, unsigned int maxwords);
+
+extern void gcode_reader_init(struct gcode_reader *reader, const struct gcode_map *map);
+extern bool gcode_next_block(struct gcode_reader *reader, struct gcode_block *block,
+                             struct gcode_word *words, unsigned int maxwords);
+
+/* copies the line into a nul terminated buffer, truncating if needed */
+extern char *gcode_block_text(const struct gcode_block *block, char *buffer, size_t size);
@@ -6,7 +6,53 @@
 
 int globalsequence;
 
-/* This function replaces a series of elements in the parents' children vector with a new element that has
+/* all child lists, each element owns one contiguous span of it */
+std::vector<unsigned int> child_store;
+
+/* all dependency edges, each element owns one contiguous span of it */
+std::vector<unsigned int> dependency_edges;
+
+void add_child(struct element *parent, struct element *e)
+{
+    unsigned int i;
+
+    /* the span can only grow in place when it sits at the end of the store */
+    if (parent->children_count > 0 && parent->children_start + parent->children_count != child_store.size()) {
+        unsigned int start = child_store.size();
+        for (i = 0; i < parent->children_count; i++)
+            child_store.push_back(child_store[parent->children_start + i]);
+        parent->children_start = start;
+    }
+    if (parent->children_count == 0)
+        parent->children_start = child_store.size();
+
+    child_store.push_back(e->id);
+    parent->children_count++;
+}
+
+/* replaces the children of parent with list; a list that is not longer reuses the old span */
+void set_children(struct element *parent, std::vector<struct element *> &list)
+{
+    unsigned int i;
+
+    if (list.size() > parent->children_count) {
+        parent->children_start = child_store.size();
+        child_store.resize(child_store.size() + list.size());
+    }
+    for (i = 0; i < list.size(); i++)
+        child_store[parent->children_start + i] = list[i]->id;
+    parent->children_count = list.size();
+}
+
+void get_children(struct element *parent, std::vector<struct element *> &list)
+{
+    list.clear();
+    list.reserve(parent->children_count);
+    for (auto i: children(parent))
+        list.push_back(i);
+}
+
+/* This function replaces a series of elements in the parents' children span with a new element that has
  * these elements as its children. Effectively this moves the <start,end> range of children one hierarchy level
  * deeper 
  */
@@ -16,18 +62,23 @@ void move_children_to_element(struct element *parent, struct element *target, in
     
     /* Step 1: Add a copy of all elements in the range to the target */    
     for (i = startindex; i <= endindex; i++)
-        target->children.push_back(parent->children[i]);
+        add_child(target, child(parent, i));
         
     /* Step 2: Replace the first element with the target */
     
-    parent->children[startindex] = target;
+    child_store[parent->children_start + startindex] = target->id;
     
     /* Step 3: remove the rest */    
-    if (startindex + 1 <= endindex)
-        parent->children.erase(parent->children.begin() + startindex + 1, parent->children.begin() + endindex + 1);
+    if (startindex + 1 <= endindex) {
+        unsigned int *span = &child_store[parent->children_start];
+        unsigned int removed = endindex - startindex;
+
+        memmove(span + startindex + 1, span + endindex + 1, (parent->children_count - endindex - 1) * sizeof(unsigned int));
+        parent->children_count -= removed;
+    }
         
-    if (target->children.size() > 0) {
-        struct element *e = target->children[0];
+    if (target->children_count > 0) {
+        struct element *e = child(target, 0);
         if (e->type != TYPE_MOVEMENT)
             target->is_barrier = true;
     }
@@ -39,24 +90,121 @@ double dist3(double X1, double Y1, double Z1, double X2, double Y2, double Z2)
     return sqrt((X2-X1)*(X2-X1) + (Y2-Y1)*(Y2-Y1) + (Z2-Z1)*(Z2-Z1));
 }
 
+bool is_arc(struct element *e)
+{
+    return e->type == TYPE_MOVEMENT && (e->glevel == '2' || e->glevel == '3');
+}
+
+/* path length of a movement, following the arc for G2/G3 */
+double movement_length(struct element *e)
+{
+    double X1 = X1_of(e), Y1 = Y1_of(e), Z1 = Z1_of(e);
+    double X2 = X2_of(e), Y2 = Y2_of(e), Z2 = Z2_of(e);
+    double I = I_of(e), J = J_of(e);
+    double R, a1, a2, sweep;
+
+    if (!is_arc(e))
+        return dist3(X1, Y1, Z1, X2, Y2, Z2);
+
+    R = sqrt(I * I + J * J);
+    a1 = atan2(-J, -I);
+    a2 = atan2(Y2 - (Y1 + J), X2 - (X1 + I));
+    sweep = a2 - a1;
+    if (e->glevel == '3' && sweep <= 0)
+        sweep += 2 * M_PI;
+    if (e->glevel == '2' && sweep >= 0)
+        sweep -= 2 * M_PI;
+
+    return sqrt((R * sweep) * (R * sweep) + (Z2 - Z1) * (Z2 - Z1));
+}
+
+/*
+ * Containers keep their bounding box from pass_bounding_box(), for everything else it is
+ * cheap enough to work out when needed. A raw line has an empty box.
+ */
+void element_bbox(struct element *e, struct bbox *box)
+{
+    double X1, Y1, Z1, X2, Y2, Z2, r;
+
+    if (e->type == TYPE_CONTAINER) {
+        *box = bbox_of_container(e);
+        return;
+    }
+
+    box->minX = 500000000000000000;
+    box->minY = 500000000000000000;
+    box->minZ = 500000000000000000;
+    box->maxX = -500000000000000000;
+    box->maxY = -500000000000000000;
+    box->maxZ = -500000000000000000;
+    box->length = 0;
+
+    if (e->type != TYPE_MOVEMENT)
+        return;
+
+    X1 = X1_of(e); Y1 = Y1_of(e); Z1 = Z1_of(e);
+    X2 = X2_of(e); Y2 = Y2_of(e); Z2 = Z2_of(e);
+    r = tool_diameter_of(e) / 2;
+
+    box->minX = fmin(X1, X2) - r;
+    box->minY = fmin(Y1, Y2) - r;
+    box->minZ = fmin(Z1, Z2);
+    box->maxX = fmax(X1, X2) + r;
+    box->maxY = fmax(Y1, Y2) + r;
+    box->maxZ = fmax(Z1, Z2);
+
+    /* an arc can bulge past its end points; the full circle is a safe bound */
+    if (is_arc(e)) {
+        double R = sqrt(I_of(e) * I_of(e) + J_of(e) * J_of(e));
+        double cX = X1 + I_of(e);
+        double cY = Y1 + J_of(e);
+        box->minX = fmin(box->minX, cX - R - r);
+        box->minY = fmin(box->minY, cY - R - r);
+        box->maxX = fmax(box->maxX, cX + R + r);
+        box->maxY = fmax(box->maxY, cY + R + r);
+    }
+
+    box->length = movement_length(e);
+}
+
 void declare_A_depends_on_B(struct element *A, struct element *B)
 {
-    A->depends_on.push_back(B);
-    B->dependents.push_back(A);
+    unsigned int i;
+
+    /* B's span can only grow in place when it sits at the end of the edge list */
+    if (B->dependents_count > 0 && B->dependents_start + B->dependents_count != dependency_edges.size()) {
+        unsigned int start = dependency_edges.size();
+        for (i = 0; i < B->dependents_count; i++)
+            dependency_edges.push_back(dependency_edges[B->dependents_start + i]);
+        B->dependents_start = start;
+    }
+    if (B->dependents_count == 0)
+        B->dependents_start = dependency_edges.size();
+
+    dependency_edges.push_back(A->id);
+    B->dependents_count++;
+
+    if (A->depends_refcount == 0)
+        A->first_depends_on = B->id;
     A->depends_refcount++;    
 }
 
 bool elements_intersect(struct element *A, struct element *B)
 {
-    if (A->maxX < B->minX)
+    struct bbox a, b;
+
+    element_bbox(A, &a);
+    element_bbox(B, &b);
+
+    if (a.maxX < b.minX)
         return false;
-    if (B->maxX < A->minX)
+    if (b.maxX < a.minX)
         return false;
-    if (A->maxY < B->minY)
+    if (a.maxY < b.minY)
         return false;
-    if (B->maxY < A->minY)
+    if (b.maxY < a.minY)
         return false;
         
     /* for now, don't look any deeper */
     return true;
-}
\ No newline at end of file
+}
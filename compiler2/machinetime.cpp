@@ -0,0 +1,211 @@
+#include "machinetime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* GRBL splits arcs into chords that deviate at most this much (its $12 default) */
+#define ARC_TOLERANCE 0.002
+
+/* GRBL defaults on a typical hobby router ($110-$112, $120-$122, $11) */
+void kinematics_default(struct kinematics *k)
+{
+    k->accel[0] = 400;
+    k->accel[1] = 400;
+    k->accel[2] = 200;
+    k->max_feed[0] = 5000;
+    k->max_feed[1] = 5000;
+    k->max_feed[2] = 2500;
+    k->junction_deviation = 0.01;
+    k->planner_blocks = 16;
+    /* roughly what 115200 baud serial streaming sustains */
+    k->min_block_time = 1.0 / 250;
+}
+
+void machinetime_init(struct machinetime *mt, const struct kinematics *k)
+{
+    memset(mt, 0, sizeof(*mt));
+    if (k)
+        mt->k = *k;
+    else
+        kinematics_default(&mt->k);
+    if (mt->k.planner_blocks < 1)
+        mt->k.planner_blocks = 1;
+    if (mt->k.planner_blocks > MACHINETIME_MAX_BUFFER)
+        mt->k.planner_blocks = MACHINETIME_MAX_BUFFER;
+}
+
+/* time to cover length L going from v0 to v1, cruising at no more than vn */
+static double trapezoid_time(double L, double v0, double v1, double vn, double a)
+{
+    double da, dd, vp;
+
+    vn = fmax(vn, fmax(v0, v1));
+    da = (vn * vn - v0 * v0) / (2 * a);
+    dd = (vn * vn - v1 * v1) / (2 * a);
+
+    if (da + dd <= L)
+        return (vn - v0) / a + (vn - v1) / a + (L - da - dd) / vn;
+
+    /* triangle profile: never reaches the nominal speed */
+    vp = sqrt((2 * a * L + v0 * v0 + v1 * v1) / 2);
+    vp = fmax(vp, fmax(v0, v1));
+    return (vp - v0) / a + (vp - v1) / a;
+}
+
+static struct mt_block *block_at(struct machinetime *mt, int i)
+{
+    return &mt->buffer[(mt->head + i) % MACHINETIME_MAX_BUFFER];
+}
+
+/*
+ * Plan the whole buffer backwards from a full stop after its last block (the controller
+ * must always be able to stop within what it has seen) and execute its first block.
+ */
+static void retire_block(struct machinetime *mt)
+{
+    struct mt_block *b = block_at(mt, 0);
+    double next_entry = 0;
+    double v0, v1, t;
+    int i;
+
+    for (i = mt->count - 1; i >= 1; i--) {
+        struct mt_block *n = block_at(mt, i);
+        next_entry = fmin(n->max_entry, sqrt(next_entry * next_entry + 2 * n->accel * n->length));
+    }
+
+    v0 = fmin(mt->speed, b->nominal);
+    v1 = fmin(next_entry, sqrt(v0 * v0 + 2 * b->accel * b->length));
+    v1 = fmin(v1, b->nominal);
+
+    t = trapezoid_time(b->length, v0, v1, b->nominal, b->accel);
+    t = fmax(t, b->min_time);
+    mt->seconds += t;
+    if (b->rapid)
+        mt->rapid_seconds += t;
+    mt->blocks++;
+    mt->speed = v1;
+
+    mt->head = (mt->head + 1) % MACHINETIME_MAX_BUFFER;
+    mt->count--;
+}
+
+static void add_block(struct machinetime *mt, double X1, double Y1, double Z1,
+                      double X2, double Y2, double Z2, double feed, double min_time)
+{
+    struct mt_block *b;
+    double d[3] = { X2 - X1, Y2 - Y1, Z2 - Z1 };
+    double L, nominal, accel;
+    int i;
+
+    L = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if (L < 0.000001)
+        return;
+
+    if (mt->count >= mt->k.planner_blocks)
+        retire_block(mt);
+
+    b = block_at(mt, mt->count);
+    b->length = L;
+    b->rapid = (feed <= 0);
+    b->min_time = min_time;
+
+    nominal = feed > 0 ? feed : 1e12;
+    accel = 1e12;
+    for (i = 0; i < 3; i++) {
+        b->unit[i] = d[i] / L;
+        if (fabs(b->unit[i]) < 1e-9)
+            continue;
+        nominal = fmin(nominal, mt->k.max_feed[i] / fabs(b->unit[i]));
+        accel = fmin(accel, mt->k.accel[i] / fabs(b->unit[i]));
+    }
+    b->nominal = nominal / 60;
+    b->accel = accel;
+
+    /* GRBL junction deviation: the corner speed at which the centripetal acceleration fits */
+    b->max_entry = 0;
+    if (mt->has_previous) {
+        double cos_theta = -(mt->prev_unit[0] * b->unit[0] + mt->prev_unit[1] * b->unit[1] + mt->prev_unit[2] * b->unit[2]);
+
+        if (cos_theta < -0.999999) {
+            b->max_entry = 1e12;
+        } else if (cos_theta < 0.999999) {
+            double sin_half = sqrt(0.5 * (1 - cos_theta));
+            double a = fmin(accel, mt->prev_accel);
+            b->max_entry = sqrt(a * mt->k.junction_deviation * sin_half / (1 - sin_half));
+        }
+        b->max_entry = fmin(b->max_entry, fmin(b->nominal, mt->prev_nominal));
+    }
+
+    memcpy(mt->prev_unit, b->unit, sizeof(b->unit));
+    mt->prev_nominal = b->nominal;
+    mt->prev_accel = b->accel;
+    mt->has_previous = true;
+    mt->count++;
+}
+
+void machinetime_move(struct machinetime *mt, double X1, double Y1, double Z1,
+                      double X2, double Y2, double Z2, double feed)
+{
+    add_block(mt, X1, Y1, Z1, X2, Y2, Z2, feed, mt->k.min_block_time);
+}
+
+/* the controller splits arcs itself, only the G2/G3 line has to be streamed */
+void machinetime_arc(struct machinetime *mt, double X1, double Y1, double Z1,
+                     double X2, double Y2, double Z2, double I, double J,
+                     bool clockwise, double feed)
+{
+    double cX = X1 + I, cY = Y1 + J;
+    double R = sqrt(I * I + J * J);
+    double a1 = atan2(Y1 - cY, X1 - cX);
+    double a2 = atan2(Y2 - cY, X2 - cX);
+    double sweep = a2 - a1;
+    double step;
+    double pX = X1, pY = Y1, pZ = Z1;
+    int n, i;
+
+    if (clockwise && sweep >= 0)
+        sweep -= 2 * M_PI;
+    if (!clockwise && sweep <= 0)
+        sweep += 2 * M_PI;
+
+    if (R < ARC_TOLERANCE) {
+        machinetime_move(mt, X1, Y1, Z1, X2, Y2, Z2, feed);
+        return;
+    }
+
+    step = 2 * acos(1 - ARC_TOLERANCE / R);
+    n = (int)ceil(fabs(sweep) / step);
+    if (n < 1)
+        n = 1;
+
+    for (i = 1; i <= n; i++) {
+        double a = a1 + sweep * i / n;
+        double X = cX + R * cos(a);
+        double Y = cY + R * sin(a);
+        double Z = Z1 + (Z2 - Z1) * i / n;
+        if (i == n) {
+            X = X2;
+            Y = Y2;
+        }
+        add_block(mt, pX, pY, pZ, X, Y, Z, feed, i == 1 ? mt->k.min_block_time : 0);
+        pX = X;
+        pY = Y;
+        pZ = Z;
+    }
+}
+
+void machinetime_stop(struct machinetime *mt)
+{
+    while (mt->count > 0)
+        retire_block(mt);
+    mt->has_previous = false;
+    mt->speed = 0;
+}
+
+double machinetime_finish(struct machinetime *mt)
+{
+    machinetime_stop(mt);
+    return mt->seconds;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * Machine time estimator: runs the moves through a GRBL style trapezoidal planner
+ * (per axis acceleration and max feed, junction deviation, a finite planner buffer)
+ * instead of just dividing distance by feed.
+ *
+ * Shared between compiler2, gcodecheck and toolpath.
+ */
+
+#define MACHINETIME_MAX_BUFFER 64
+
+struct kinematics {
+    double accel[3];            /* mm/s^2 per axis */
+    double max_feed[3];         /* mm/min per axis, also used for G0 */
+    double junction_deviation;  /* mm */
+    int planner_blocks;         /* look-ahead depth of the controller */
+    double min_block_time;      /* seconds, how fast G-code lines can be streamed in */
+};
+
+struct mt_block {
+    double length;              /* mm */
+    double unit[3];
+    double nominal;             /* mm/s */
+    double accel;               /* mm/s^2 along the move */
+    double max_entry;           /* mm/s, limited by the junction with the previous block */
+    double min_time;            /* seconds, streaming limit for this block */
+    bool rapid;
+};
+
+struct machinetime {
+    struct kinematics k;
+
+    struct mt_block buffer[MACHINETIME_MAX_BUFFER];
+    int head, count;
+
+    bool has_previous;
+    double prev_unit[3];
+    double prev_nominal;
+    double prev_accel;
+    double speed;               /* exit speed of the last retired block */
+
+    double seconds;
+    double rapid_seconds;
+    long blocks;
+};
+
+extern void kinematics_default(struct kinematics *k);
+
+extern void machinetime_init(struct machinetime *mt, const struct kinematics *k);
+/* feed in mm/min; zero or negative means a G0 rapid */
+extern void machinetime_move(struct machinetime *mt, double X1, double Y1, double Z1,
+                             double X2, double Y2, double Z2, double feed);
+/* G2 (clockwise) / G3 arc in the XY plane, center at X1+I, Y1+J */
+extern void machinetime_arc(struct machinetime *mt, double X1, double Y1, double Z1,
+                            double X2, double Y2, double Z2, double I, double J,
+                            bool clockwise, double feed);
+/* the machine comes to a full stop (tool change, dwell, program end) */
+extern void machinetime_stop(struct machinetime *mt);
+/* stops and returns the total time in seconds */
+extern double machinetime_finish(struct machinetime *mt);
@@ -9,16 +9,23 @@ double retractZ = 0;
 void optimization_passes(struct element *e)
 {
     pass_raw_to_movement(e);
+    stat_blocks_in = count_blocks(e);
+    stat_time_in = estimate_machine_time(e);
+    
     pass_bounding_box(e);
     pass_vertical_G0(e);
     pass_positioning(e, NULL);
     
     pass_split_cut(e);
+    pass_arc_fit(e);
+    pass_decimate(e);
     pass_bounding_box(e);
     
     pass_dependencies(e);
 
-    retractZ = e->maxZ;
+    retractZ = bbox_of_container(e).maxZ;
+    
+    stat_blocks_out = count_blocks(e);
     
     print_tree(e, 0);
 }
@@ -27,6 +34,7 @@ int main(int argc, char **argv)
     struct element *element;
     FILE *file;
     
+    kinematics_default(&machine_kinematics);
     element = parse_file("input.nc");
     
     
@@ -36,6 +44,8 @@ int main(int argc, char **argv)
     emit_gcode(file, element);
     fclose(file);
     
+    print_stats();
+    
     
     return EXIT_SUCCESS;
 }
\ No newline at end of file
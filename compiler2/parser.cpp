@@ -1,9 +1,13 @@
 #include "compiler.h"
+#include "gcodetok.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <cstring>
 
+/* the elements point into the mapped file, so it stays mapped for the whole run */
+static struct gcode_map map;
+
 struct element * parse_file(const char *filename)
 {
     struct element *container;
@@ -11,29 +15,25 @@ struct element * parse_file(const char *filename)
     container = new_element(TYPE_CONTAINER, "Top Level Container");
     container->type = TYPE_CONTAINER;
     
-    FILE *file;
+    struct gcode_reader reader;
+    struct gcode_block block;
+    struct gcode_word words[GCODE_MAX_WORDS];
     
-    file = fopen(filename, "r");
-    if (!file) {
+    if (!gcode_map_file(&map, filename)) {
         printf("Could not open file %s", filename);
         return container;
     }
         
-    while (!feof(file)) {
-        char line[4096];
-        char *ret;
+    gcode_reader_init(&reader, &map);
+    while (gcode_next_block(&reader, &block, words, GCODE_MAX_WORDS)) {
         struct element *el;
-        ret = fgets(line, 4096, file);
-        if (ret == NULL)
-            break;
-        ret = strchr(line, '\n');
-        if (ret) *ret = 0;
         
         el = new_element(TYPE_RAW, NULL);
-        el->raw_gcode = strdup(line);
+        el->raw_gcode = block.text;
+        el->raw_length = block.length;
 
-        container->children.push_back(el);
+        add_child(container, el);
     }
-    printf("Size : %li \n", container->children.size());    
+    printf("Size : %u \n", container->children_count);    
     return container;
-}
\ No newline at end of file
+}
@@ -0,0 +1,201 @@
+#include "compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cstring>
+
+/*
+ * Replace runs of short G1 segments that lie on a circle with a single G2/G3.
+ *
+ * A run only contains G1 moves at one constant Z with one feed, so the arc stays in the
+ * XY plane (G17) and nothing observable besides the block count changes.
+ * Runs are grown greedily: circle through first, middle and last point. The arc is at most
+ * the radial error of a chord's end points plus its sagitta away from that chord, and that
+ * sum has to stay within arc_tolerance for every segment.
+ * A container only takes the arcs if the planner does not predict it to get slower.
+ */
+
+double arc_tolerance = 0.005;
+
+int stat_pass_arc_fit;
+int stat_pass_arc_fit_segments;
+
+/* arcs flatter than this are better left to straight line handling */
+#define MAX_ARC_RADIUS 1000.0
+/* fewer segments than this are not worth an arc */
+#define MIN_ARC_SEGMENTS 3
+
+static bool approx(double A, double B)
+{
+    return fabs(A - B) < 0.0001;
+}
+
+static bool can_be_in_arc(struct element *first, struct element *e)
+{
+    if (e->type != TYPE_MOVEMENT || e->glevel != '1')
+        return false;
+    if (e->is_barrier || e->is_positioning || e->is_retract || e->is_vertical)
+        return false;
+    if (!approx(Z1_of(e), Z2_of(e)) || !approx(Z1_of(e), Z1_of(first)))
+        return false;
+    if (!approx(feed_of(e), feed_of(first)))
+        return false;
+    if (e->children_count > 0)
+        return false;
+    return true;
+}
+
+static bool circle_from_3_points(double X1, double Y1, double X2, double Y2, double X3, double Y3,
+                                 double *cX, double *cY, double *R)
+{
+    double d = 2 * (X1 * (Y2 - Y3) + X2 * (Y3 - Y1) + X3 * (Y1 - Y2));
+    double s1 = X1 * X1 + Y1 * Y1;
+    double s2 = X2 * X2 + Y2 * Y2;
+    double s3 = X3 * X3 + Y3 * Y3;
+
+    if (fabs(d) < 1e-12)
+        return false;
+
+    *cX = (s1 * (Y2 - Y3) + s2 * (Y3 - Y1) + s3 * (Y1 - Y2)) / d;
+    *cY = (s1 * (X3 - X2) + s2 * (X1 - X3) + s3 * (X2 - X1)) / d;
+    *R = sqrt((X1 - *cX) * (X1 - *cX) + (Y1 - *cY) * (Y1 - *cY));
+    return true;
+}
+
+/*
+ * Check if children [start, end] of e fit one arc. On success returns the
+ * center and the direction ('2' for clockwise, '3' for counter clockwise)
+ */
+static bool fit_arc(struct element *e, unsigned int start, unsigned int end, double *cX, double *cY, char *glevel)
+{
+    struct element *first = child(e, start);
+    struct element *mid = child(e, (start + end) / 2);
+    struct element *last = child(e, end);
+    double R, sweep = 0;
+    int direction = 0;
+    unsigned int i;
+
+    if (!circle_from_3_points(X1_of(first), Y1_of(first), X2_of(mid), Y2_of(mid), X2_of(last), Y2_of(last), cX, cY, &R))
+        return false;
+    if (R > MAX_ARC_RADIUS)
+        return false;
+
+    for (i = start; i <= end; i++) {
+        struct element *s = child(e, i);
+        double X1 = X1_of(s), Y1 = Y1_of(s), X2 = X2_of(s), Y2 = Y2_of(s);
+        double r1 = sqrt((X1 - *cX) * (X1 - *cX) + (Y1 - *cY) * (Y1 - *cY));
+        double r2 = sqrt((X2 - *cX) * (X2 - *cX) + (Y2 - *cY) * (Y2 - *cY));
+        double half = dist3(X1, Y1, 0, X2, Y2, 0) / 2;
+        double cross, angle, sagitta;
+
+        if (half >= R)
+            return false;
+
+        /* the arc bulges out of the chord by its sagitta, on top of the end point error */
+        sagitta = R - sqrt(R * R - half * half);
+        if (fmax(fabs(r1 - R), fabs(r2 - R)) + sagitta > arc_tolerance)
+            return false;
+
+        cross = (X1 - *cX) * (Y2 - *cY) - (Y1 - *cY) * (X2 - *cX);
+        if (fabs(cross) < 1e-12)
+            return false;
+        if (direction == 0)
+            direction = cross > 0 ? 1 : -1;
+        if ((cross > 0 ? 1 : -1) != direction)
+            return false;
+
+        angle = 2 * asin(fmin(half / R, 1.0));
+        sweep += angle;
+    }
+
+    /* a (near) full circle has ambiguous start/end points, leave those alone */
+    if (sweep > 1.9 * M_PI)
+        return false;
+
+    *glevel = direction > 0 ? '3' : '2';
+    return true;
+}
+
+static struct element *make_arc(struct element *e, unsigned int start, unsigned int end, double cX, double cY, char glevel)
+{
+    struct element *first = child(e, start);
+    struct element *last = child(e, end);
+    struct element *arc;
+
+    arc = new_element(TYPE_MOVEMENT, NULL);
+    arc->glevel = glevel;
+    X1_of(arc) = X1_of(first);
+    Y1_of(arc) = Y1_of(first);
+    Z1_of(arc) = Z1_of(first);
+    X2_of(arc) = X2_of(last);
+    Y2_of(arc) = Y2_of(last);
+    Z2_of(arc) = Z2_of(last);
+    I_of(arc) = cX - X1_of(first);
+    J_of(arc) = cY - Y1_of(first);
+    feed_of(arc) = feed_of(first);
+    tool_diameter_of(arc) = tool_diameter_of(first);
+    /* keep the place of the first segment in the original order */
+    arc->sequence = first->sequence;
+
+    return arc;
+}
+
+void pass_arc_fit(struct element *e)
+{
+    std::vector<struct element *> out, in;
+    unsigned int i = 0;
+    int arcs = 0, segments = 0;
+
+    for (auto c: children(e))
+        pass_arc_fit(c);
+
+    if (e->type != TYPE_CONTAINER || e->children_count <= MIN_ARC_SEGMENTS)
+        return;
+
+    while (i < e->children_count) {
+        struct element *first = child(e, i);
+        unsigned int end, best = 0;
+        double cX = 0, cY = 0, bcX = 0, bcY = 0;
+        char glevel = 0, bglevel = 0;
+
+        if (!can_be_in_arc(first, first)) {
+            out.push_back(first);
+            i++;
+            continue;
+        }
+
+        for (end = i + 1; end < e->children_count; end++) {
+            if (!can_be_in_arc(first, child(e, end)))
+                break;
+            if (end - i + 1 < MIN_ARC_SEGMENTS)
+                continue;
+            if (!fit_arc(e, i, end, &cX, &cY, &glevel))
+                break;
+            best = end;
+            bcX = cX;
+            bcY = cY;
+            bglevel = glevel;
+        }
+
+        if (best > i) {
+            out.push_back(make_arc(e, i, best, bcX, bcY, bglevel));
+            arcs++;
+            segments += best - i + 1;
+            i = best + 1;
+        } else {
+            out.push_back(first);
+            i++;
+        }
+    }
+
+    if (arcs == 0)
+        return;
+    get_children(e, in);
+    if (estimate_machine_time(out) > estimate_machine_time(in))
+        return;
+
+    stat_pass_arc_fit += arcs;
+    stat_pass_arc_fit_segments += segments;
+    set_children(e, out);
+}
@@ -5,60 +5,53 @@
 #include <math.h>
 
 
+/* only containers store their box, see element_bbox() for the rest */
 void pass_bounding_box(struct element *e)
 {
-    e->minX = 500000000000000000;
-    e->minY = 500000000000000000;
-    e->minZ = 500000000000000000;
-    e->maxX = -500000000000000000;
-    e->maxY = -500000000000000000;
-    e->maxZ = -500000000000000000;
-    e->length = 0;
+    struct bbox *box;
+
+    if (e->type != TYPE_CONTAINER) {
+        for (auto i: children(e))
+            pass_bounding_box(i);
+        return;
+    }
+
+    box = &bbox_of_container(e);
+    box->minX = 500000000000000000;
+    box->minY = 500000000000000000;
+    box->minZ = 500000000000000000;
+    box->maxX = -500000000000000000;
+    box->maxY = -500000000000000000;
+    box->maxZ = -500000000000000000;
+    box->length = 0;
     
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         pass_bounding_box(i);
         
         if (!i->is_positioning) {
-            e->minX = fmin(e->minX, i->minX);
-            e->minY = fmin(e->minY, i->minY);
-            e->minZ = fmin(e->minZ, i->minZ);
-            e->maxX = fmax(e->maxX, i->maxX);
-            e->maxY = fmax(e->maxY, i->maxY);
-            e->maxZ = fmax(e->maxZ, i->maxZ);        
+            struct bbox child;
+
+            element_bbox(i, &child);
+            box->minX = fmin(box->minX, child.minX);
+            box->minY = fmin(box->minY, child.minY);
+            box->minZ = fmin(box->minZ, child.minZ);
+            box->maxX = fmax(box->maxX, child.maxX);
+            box->maxY = fmax(box->maxY, child.maxY);
+            box->maxZ = fmax(box->maxZ, child.maxZ);        
         
-            e->length += i->length;
+            box->length += child.length;
         }
         
-        if (e->type == TYPE_CONTAINER && i->is_positioning) {
+        if (i->is_positioning) {
             /* by cnvention, the X1/Y1/Z1 of a container is the entry point */
             /* which is the *target* of a positioning move not the origin */
-            e->X1 = i->X2;
-            e->Y1 = i->Y2;
-            e->Z1 = i->Z2;
+            X1_of(e) = X2_of(i);
+            Y1_of(e) = Y2_of(i);
+            Z1_of(e) = Z2_of(i);
         }
     }
     
-    if (e->type == TYPE_MOVEMENT) {
-        e->minX = fmin(e->minX, e->X1 - e->tool_diameter/2);
-        e->minY = fmin(e->minY, e->Y1 - e->tool_diameter/2);
-        e->minZ = fmin(e->minZ, e->Z1);
-        e->maxX = fmax(e->maxX, e->X1 + e->tool_diameter/2);
-        e->maxY = fmax(e->maxY, e->Y1 + e->tool_diameter/2);
-        e->maxZ = fmax(e->maxZ, e->Z1);
-        e->minX = fmin(e->minX, e->X2 - e->tool_diameter/2);
-        e->minY = fmin(e->minY, e->Y2 - e->tool_diameter/2);
-        e->minZ = fmin(e->minZ, e->Z2);
-        e->maxX = fmax(e->maxX, e->X2 + e->tool_diameter/2);
-        e->maxY = fmax(e->maxY, e->Y2 + e->tool_diameter/2);
-        e->maxZ = fmax(e->maxZ, e->Z2);        
-        
-        e->length += dist3(e->X1, e->Y1, e->Z1, e->X2, e->Y2, e->Z2);
-    }
-    
-    if (e->type == TYPE_CONTAINER) {
-        e->X1 = (e->minX + e->maxX)/2;
-        e->Y1 = (e->minY + e->maxY)/2;
-        e->Z1 = (e->minZ + e->maxZ)/2;
-    }
-    
-}
\ No newline at end of file
+    X1_of(e) = (box->minX + box->maxX)/2;
+    Y1_of(e) = (box->minY + box->maxY)/2;
+    Z1_of(e) = (box->minZ + box->maxZ)/2;
+}
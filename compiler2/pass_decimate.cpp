@@ -0,0 +1,216 @@
+#include "compiler.h"
+#include "gcodetok.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cstring>
+
+/*
+ * Collapse chains of nearly collinear G1 moves (Douglas-Peucker).
+ *
+ * A chain only contains plain G1 moves with one feed; a feed change, a barrier, a
+ * positioning move or anything that is not a movement ends the chain.
+ * Dropped points may deviate at most decimate_tolerance sideways (XY) and
+ * decimate_z_tolerance in Z from the straight line that replaces them.
+ */
+
+double decimate_tolerance = 0.005;
+double decimate_z_tolerance = 0.005;
+
+int stat_pass_decimate;
+
+static bool approx(double A, double B)
+{
+    return fabs(A - B) < 0.0001;
+}
+
+static bool can_be_in_chain(struct element *first, struct element *e)
+{
+    if (e->type != TYPE_MOVEMENT || e->glevel != '1')
+        return false;
+    if (e->is_barrier || e->is_positioning || e->is_retract)
+        return false;
+    if (!approx(feed_of(e), feed_of(first)))
+        return false;
+    if (e->children_count > 0)
+        return false;
+    return true;
+}
+
+/* does point P stay within tolerance of the line A->B */
+static bool within_tolerance(double AX, double AY, double AZ, double BX, double BY, double BZ,
+                             double PX, double PY, double PZ)
+{
+    double dX = BX - AX, dY = BY - AY, dZ = BZ - AZ;
+    double len2 = dX * dX + dY * dY + dZ * dZ;
+    double t = 0;
+    double qX, qY, qZ;
+
+    if (len2 > 0)
+        t = ((PX - AX) * dX + (PY - AY) * dY + (PZ - AZ) * dZ) / len2;
+    if (t < 0)
+        t = 0;
+    if (t > 1)
+        t = 1;
+
+    qX = AX + t * dX;
+    qY = AY + t * dY;
+    qZ = AZ + t * dZ;
+
+    if (sqrt((PX - qX) * (PX - qX) + (PY - qY) * (PY - qY)) > decimate_tolerance)
+        return false;
+    if (fabs(PZ - qZ) > decimate_z_tolerance)
+        return false;
+    return true;
+}
+
+struct point {
+    double X, Y, Z;
+};
+
+/*
+ * Marks the points that must stay in keep[]. Chains can be as long as the file,
+ * so the ranges still to split go on an explicit stack instead of recursing.
+ */
+static void douglas_peucker(std::vector<struct point> &pts, std::vector<bool> &keep)
+{
+    std::vector<std::pair<unsigned int, unsigned int>> todo;
+
+    todo.push_back({0, pts.size() - 1});
+    while (todo.size() > 0) {
+        unsigned int from = todo.back().first, to = todo.back().second;
+        struct point *a = &pts[from], *b = &pts[to];
+        unsigned int i, worst = 0;
+        double worstd = -1;
+
+        todo.pop_back();
+        if (to <= from + 1)
+            continue;
+
+        for (i = from + 1; i < to; i++) {
+            struct point *p = &pts[i];
+            double d;
+
+            if (within_tolerance(a->X, a->Y, a->Z, b->X, b->Y, b->Z, p->X, p->Y, p->Z))
+                continue;
+
+            d = dist3(a->X, a->Y, a->Z, p->X, p->Y, p->Z) + dist3(p->X, p->Y, p->Z, b->X, b->Y, b->Z);
+            if (d > worstd) {
+                worstd = d;
+                worst = i;
+            }
+        }
+
+        if (worstd < 0)
+            continue;
+
+        keep[worst] = true;
+        todo.push_back({worst, to});
+        todo.push_back({from, worst});
+    }
+}
+
+/*
+ * A line only names the axes it moves, the others stay where the line before left them.
+ * With the lines in between dropped, the original text still means the same move as long
+ * as every axis it does not name starts out at the same value as before.
+ */
+static bool raw_text_still_valid(struct element *e, struct point *old_start, struct point *new_start)
+{
+    struct gcode_block block;
+    struct gcode_word words[GCODE_MAX_WORDS];
+    bool hasX = false, hasY = false, hasZ = false;
+    unsigned int i;
+
+    if (!e->raw_gcode)
+        return false;
+
+    gcode_tokenize_line(e->raw_gcode, e->raw_gcode + e->raw_length, &block, words, GCODE_MAX_WORDS);
+    for (i = 0; i < block.nwords; i++) {
+        if (words[i].letter == 'X')
+            hasX = true;
+        if (words[i].letter == 'Y')
+            hasY = true;
+        if (words[i].letter == 'Z')
+            hasZ = true;
+    }
+
+    if (!hasX && old_start->X != new_start->X)
+        return false;
+    if (!hasY && old_start->Y != new_start->Y)
+        return false;
+    if (!hasZ && old_start->Z != new_start->Z)
+        return false;
+    return true;
+}
+
+static void decimate_chain(std::vector<struct element *> &chain, std::vector<struct element *> &out)
+{
+    std::vector<struct point> pts;
+    std::vector<bool> keep;
+    struct point prev;
+    unsigned int i;
+    bool gap = false;
+
+    /* point 0 is the start of the chain, point i the end of chain[i - 1] */
+    pts.push_back({X1_of(chain[0]), Y1_of(chain[0]), Z1_of(chain[0])});
+    for (auto e: chain)
+        pts.push_back({X2_of(e), Y2_of(e), Z2_of(e)});
+
+    keep.resize(pts.size(), false);
+    keep[0] = true;
+    keep[pts.size() - 1] = true;
+    douglas_peucker(pts, keep);
+
+    prev = pts[0];
+    for (i = 1; i < pts.size(); i++) {
+        struct element *e = chain[i - 1];
+        if (!keep[i]) {
+            stat_pass_decimate++;
+            gap = true;
+            continue;
+        }
+        if (gap) {
+            struct point old_start = {X1_of(e), Y1_of(e), Z1_of(e)};
+
+            /* otherwise the emitter writes the line out fresh from the movement */
+            if (!raw_text_still_valid(e, &old_start, &prev))
+                e->raw_gcode = NULL;
+            X1_of(e) = prev.X;
+            Y1_of(e) = prev.Y;
+            Z1_of(e) = prev.Z;
+            gap = false;
+        }
+        out.push_back(e);
+        prev = pts[i];
+    }
+}
+
+void pass_decimate(struct element *e)
+{
+    std::vector<struct element *> out;
+    std::vector<struct element *> chain;
+
+    for (auto c: children(e))
+        pass_decimate(c);
+
+    if (e->type != TYPE_CONTAINER || e->children_count < 3)
+        return;
+
+    for (auto c: children(e)) {
+        if (chain.size() > 0 && !can_be_in_chain(chain[0], c)) {
+            decimate_chain(chain, out);
+            chain.clear();
+        }
+        if (chain.size() == 0 && !can_be_in_chain(c, c)) {
+            out.push_back(c);
+            continue;
+        }
+        chain.push_back(c);
+    }
+    if (chain.size() > 0)
+        decimate_chain(chain, out);
+
+    set_children(e, out);
+}
@@ -10,22 +10,22 @@ void pass_dependencies(struct element *e)
     unsigned int i, j;
     
     
-    if (e->children.size() < 1)
+    if (e->children_count < 1)
         return;
         
     
-    for (i = 0; i < e->children.size(); i++) {
+    for (i = 0; i < e->children_count; i++) {
         struct element *first;
-        first = e->children[i];
+        first = child(e, i);
         
         /* 
          * Warning: O(N^2) complexity here
          * 
          * We will try to cut this down by honoring barriers and aborting early as often as possible
          */
-        for (j = i + 1; i < e->children.size(); j++) {
+        for (j = i + 1; j < e->children_count; j++) {
             struct element *second;
-            second = e->children[j];
+            second = child(e, j);
             
             /* cut the chain on barriers */
             if (second->is_barrier || second->type != TYPE_CONTAINER) {
@@ -12,7 +12,7 @@ void pass_positioning(struct element *e, struct element *prev)
     }
 
     struct element *p = NULL;
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         pass_positioning(i, p);
         p = i;
     }
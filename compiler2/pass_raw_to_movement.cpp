@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include "gcodetok.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,55 +11,46 @@ static char cG = '0';
 
 static double tool_diameter = 0.0;
 
-static void handle_XYZ(struct element *e, const char *c2) 
+static void handle_XYZ(struct element *e, const struct gcode_word *words, unsigned int nwords) 
 {
     double nX = cX;
     double nY = cY;
     double nZ = cZ;
     double nF = cF;
-    char *c;
+    unsigned int i;
     
-    c = (char *)c2;
-    
-    
-    while (c && strlen(c) > 0) {
-        if (c[0] == ' ') {
-            c++;
-            continue;
-        }
-        
-        if (c[0] == 'X') {
-            nX = strtod(c + 1, &c);
-            continue;
-        }
-        if (c[0] == 'Y') {
-            nY = strtod(c + 1, &c);
-            continue;
-        }
-        if (c[0] == 'Z') {
-            nZ = strtod(c + 1, &c);
-            continue;
-        }
-        if (c[0] == 'F') {
-            nF = strtod(c + 1, &c);
-            continue;
+    for (i = 0; i < nwords; i++) {
+        switch (words[i].letter) {
+        case 'X':
+            nX = words[i].value;
+            break;
+        case 'Y':
+            nY = words[i].value;
+            break;
+        case 'Z':
+            nZ = words[i].value;
+            break;
+        case 'F':
+            nF = words[i].value;
+            break;
+        default:
+            printf("Invalid option in -%c- out of %.*s\n", words[i].letter, (int)e->raw_length, e->raw_gcode);
+            cValid = false;
+            return;
         }
-        printf("Invalid option in -%s- out of %s\n", c, c2);
-        cValid = false;
-        return;
     }
     
-    e->tool_diameter = tool_diameter;
+    tool_diameter_of(e) = tool_diameter;
     
     if (cValid) {
         e->glevel = cG;
-        e->X1 = cX;
-        e->Y1 = cY;
-        e->Z1 = cZ;
-        e->X2 = nX;
-        e->Y2 = nY;
-        e->Z2 = nZ;
-        e->feed = nF;
+        X1_of(e) = cX;
+        Y1_of(e) = cY;
+        Z1_of(e) = cZ;
+        X2_of(e) = nX;
+        Y2_of(e) = nY;
+        Z2_of(e) = nZ;
+        feed_of(e) = nF;
         e->type = TYPE_MOVEMENT;
         stat_pass_raw_to_movement++;
     }
@@ -73,37 +65,34 @@ static void handle_XYZ(struct element *e, const char *c2)
     cValid = true;
 }
 
-static void handle_G(struct element *e, const char *c) 
+static void handle_G(struct element *e, const struct gcode_word *words, unsigned int nwords) 
 {
-    if (strlen(c) < 2)
+    if (nwords < 1)
         return;
         
     /* bit change goes to high Z */
-    if (strstr(c, "G53G0Z")) {
+    if (memmem(e->raw_gcode, e->raw_length, "G53G0Z", 6)) {
         cZ = 1000;
         e->is_vertical = true;
     }
     /* for now, only handle G0/G1 */
-    if (c[1] <'0' || c[1] > '1') {
-        cValid = false;
-        return;
-    }
-    /* check the second digit to make sure we only look at single digit G levels */
-    if (strlen(c) > 2 && c[2] >= '0' && c[2] <= '9') {
+    if (words[0].fixed != 0 && words[0].fixed != 10000) {
         cValid = false;
         return;
     }
         
-    cG = c[1];
-    handle_XYZ(e, c + 2);
+    cG = words[0].fixed ? '1' : '0';
+    handle_XYZ(e, words + 1, nwords - 1);
 }
 
-static void handle_comment(struct element *e, const char *line)
+static void handle_comment(struct element *e, const struct gcode_block *block)
 {
     double d;
+    char line[4096];
     
     e->is_barrier = true;
     const char *c;
+    gcode_block_text(block, line, sizeof(line));
     c = strstr(line, "(TOOL/MILL,");
     if (!c)
         return;
@@ -115,22 +104,27 @@ static void handle_comment(struct element *e, const char *line)
 
 void pass_raw_to_movement(struct element *e)
 {
-    if (e->type == TYPE_RAW) {
+    if (e->type == TYPE_RAW && e->raw_length > 0) {
+        struct gcode_block block;
+        struct gcode_word words[GCODE_MAX_WORDS];
+        
+        gcode_tokenize_line(e->raw_gcode, e->raw_gcode + e->raw_length, &block, words, GCODE_MAX_WORDS);
+        
         if (e->raw_gcode[0] == 'G')
-            handle_G(e, e->raw_gcode);
+            handle_G(e, words, block.nwords);
         if (e->raw_gcode[0] == 'M') {
             e->is_barrier = true;
         }
         if (e->raw_gcode[0] == '(') {
-            handle_comment(e, e->raw_gcode);
+            handle_comment(e, &block);
         }
         if (e->raw_gcode[0] == 'X' || e->raw_gcode[0] == 'Y' || e->raw_gcode[0] == 'Z')
-            handle_XYZ(e, e->raw_gcode);
+            handle_XYZ(e, words, block.nwords);
         
     }
 
 
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         pass_raw_to_movement(i);
     }
 }
\ No newline at end of file
@@ -14,14 +14,14 @@ void pass_split_cut(struct element *e)
     int state = 0;
     
     
-    if (e->children.size() < 1)
+    if (e->children_count < 1)
         return;
         
     
-    for (i = 0; i < e->children.size(); i++) {
+    for (i = 0; i < e->children_count; i++) {
         int need_flush = 0;
         struct element *t;
-        t = e->children[i];
+        t = child(e, i);
         
         if (t->type != TYPE_MOVEMENT && state != 0) {
             need_flush = state;
@@ -58,11 +58,11 @@ void pass_split_cut(struct element *e)
             struct element *target;
             target = new_element(TYPE_CONTAINER, "Cut path");
             target->is_split_already = true;
-            move_children_to_element(e, target, start, e->children.size() - 1);
+            move_children_to_element(e, target, start, e->children_count - 1);
             state = 0;
     }
 
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         if (!i->is_split_already)
             pass_split_cut(i);
     }
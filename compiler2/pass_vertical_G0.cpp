@@ -7,15 +7,15 @@
 
 void pass_vertical_G0(struct element *e)
 {
-    if (e->type == TYPE_MOVEMENT && e->X1 == e->X2 && e->Y1 == e->Y2 && e->Z1 < e->Z2 && e->Z2 >= retractZ) {
+    if (e->type == TYPE_MOVEMENT && X1_of(e) == X2_of(e) && Y1_of(e) == Y2_of(e) && Z1_of(e) < Z2_of(e) && Z2_of(e) >= retractZ) {
         e->is_retract = true;
     }
-    if (e->type == TYPE_MOVEMENT && e->X1 == e->X2 && e->Y1 == e->Y2) {
+    if (e->type == TYPE_MOVEMENT && X1_of(e) == X2_of(e) && Y1_of(e) == Y2_of(e)) {
         e->is_vertical = true;
     }
 
 
-    for (auto i: e->children) {
+    for (auto i: children(e)) {
         pass_vertical_G0(i);
     }
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+ * The ready set holds all elements that can be emitted next (depends_refcount == 0).
+ * Elements are bucketed in a uniform XY grid on their entry point (X1,Y1) so that
+ * finding the nearest one to the current tool position only needs to look at the
+ * cells around that position, instead of re-sorting all children after every emit.
+ *
+ * The ranking is the same as the old sort: nearest (3D) entry point first,
+ * ties broken by the lowest sequence number.
+ */
+
+long int stat_readyset_probes;
+
+void readyset_init(struct readyset *rs, struct element *parent)
+{
+    double minX = 500000000000000000, minY = 500000000000000000;
+    double maxX = -500000000000000000, maxY = -500000000000000000;
+    double span;
+    int grid;
+
+    for (auto e : children(parent)) {
+        minX = fmin(minX, X1_of(e));
+        minY = fmin(minY, Y1_of(e));
+        maxX = fmax(maxX, X1_of(e));
+        maxY = fmax(maxY, Y1_of(e));
+    }
+    if (parent->children_count == 0) {
+        minX = minY = maxX = maxY = 0;
+    }
+
+    /* aim for a handful of elements per cell */
+    grid = (int)sqrt(parent->children_count / 4.0) + 1;
+    span = fmax(maxX - minX, maxY - minY);
+    if (span <= 0)
+        span = 1;
+
+    rs->originX = minX;
+    rs->originY = minY;
+    rs->cellsize = span / grid;
+    rs->gridX = (int)((maxX - minX) / rs->cellsize) + 1;
+    rs->gridY = (int)((maxY - minY) / rs->cellsize) + 1;
+    rs->cells.clear();
+    rs->cells.resize(rs->gridX * rs->gridY);
+    rs->count = 0;
+}
+
+static int cell_x(struct readyset *rs, double X)
+{
+    int x = (int)floor((X - rs->originX) / rs->cellsize);
+    if (x < 0)
+        x = 0;
+    if (x >= rs->gridX)
+        x = rs->gridX - 1;
+    return x;
+}
+
+static int cell_y(struct readyset *rs, double Y)
+{
+    int y = (int)floor((Y - rs->originY) / rs->cellsize);
+    if (y < 0)
+        y = 0;
+    if (y >= rs->gridY)
+        y = rs->gridY - 1;
+    return y;
+}
+
+void readyset_insert(struct readyset *rs, struct element *e)
+{
+    int x = cell_x(rs, X1_of(e));
+    int y = cell_y(rs, Y1_of(e));
+
+    rs->cells[y * rs->gridX + x].push_back(e);
+    rs->count++;
+}
+
+struct element *readyset_pop_nearest(struct readyset *rs, double X, double Y, double Z)
+{
+    int cx, cy, r, maxr;
+    struct element *best = NULL;
+    double bestd = 0;
+    int bestcell = -1;
+    unsigned int bestindex = 0;
+
+    if (rs->count == 0)
+        return NULL;
+
+    cx = cell_x(rs, X);
+    cy = cell_y(rs, Y);
+    maxr = rs->gridX;
+    if (rs->gridY > maxr)
+        maxr = rs->gridY;
+
+    for (r = 0; r <= maxr; r++) {
+        int x, y;
+
+        /*
+         * every cell in ring r is at least (r-1) cells away from the query point,
+         * even when the point lies outside the grid and got clamped to the edge
+         */
+        if (best && (r - 1) * rs->cellsize > bestd)
+            break;
+
+        for (y = cy - r; y <= cy + r; y++) {
+            if (y < 0 || y >= rs->gridY)
+                continue;
+            for (x = cx - r; x <= cx + r; x++) {
+                int cell;
+                if (x < 0 || x >= rs->gridX)
+                    continue;
+                /* only walk the border of the ring */
+                if (y != cy - r && y != cy + r && x != cx - r && x != cx + r)
+                    continue;
+
+                cell = y * rs->gridX + x;
+                for (unsigned int i = 0; i < rs->cells[cell].size(); i++) {
+                    struct element *e = rs->cells[cell][i];
+                    double d = dist3(X, Y, Z, X1_of(e), Y1_of(e), Z1_of(e));
+                    stat_readyset_probes++;
+
+                    if (!best || d < bestd || (d == bestd && e->sequence < best->sequence)) {
+                        best = e;
+                        bestd = d;
+                        bestcell = cell;
+                        bestindex = i;
+                    }
+                }
+            }
+        }
+    }
+
+    if (best) {
+        std::vector<struct element *> &c = rs->cells[bestcell];
+        c[bestindex] = c.back();
+        c.pop_back();
+        rs->count--;
+    }
+    return best;
+}
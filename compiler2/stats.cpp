@@ -3,15 +3,80 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <cstring>
+#include <math.h>
 
 int stat_pass_raw_to_movement;
 int stat_pass_vertical_G0;
 int stat_pass_split_rings;
 
+int stat_blocks_in, stat_blocks_out;
+double stat_time_in, stat_time_out;
+
+/* number of G-code lines this element will produce */
+int count_blocks(struct element *e)
+{
+    int count = 0;
+    
+    if (e->type != TYPE_CONTAINER)
+        count++;
+    for (auto i: children(e))
+        count += count_blocks(i);
+    return count;
+}
+
+struct kinematics machine_kinematics;
+
+static void simulate_element(struct machinetime *mt, struct element *e)
+{
+    if (e->type == TYPE_MOVEMENT) {
+        double feed = feed_of(e);
+        if (e->glevel == '0')
+            feed = 0;
+        if (is_arc(e))
+            machinetime_arc(mt, X1_of(e), Y1_of(e), Z1_of(e), X2_of(e), Y2_of(e), Z2_of(e), I_of(e), J_of(e),
+                            e->glevel == '2', feed);
+        else
+            machinetime_move(mt, X1_of(e), Y1_of(e), Z1_of(e), X2_of(e), Y2_of(e), Z2_of(e), feed);
+    }
+    for (auto i: children(e))
+        simulate_element(mt, i);
+}
+
+/*
+ * Machine time in minutes for a list of elements run back to back, from a
+ * standstill to a standstill. Passes use this as their objective function.
+ */
+double estimate_machine_time(std::vector<struct element *> &elements)
+{
+    struct machinetime mt;
+
+    machinetime_init(&mt, &machine_kinematics);
+    for (auto i: elements)
+        simulate_element(&mt, i);
+    return machinetime_finish(&mt) / 60;
+}
+
+double estimate_machine_time(struct element *e)
+{
+    struct machinetime mt;
+
+    machinetime_init(&mt, &machine_kinematics);
+    simulate_element(&mt, e);
+    return machinetime_finish(&mt) / 60;
+}
+
 void print_stats(void)
 {
     printf("Pass statistics\n");
     printf("\traw_to_movement      : %i\n", stat_pass_raw_to_movement);
     printf("\tvertical_G0          : %i\n", stat_pass_vertical_G0);
     printf("\tsplit_rings          : %i\n", stat_pass_split_rings);
+    printf("\tarc_fit              : %i arcs replacing %i segments\n", stat_pass_arc_fit, stat_pass_arc_fit_segments);
+    printf("\tdecimate             : %i segments removed\n", stat_pass_decimate);
+    printf("\tblocks               : %i -> %i\n", stat_blocks_in, stat_blocks_out);
+    printf("\testimated time       : %5.2f -> %5.2f minutes\n", stat_time_in, stat_time_out);
+    printf("\treadyset probes      : %li\n", stat_readyset_probes);
+    printf("\tarena bytes          : %lu\n", (unsigned long)stat_arena_bytes);
+    printf("\tdependency edges     : %lu\n", (unsigned long)dependency_edges.size());
+    printf("\telements             : %u\n", count_elements());
 }
\ No newline at end of file
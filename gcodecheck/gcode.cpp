@@ -15,6 +15,8 @@
 #include <vector>
 
 #include "gcodecheck.h"
+#include "../compiler2/gcodetok.h"
+#include "../compiler2/machinetime.h"
 
 
 static std::vector<struct line *> lines;
@@ -46,6 +48,8 @@ static double diameter;
 static double angle;
 static double speedlimit, plungelimit;
 
+static struct machinetime machinetime;
+
 static double to_mm(double x)
 {
 	if (metric)
@@ -153,14 +157,11 @@ static void record_motion_XYZ(double fX, double fY, double fZ, double tX, double
 //	printf("XYZ movement from %5.2f,%5.2f to %5.2f,%5.2f\n", currentX, currentY, X, Y);
 }
 
-static int xyzline(char *line, int nr)
+static int xyzline(const char *line, const struct gcode_word *words, unsigned int nwords, int nr)
 {
-	char *c;
+	unsigned int i;
 	double X,Y,Z;
 
-	while (line[0] == ' ')
-		line++;
-
 	if (absolute == 1) {
 		X = currentX;
 		Y = currentY;
@@ -170,28 +171,21 @@ static int xyzline(char *line, int nr)
 		Y = 0.0;
 		Z = 0.0;
 	}
-	if (strlen(line) == 0)
+	if (nwords == 0)
 		return 1;
-	c = line;
 	
-	while (strlen(c) > 0) {
-		char *c2;
-
-		if (c[0] == 'X') {
-			X = to_mm(strtod(c+1, &c2));
-			c = c2;
-		} else if (c[0] == 'Y') {
-			Y = to_mm(strtod(c+1, &c2));
-			c = c2;
-		} else if (c[0] == 'Z') {
-			Z = to_mm(strtod(c+1, &c2));
-			c = c2;
-		} else if (c[0] == 'F') {
-			speed = strtod(c+1, &c2);
-			c = c2;
+	for (i = 0; i < nwords; i++) {
+		if (words[i].letter == 'X') {
+			X = to_mm(words[i].value);
+		} else if (words[i].letter == 'Y') {
+			Y = to_mm(words[i].value);
+		} else if (words[i].letter == 'Z') {
+			Z = to_mm(words[i].value);
+		} else if (words[i].letter == 'F') {
+			speed = words[i].value;
 		} else {
 			printf("Unknown XYZ command: %s\n", line);
-			*c = 0;
+			break;
 		}
 	}
 
@@ -201,8 +195,10 @@ static int xyzline(char *line, int nr)
 		Z += currentZ;
 	}
 
-	if (!first_coord)
+	if (!first_coord) {
 		record_motion_XYZ(currentX, currentY, currentZ, X, Y, Z, nr);
+		machinetime_move(&machinetime, currentX, currentY, currentZ, X, Y, Z, gcommand == 0 ? 0 : to_mm(speed));
+	}
 
 	currentX = X;
 	currentY = Y;
@@ -212,21 +208,26 @@ static int xyzline(char *line, int nr)
 }
 
 
-static int gline(char *line, int nr)
+static int gline(const char *line, const struct gcode_word *words, unsigned int nwords, int nr)
 {
 	int code;
 	int handled = 0;
-	code = strtoull(&line[1], NULL, 10);
 
-	if (code == 0 && line[1] == '0') {
+	/* fractional codes such as G38.2 are not supported */
+	if (words[0].fixed % 10000)
+		code = -1;
+	else
+		code = words[0].fixed / 10000;
+
+	if (code == 0) {
 		gcommand = 0;
 		handled = 1;
-		xyzline(line + 2, nr);
+		xyzline(line, words + 1, nwords - 1, nr);
 	}
-	if (code == 1 && line[1] == '1') {
+	if (code == 1) {
 		gcommand = 1;
 		handled = 1;
-		xyzline(line + 2, nr);
+		xyzline(line, words + 1, nwords - 1, nr);
 	}
 	
 	if (code == 20) {
@@ -252,6 +253,7 @@ static int gline(char *line, int nr)
 
 	if (code == 53) { /* G53 is "absolute move once line" which is for bit changes/etc */
 		handled = 1;
+		machinetime_stop(&machinetime);
 		first_coord = true;
 		need_homing_switches = true;
 	}
@@ -264,11 +266,11 @@ static int gline(char *line, int nr)
 }
 
 
-static int mline(char *line)
+static int mline(char *line, const struct gcode_word *words)
 {
 	int code;
 	int handled = 0;
-	code = strtoull(&line[1], NULL, 10);
+	code = words[0].fixed / 10000;
 
 	if (code == 2) {
 		vprintf("Program end\n");
@@ -300,6 +302,7 @@ static int mline(char *line)
 		if (*c == 'T') c++;
 		t = strtoull(c, NULL, 10);
 		activate_tool(t);
+		machinetime_stop(&machinetime);
 		handled = 1;
 	}
 	if (code == 30) {
@@ -314,35 +317,28 @@ static int mline(char *line)
 	return handled;
 }
 
-static void parse_line(char *line, int nr)
+static void parse_line(const struct gcode_block *block, const struct gcode_word *words)
 {
 	int handled = 0;
-	char *c;
-	c = strchr(line, '\n');
-	if (c) *c = 0;
+	int nr = block->linenr;
+	char line[8192];
+
+	/* the block points into the mapped file; only copy for messages and the M6 tool list */
+	gcode_block_text(block, line, sizeof(line));
 
 	if (line[0] == '%')
 		return;
 	if (line[0] == '(')
 		return;
 
-	if (line[0] == 'G') {
-		handled += gline(line, nr);
-	}
-	if (line[0] == 'M') {
-		handled += mline(line);
-	}
-	if (line[0] == 'X') {
-		handled += xyzline(line, nr);
-	}
-	if (line[0] == 'Y') {
-		handled += xyzline(line, nr);
+	if (line[0] == 'G' && block->nwords > 0) {
+		handled += gline(line, words, block->nwords, nr);
 	}
-	if (line[0] == 'Z') {
-		handled += xyzline(line, nr);
+	if (line[0] == 'M' && block->nwords > 0) {
+		handled += mline(line, words);
 	}
-	if (line[0] == 'F') {
-		handled += xyzline(line, nr);
+	if (line[0] == 'X' || line[0] == 'Y' || line[0] == 'Z' || line[0] == 'F') {
+		handled += xyzline(line, words, block->nwords, nr);
 	}
 
 
@@ -354,24 +350,25 @@ static void parse_line(char *line, int nr)
 
 void read_gcode(const char *filename)
 {
-	FILE *file;
-	int linenr = 0;
+	struct gcode_map map;
+	struct gcode_reader reader;
+	struct gcode_block block;
+	struct gcode_word words[GCODE_MAX_WORDS];
 
 	vprintf("Parsing %s\n", filename);
-	file = fopen(filename, "r");
-	if (!file) {
+	if (!gcode_map_file(&map, filename)) {
 		error("Error opening file: %s\n", strerror(errno));
+		return;
 	}
-	while (!feof(file)) {
-		char line[8192];
-		line[0] = 0;
-		if (!fgets(line, 8192, file))
-			break;
-		linenr++;
-		if (line[0] != 0)
-			parse_line(line, linenr);
+	machinetime_init(&machinetime, NULL);
+	gcode_reader_init(&reader, &map);
+	while (gcode_next_block(&reader, &block, words, GCODE_MAX_WORDS)) {
+		if (block.length > 0)
+			parse_line(&block, words);
 	}
-	fclose(file);
+	gcode_unmap_file(&map);
+	machinetime_finish(&machinetime);
+	printf("Estimated machine time: %5.2f minutes (%5.2f minutes rapids)\n", machinetime.seconds / 60, machinetime.rapid_seconds / 60);
 }
 
 double depth_at_XY(double X, double Y)
@@ -569,3 +566,18 @@ void set_tool_imperial(const char *name, int nr, double diameter_inch, double st
 	angle = get_tool_angle(toolnr);
 
 }
+
+void set_tool_metric(const char *name, int nr, double diameter_mm, double stepover_mm, double maxdepth_mm, double feedrate_metric, double plungerate_metric)
+{
+	unused(stepover_mm);
+	unused(name);
+	unused(maxdepth_mm);
+
+	vprintf("Switching to tool %i\n", nr);
+	toolnr = nr;
+	diameter = diameter_mm;
+	speedlimit = feedrate_metric;
+	plungelimit = plungerate_metric;
+	angle = get_tool_angle(toolnr);
+
+}
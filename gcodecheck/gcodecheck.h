@@ -41,6 +41,7 @@ static inline double radius_to_depth(double r, double angle) { return -r / tan(a
 
 extern "C" {
 extern void set_tool_imperial(const char *name, int nr, double diameter_inch, double stepover_inch, double maxdepth_inch, double feedrate_ipm, double plungerate_ipm);
+extern void set_tool_metric(const char *name, int nr, double diameter_mm, double stepover_mm, double maxdepth_mm, double feedrate_metric, double plungerate_metric);
 extern void read_tool_lib(const char *filename);
 extern void activate_tool(int nr);
 extern double get_tool_angle(int toolnr);
@@ -37,22 +37,19 @@ render::render(const char *filename)
 
 void render::load(void)
 {
-    FILE *file;
-    char *line;
+    struct gcode_map map;
+    struct gcode_reader reader;
+    struct gcode_block block;
+    struct gcode_word words[GCODE_MAX_WORDS];
     int lines = 0;
-    file = fopen(fname, "rm");
-    if (!file)
+    if (!gcode_map_file(&map, fname))
         return;
-    while (!feof(file)) {
-        size_t s = 0;
-        line = NULL;
-        if (getline(&line, &s, file) < 0)
-            break;
-        parse_line(line);
-        free(line);       
+    gcode_reader_init(&reader, &map);
+    while (gcode_next_block(&reader, &block, words, GCODE_MAX_WORDS)) {
+        parse_line(&block, words);
         lines++;
     }
-    fclose(file);
+    gcode_unmap_file(&map);
     printf("Read %i lines\n", lines);
 }
 
@@ -121,8 +118,18 @@ void render::setup_canvas(void)
 }
 
 
-void render::parse_line(const char *line)
+void render::parse_line(const struct gcode_block *block, const struct gcode_word *words)
 {
+    char line[4096];
+
+    /* movement lines are the bulk of the file and only need the words */
+    if (block->length > 0 && (block->text[0] == 'G' || block->text[0] == 'X' || block->text[0] == 'Y' || block->text[0] == 'Z')) {
+        parse_g_line(block, words);
+        return;
+    }
+
+    gcode_block_text(block, line, sizeof(line));
+
 //    (stockMax:127.00mm
     if (strncmp(line, "(stockMax ", 9) == 0) {
         const char *c;
@@ -175,11 +182,6 @@ void render::parse_line(const char *line)
             
         return;
     }    
-    if (line[0] == 'G' || line[0] == 'X' || line[0] == 'Y' || line[0] == 'Z') {
-        parse_g_line(line);
-        return;
-    }
-    
     if (line[0] == 'M' || line[0] =='T') {
         const char *c;
         /* nothing much to do with M or T or comment lines for now but reset Z*/
@@ -202,46 +204,35 @@ void render::parse_line(const char *line)
     
 }
 
-void render::parse_g_line(const char *line)
+void render::parse_g_line(const struct gcode_block *block, const struct gcode_word *words)
 {
-    char *c;
+    unsigned int i;
     double nX, nY, nZ;
     
     nX = cX;
     nY = cY;
     nZ = cZ;
     
-    if (strstr(line, "G53"))
-        return;
-    
-    c = (char *)line;
-    while (strlen(c) > 0) {
-        if (*c == 'G') {
-            c++;
-            strtoull(c, &c, 10);
-            continue;
-        }
-        if (*c == 'X') {
-            nX = strtod(c +1, &c);
-            continue;
-        }
-        if (*c == 'Y') {
-            nY = strtod(c +1, &c);
-            continue;
-        }
-        if (*c == 'Z') {
-            nZ = strtod(c +1, &c);
-            continue;
-        }
-        if (*c == 'F') {
-            strtod(c +1, &c);
-            continue;
-        }
-        if (*c == ' ' || *c == '\n') {
-            c++;
-            continue;
+    for (i = 0; i < block->nwords; i++) {
+        switch (words[i].letter) {
+        case 'G':
+            if (words[i].fixed == 530000)
+                return;
+            break;
+        case 'X':
+            nX = words[i].value;
+            break;
+        case 'Y':
+            nY = words[i].value;
+            break;
+        case 'Z':
+            nZ = words[i].value;
+            break;
+        case 'F':
+            break;
+        default:
+            printf("Unknown word %c in line %i\n", words[i].letter, block->linenr);
         }
-        printf("Line is %s  %s\n",c, line);
     }
     movement(cX, cY, cZ, nX, nY, nZ);
     cX = nX;
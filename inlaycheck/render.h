@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../compiler2/gcodetok.h"
+
 
 
 class render {
@@ -67,8 +69,8 @@ private:
     
     void setup_canvas(void);
     
-    void parse_line(const char *line);
-    void parse_g_line(const char *line);
+    void parse_line(const struct gcode_block *block, const struct gcode_word *words);
+    void parse_g_line(const struct gcode_block *block, const struct gcode_word *words);
     void movement(double X1, double Y1, double Z1, double X2, double Y2,double Z2);
     void tooltouch(double X, double Y, double Z);
 };
\ No newline at end of file
@@ -18,6 +18,8 @@ extern int image_X(void);
 extern int image_Y(void);
 extern double scale_Z(void);
 extern double get_height(double X, double Y);
+extern void start_band_rasterizer(void);
+extern void rasterize_band(float *zbuf, int width, int y0, int y1, int nthreads);
 extern void create_image(char *filename);
 extern void reset_triangles(void);
 #endif
\ No newline at end of file
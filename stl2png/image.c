@@ -8,20 +8,63 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <pthread.h>
 #include <png.h>
 
 #include "fenrus.h"
 
 extern int verbose;
+extern int png_bits;
+extern int threads;
+extern int band_rows;
 
+/*
+ * The image is streamed out in bands of rows: while the rasterizer fills one band
+ * buffer, a writer thread hands the previous band to libpng, so encoding overlaps
+ * rendering and memory stays at two bands regardless of the image size.
+ */
+struct band_writer {
+	png_structp png;
+	float *zbuf;
+	unsigned char *row;
+	int width;
+	int y0, y1;
+	double scale;
+};
+
+/* PNG rows go top to bottom, which is from the highest Y down */
+static void *write_band(void *data)
+{
+	struct band_writer *w = data;
+	int x, y;
+
+	for (y = w->y1 - 1; y >= w->y0; y--) {
+		float *Z = &w->zbuf[(y - w->y0) * w->width];
+		for (x = 0; x < w->width; x++) {
+			if (png_bits == 16) {
+				/* 16 bit PNG samples are big endian */
+				unsigned int value = w->scale * 257 * Z[x];
+				if (value > 65535)
+					value = 65535;
+				w->row[2 * x] = value >> 8;
+				w->row[2 * x + 1] = value & 255;
+			} else {
+				w->row[x] = w->scale * Z[x];
+			}
+		}
+		png_write_row(w->png, w->row);
+	}
+	return NULL;
+}
 
 void create_image(char *filename)
 {
 	int maxX, maxY;
-	double scale;
-	unsigned char *pixels;
+	int rows, top, bands = 0;
+	float *zbuf[2];
+	struct band_writer writer;
+	pthread_t writer_thread;
 	FILE *file;
-	int x, y;
 
 	png_structp png;
 	png_infop info;
@@ -32,31 +75,59 @@ void create_image(char *filename)
 
 	maxX = image_X();
 	maxY = image_Y();
-	scale = scale_Z();
-
-	pixels = calloc(maxX, maxY);
-
-	for (y = 0; y < maxY; y++) {
-		for (x = 0; x < maxX; x++) {
-			pixels[x + y * maxX] = scale * get_height(x, y);
-		}
-		if (verbose) {
-			printf("\rLine %i",y);
-			fflush(stdout);
-		}
-	}
 
+	rows = band_rows;
+	if (rows < 1 || rows > maxY)
+		rows = maxY;
+	zbuf[0] = calloc(maxX, rows * sizeof(float));
+	zbuf[1] = calloc(maxX, rows * sizeof(float));
 
 	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	info = png_create_info_struct(png);
 
 	png_init_io(png, file);
-	png_set_IHDR(png, info, maxX, maxY, 8, PNG_COLOR_TYPE_GRAY,
+	png_set_IHDR(png, info, maxX, maxY, png_bits, PNG_COLOR_TYPE_GRAY,
 		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 	png_write_info(png, info);
-	for (y = 0; y < maxY; y++)
-		png_write_row(png, &pixels[(maxY - y - 1) * maxX]);
+
+	writer.png = png;
+	writer.row = calloc(maxX, 2);
+	writer.width = maxX;
+	writer.scale = scale_Z();
+
+	start_band_rasterizer();
+	for (top = maxY; top > 0; top -= rows) {
+		int y0 = top - rows;
+		float *buffer = zbuf[bands % 2];
+
+		if (y0 < 0)
+			y0 = 0;
+
+		rasterize_band(buffer, maxX, y0, top, threads);
+
+		if (bands > 0)
+			pthread_join(writer_thread, NULL);
+		writer.zbuf = buffer;
+		writer.y0 = y0;
+		writer.y1 = top;
+		pthread_create(&writer_thread, NULL, write_band, &writer);
+		bands++;
+
+		if (verbose) {
+			printf("\rBand %i, line %i   ", bands, y0);
+			fflush(stdout);
+		}
+	}
+	if (bands > 0)
+		pthread_join(writer_thread, NULL);
+	if (verbose)
+		printf("\nRendered %i bands of %i rows on %i threads\n", bands, rows, threads);
+
 	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
 
+	free(zbuf[0]);
+	free(zbuf[1]);
+	free(writer.row);
 	fclose(file);
 }
\ No newline at end of file
@@ -16,13 +16,20 @@
 static int resolution = 512;
 
 int verbose = 0;
+int png_bits = 8;
+int threads = 1;
+int band_rows = 256;
 
 int main(int argc, char **argv)
 {	
 	char *output, *stl;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "r:v")) != -1) {
+#ifdef _SC_NPROCESSORS_ONLN
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	while ((opt = getopt(argc, argv, "r:vdt:b:")) != -1) {
 		switch (opt)
 		{
 			case 'r':
@@ -32,6 +39,15 @@ int main(int argc, char **argv)
 			case 'v':
 				verbose = 1;
 				break;
+			case 'd':
+				png_bits = 16;
+				break;
+			case 't':
+				threads = strtoull(optarg, NULL, 10);
+				break;
+			case 'b':
+				band_rows = strtoull(optarg, NULL, 10);
+				break;
 			
 			default:
 				printf("Usage:\n\tstl2c2d <file.stl>\n");
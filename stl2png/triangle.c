@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "fenrus.h"
 
@@ -18,6 +19,11 @@ static int maxtriangle = 0;
 static int current = 0;
 static struct triangle *triangles;
 
+static int *sorted;		/* triangles, highest maxY first */
+static int next_sorted;
+static int *active;
+static int nractive;
+
 
 static float minX = 100000;
 static float maxX = -100000;
@@ -30,6 +36,11 @@ void reset_triangles(void)
 {
 	free(triangles);
 	triangles = NULL;
+	free(sorted);
+	sorted = NULL;
+	free(active);
+	active = NULL;
+	nractive = 0;
 	current = 0;
 	maxtriangle = 0;
 	minX = 100000;
@@ -257,3 +268,177 @@ double get_height(double X, double Y)
 	return value;
 }
 
+
+
+/*
+ * Z-buffer rasterizer: rather than asking get_height() for every pixel (which tests
+ * every triangle), every triangle walks the pixels of its own footprint, row by row.
+ *
+ * The image is rendered in horizontal bands from the top (highest Y) down, so that
+ * rows can be written out as soon as their band is done and only a band has to be
+ * in memory. Triangles are sorted on their top Y; each band takes in the triangles
+ * that start above its bottom and drops the ones that ended above it, so only the
+ * triangles that intersect the band get looked at.
+ * A band is split again into one range of rows per thread; a thread only writes its
+ * own rows so no locking is needed.
+ * Pixels are sampled at integer coordinates with the same inside test and Z math as
+ * get_height(), so the result is identical.
+ */
+struct raster_job {
+	float *zbuf;		/* holds the rows of the band, starting at band_y0 */
+	int width;
+	int band_y0;
+	int y0, y1;		/* rows y0 up to (not including) y1 */
+};
+
+static int compare_maxY(const void *A, const void *B)
+{
+	float a = triangles[*(const int *)A].maxY;
+	float b = triangles[*(const int *)B].maxY;
+
+	if (a > b)
+		return -1;
+	if (a < b)
+		return 1;
+	return *(const int *)A - *(const int *)B;
+}
+
+
+/* the X range where row Y crosses the triangle */
+static int row_span(int i, double Y, double *XL, double *XR)
+{
+	int k;
+	int found = 0;
+
+	*XL = 1e30;
+	*XR = -1e30;
+	for (k = 0; k < 3; k++) {
+		double AX = triangles[i].vertex[k][0], AY = triangles[i].vertex[k][1];
+		double BX = triangles[i].vertex[(k + 1) % 3][0], BY = triangles[i].vertex[(k + 1) % 3][1];
+		double X;
+
+		if ((AY > Y && BY > Y) || (AY < Y && BY < Y))
+			continue;
+		if (AY == BY) {
+			*XL = fmin(*XL, fmin(AX, BX));
+			*XR = fmax(*XR, fmax(AX, BX));
+		} else {
+			X = AX + (Y - AY) * (BX - AX) / (BY - AY);
+			*XL = fmin(*XL, X);
+			*XR = fmax(*XR, X);
+		}
+		found = 1;
+	}
+	return found;
+}
+
+static void rasterize_triangle(struct raster_job *job, int i)
+{
+	int x, y, xstart, xend, ystart, yend;
+
+	ystart = ceilf(triangles[i].minY);
+	yend = floorf(triangles[i].maxY);
+	if (ystart < job->y0)
+		ystart = job->y0;
+	if (yend > job->y1 - 1)
+		yend = job->y1 - 1;
+
+	for (y = ystart; y <= yend; y++) {
+		double XL, XR;
+		float *row = &job->zbuf[(y - job->band_y0) * job->width];
+
+		if (!row_span(i, y, &XL, &XR))
+			continue;
+
+		/* a little slack; within_triangle() has the final say on the edges */
+		xstart = ceil(fmax(XL - 0.001, triangles[i].minX));
+		xend = floor(fmin(XR + 0.001, triangles[i].maxX));
+		if (xstart < 0)
+			xstart = 0;
+		if (xend > job->width - 1)
+			xend = job->width - 1;
+
+		for (x = xstart; x <= xend; x++) {
+			if (!within_triangle(x, y, i))
+				continue;
+			row[x] = fmax(calc_Z(x, y, i), row[x]);
+		}
+	}
+}
+
+static void *raster_thread(void *data)
+{
+	struct raster_job *job = data;
+	int i;
+
+	for (i = 0; i < nractive; i++) {
+		int t = active[i];
+		if (triangles[t].maxY < job->y0 || triangles[t].minY > job->y1 - 1)
+			continue;
+		rasterize_triangle(job, t);
+	}
+	return NULL;
+}
+
+/* sets up for a new image; bands have to be rendered from the top down after this */
+void start_band_rasterizer(void)
+{
+	int i;
+
+	free(sorted);
+	free(active);
+	sorted = calloc(current + 1, sizeof(int));
+	active = calloc(current + 1, sizeof(int));
+	for (i = 0; i < current; i++)
+		sorted[i] = i;
+	qsort(sorted, current, sizeof(int), compare_maxY);
+	next_sorted = 0;
+	nractive = 0;
+}
+
+/* fills zbuf with the heights of rows y0 up to y1, width pixels each */
+void rasterize_band(float *zbuf, int width, int y0, int y1, int nthreads)
+{
+	struct raster_job *jobs;
+	pthread_t *threads;
+	int i, j;
+
+	/* drop the triangles that lie entirely above this band, then take in new ones */
+	for (i = 0, j = 0; i < nractive; i++)
+		if (triangles[active[i]].minY <= y1 - 1)
+			active[j++] = active[i];
+	nractive = j;
+	while (next_sorted < current && triangles[sorted[next_sorted]].maxY >= y0) {
+		int t = sorted[next_sorted++];
+		if (triangles[t].minY <= y1 - 1)
+			active[nractive++] = t;
+	}
+
+	for (i = 0; i < width * (y1 - y0); i++)
+		zbuf[i] = 0;
+
+	if (nthreads > y1 - y0)
+		nthreads = y1 - y0;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	jobs = calloc(nthreads, sizeof(struct raster_job));
+	threads = calloc(nthreads, sizeof(pthread_t));
+
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].zbuf = zbuf;
+		jobs[i].width = width;
+		jobs[i].band_y0 = y0;
+		jobs[i].y0 = y0 + (long)(y1 - y0) * i / nthreads;
+		jobs[i].y1 = y0 + (long)(y1 - y0) * (i + 1) / nthreads;
+	}
+
+	for (i = 1; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, raster_thread, &jobs[i]);
+	raster_thread(&jobs[0]);
+	for (i = 1; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(jobs);
+	free(threads);
+}
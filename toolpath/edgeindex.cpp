@@ -0,0 +1,197 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include "tool.h"
+
+#include "scene.h"
+
+extern "C" {
+  #include "toolpath.h"
+}
+
+#include <chrono>
+#include <algorithm>
+
+/*
+ * Bucket grid over all the edges of a scene, for nearest edge queries.
+ *
+ * Every edge is listed in all the cells its bounding box touches. A query starts at
+ * the cell of the point and works outward ring by ring; an edge not seen yet lies
+ * entirely outside the rings done so far, so once the best distance is below the
+ * distance to the edge of those rings the rest of the grid cannot have anything
+ * closer. The answer is the exact same minimum the linear scan over all shapes gives.
+ */
+
+/* aim for about this many edges per cell */
+#define EDGES_PER_CELL 2
+#define MAX_CELLS 4000000
+
+void edge_index::add_shape(class inputshape *shape)
+{
+	unsigned int i;
+
+	for (i = 0; i < shape->poly.size(); i++) {
+		unsigned int next = i + 1;
+		struct edge e;
+
+		if (next >= shape->poly.size())
+			next = 0;
+		e.X1 = CGAL::to_double(shape->poly[i].x());
+		e.Y1 = CGAL::to_double(shape->poly[i].y());
+		e.X2 = CGAL::to_double(shape->poly[next].x());
+		e.Y2 = CGAL::to_double(shape->poly[next].y());
+		edges.push_back(e);
+	}
+	for (auto c : shape->children)
+		add_shape(c);
+}
+
+void edge_index::cell_range(double minX, double minY, double maxX, double maxY, int *x1, int *y1, int *x2, int *y2)
+{
+	*x1 = std::max(0, std::min(nx - 1, (int)floor((minX - X0) / cell)));
+	*y1 = std::max(0, std::min(ny - 1, (int)floor((minY - Y0) / cell)));
+	*x2 = std::max(0, std::min(nx - 1, (int)floor((maxX - X0) / cell)));
+	*y2 = std::max(0, std::min(ny - 1, (int)floor((maxY - Y0) / cell)));
+}
+
+void edge_index::build(vector<class inputshape *> &shapes)
+{
+	double minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30;
+	vector<int> count;
+	int x, y, x1, y1, x2, y2;
+
+	clear();
+	for (auto s : shapes)
+		add_shape(s);
+	if (edges.size() == 0)
+		return;
+
+	for (auto &e : edges) {
+		minX = fmin(minX, fmin(e.X1, e.X2));
+		minY = fmin(minY, fmin(e.Y1, e.Y2));
+		maxX = fmax(maxX, fmax(e.X1, e.X2));
+		maxY = fmax(maxY, fmax(e.Y1, e.Y2));
+	}
+
+	X0 = minX;
+	Y0 = minY;
+	cell = sqrt(fmax((maxX - minX) * (maxY - minY), 1e-6) * EDGES_PER_CELL / edges.size());
+	cell = fmax(cell, fmax(maxX - minX, maxY - minY) / 2000);
+	cell = fmax(cell, 0.001);
+	nx = (int)floor((maxX - minX) / cell) + 1;
+	ny = (int)floor((maxY - minY) / cell) + 1;
+	while ((long)nx * ny > MAX_CELLS) {
+		cell *= 1.5;
+		nx = (int)floor((maxX - minX) / cell) + 1;
+		ny = (int)floor((maxY - minY) / cell) + 1;
+	}
+
+	/* two passes: count per cell, then fill */
+	count.resize(nx * ny + 1, 0);
+	for (auto &e : edges) {
+		cell_range(fmin(e.X1, e.X2), fmin(e.Y1, e.Y2), fmax(e.X1, e.X2), fmax(e.Y1, e.Y2), &x1, &y1, &x2, &y2);
+		for (y = y1; y <= y2; y++)
+			for (x = x1; x <= x2; x++)
+				count[y * nx + x]++;
+	}
+	cell_start.resize(nx * ny + 1, 0);
+	for (x = 0; x < nx * ny; x++)
+		cell_start[x + 1] = cell_start[x] + count[x];
+	cell_edges.resize(cell_start[nx * ny]);
+	for (auto &e : edges) {
+		cell_range(fmin(e.X1, e.X2), fmin(e.Y1, e.Y2), fmax(e.X1, e.X2), fmax(e.Y1, e.Y2), &x1, &y1, &x2, &y2);
+		for (y = y1; y <= y2; y++)
+			for (x = x1; x <= x2; x++)
+				cell_edges[cell_start[y * nx + x + 1] - count[y * nx + x]--] = &e - &edges[0];
+	}
+
+	built = true;
+	vprintf("Edge index: %i edges in a %i x %i grid of %5.3fmm cells\n", (int)edges.size(), nx, ny, cell);
+}
+
+void edge_index::clear(void)
+{
+	edges.clear();
+	cell_start.clear();
+	cell_edges.clear();
+	built = false;
+	queries = 0;
+	tests = 0;
+	nanoseconds = 0;
+}
+
+double edge_index::distance_from_edge(double X, double Y, bool exclude_zero)
+{
+	auto start = std::chrono::steady_clock::now();
+	double bestdist = 1000000000;
+	double pX, pY, outside;
+	int cx, cy, r, x, y, i;
+	long nrtests = 0;
+
+	cell_range(X, Y, X, Y, &cx, &cy, &cx, &cy);
+	/*
+	 * a point outside the grid gets projected onto it; the distance to any edge is then
+	 * at least sqrt(outside^2 + distance from the projection^2)
+	 */
+	pX = fmin(fmax(X, X0), X0 + nx * cell);
+	pY = fmin(fmax(Y, Y0), Y0 + ny * cell);
+	outside = (X - pX) * (X - pX) + (Y - pY) * (Y - pY);
+
+	for (r = 0; r <= nx || r <= ny; r++) {
+		/* all edges not seen yet lie outside the square of rings 0 .. r-1 */
+		if (r > 0) {
+			double reach = 1e30;
+
+			if (cx - r >= 0)
+				reach = fmin(reach, pX - (X0 + (cx - r + 1) * cell));
+			if (cx + r < nx)
+				reach = fmin(reach, X0 + (cx + r) * cell - pX);
+			if (cy - r >= 0)
+				reach = fmin(reach, pY - (Y0 + (cy - r + 1) * cell));
+			if (cy + r < ny)
+				reach = fmin(reach, Y0 + (cy + r) * cell - pY);
+			if (reach * reach + outside > bestdist * bestdist)
+				break;
+		}
+		for (y = cy - r; y <= cy + r; y++) {
+			if (y < 0 || y >= ny)
+				continue;
+			for (x = cx - r; x <= cx + r; x++) {
+				if (x < 0 || x >= nx)
+					continue;
+				/* only the outline of the square is new */
+				if (y != cy - r && y != cy + r && x != cx - r)
+					x = cx + r;
+				if (x >= nx)
+					continue;
+				for (i = cell_start[y * nx + x]; i < cell_start[y * nx + x + 1]; i++) {
+					struct edge *e = &edges[cell_edges[i]];
+					double d = distance_point_from_vector(e->X1, e->Y1, e->X2, e->Y2, X, Y);
+
+					nrtests++;
+					if (exclude_zero && d < 0.0000001)
+						continue;
+					if (d < bestdist)
+						bestdist = d;
+				}
+			}
+		}
+	}
+
+	queries++;
+	tests += nrtests;
+	nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	return bestdist;
+}
+
+void edge_index::print_stats(void)
+{
+	if (queries == 0)
+		return;
+	vprintf("Edge index: %li distance queries, %li edge tests (%5.1f per query), %5.3f seconds\n",
+		queries.load(), tests.load(), (double)tests / queries, nanoseconds / 1e9);
+}
@@ -47,4 +47,12 @@ extern double get_height(double X, double Y);
 extern void reset_triangles(void);
 extern struct line * stl_vertical_triangles(double radius);
 
+extern int read_heightmap_file(const char *filename, double model_width);
+extern int heightmap_loaded(void);
+extern void free_heightmap(void);
+extern void scale_heightmap_Z(double newheight, double z_offset);
+extern double heightmap_X(void);
+extern double heightmap_Y(void);
+extern double heightmap_height(double X, double Y);
+
 #endif
\ No newline at end of file
@@ -12,16 +12,28 @@
 #include <errno.h>
 #include <math.h>
 #include <vector>
+#include <unordered_map>
 
 extern "C" {
 #include "toolpath.h"
 }
 
 #include "gcode.h"
+#include "../compiler2/machinetime.h"
 
 static bool want_adaptive = false;
+static bool want_low_retract = false;
+static double low_retract_clearance = 0.5;
 
 static std::vector<struct gline *> lines;
+/* the swept lines bucketed on a grid so depth lookups only scan their own cell */
+#define GRID_CELL 5.0
+static std::unordered_map<long long, std::vector<struct gline *>> line_grid;
+
+static int low_retract_count;
+static double low_retract_saved;     /* mm of vertical travel */
+static double low_retract_seconds;
+
 static const char *tool_name = "T201";
 static int current_tool_nr = -499;
 static double tool_diameter = 6;
@@ -49,6 +61,8 @@ static int am_roughing = 0;
 static double prevX1, prevY1, prevX2, prevY2;
 static int prev_valid;
 
+static struct machinetime machinetime;
+
 static double dist(double X0, double Y0, double X1, double Y1)
 {
   return sqrt((X1-X0)*(X1-X0) + (Y1-Y0)*(Y1-Y0));
@@ -66,11 +80,24 @@ static double radius_at_depth(double Z)
 	return fmin(depth_to_radius(Z, tool_angle), radius);	
 }
 
+static long long grid_key(int gX, int gY)
+{
+	return ((long long)gX << 32) ^ (unsigned int)gY;
+}
+
+static void grid_insert(struct gline *line)
+{
+	int x, y;
+	for (x = (int)floor(line->minX / GRID_CELL); x <= (int)floor(line->maxX / GRID_CELL); x++)
+		for (y = (int)floor(line->minY / GRID_CELL); y <= (int)floor(line->maxY / GRID_CELL); y++)
+			line_grid[grid_key(x, y)].push_back(line);
+}
+
 static void record_motion_XYZ(double fX, double fY, double fZ, double tX, double tY, double tZ)
 {
 	struct gline *point;
 
-	if (!want_adaptive)
+	if (!want_adaptive && !want_low_retract)
 		return;
 
 	point = (struct gline*)calloc(sizeof(struct gline), 1);
@@ -91,9 +118,18 @@ static void record_motion_XYZ(double fX, double fY, double fZ, double tX, double
 	point->toolangle = tool_angle;
 
 	lines.push_back(point);
+	grid_insert(point);
 //	printf("XYZ movement from %5.2f,%5.2f to %5.2f,%5.2f\n", currentX, currentY, X, Y);
 }
 
+/* feed 0 is a G0; moves from the unknown position after a tool change are skipped */
+static void time_move(double fX, double fY, double fZ, double tX, double tY, double tZ, double feed)
+{
+	if (fabs(fX) >= 100000 || fabs(fY) >= 100000 || fabs(fZ) >= 100000)
+		return;
+	machinetime_move(&machinetime, fX, fY, fZ, tX, tY, tZ, feed);
+}
+
 static char *double_to_str(double X)
 {
 	static char buffer[128];
@@ -206,6 +242,7 @@ void write_gcode_header(const char *filename)
     fprintf(gcode, "G0X0Y0Z%5.4f\n", safe_retract_height);
     cZ = safe_retract_height;
     fprintf(gcode, "(FILENAME: %s)\n", filename);
+    machinetime_init(&machinetime, NULL);
 }
 
 void gcode_plunge_to(double Z, double speedratio)
@@ -215,6 +252,7 @@ void gcode_plunge_to(double Z, double speedratio)
         fprintf(gcode,"Z%5.4f", Z);
     if (cS != speedratio)
         fprintf(gcode, "F%i", (int)(speedratio * tool_plungerate) );
+    time_move(cX, cY, cZ, cX, cY, Z, speedratio * tool_plungerate);
     cZ = Z;
     cS = speedratio * tool_plungerate;
     prev_valid = 0;
@@ -228,6 +266,7 @@ void gcode_retract(void)
     fprintf(gcode, "G0");
     if (cZ != safe_retract_height)
         fprintf(gcode,"Z%s", double_to_str(safe_retract_height));
+    time_move(cX, cY, cZ, cX, cY, safe_retract_height, 0);
     cZ = safe_retract_height;
     fprintf(gcode, "\n");
     retract_count++;
@@ -235,39 +274,65 @@ void gcode_retract(void)
 	has_current = 1;
 }
 
+/* retract only as far as needed to clear the stock, Z comes from traverse_height() */
+static void gcode_low_retract(double Z)
+{
+    double saved = safe_retract_height - fmax(Z, cZ);
+
+    /* both the rapid up and the plunge back down get shorter */
+    low_retract_count++;
+    low_retract_saved += 2 * saved;
+    low_retract_seconds += saved / (machinetime.k.max_feed[2] / 60);
+    if (tool_plungerate > 0)
+        low_retract_seconds += saved / (tool_plungerate / 60);
+
+    if (cZ < Z) {
+        fprintf(gcode, "G0Z%s\n", double_to_str(Z));
+        time_move(cX, cY, cZ, cX, cY, Z, 0);
+        cZ = Z;
+        retract_count++;
+    }
+    prev_valid = 0;
+}
+
 static double gcode_depth_at_XY(double X, double Y)
 {
 	double depth = 2;
 	unsigned int i;
-	
-	for (i = 0; i < lines.size(); i++) {
+	auto bucket = line_grid.find(grid_key((int)floor(X / GRID_CELL), (int)floor(Y / GRID_CELL)));
+
+	if (bucket == line_grid.end())
+		return 0;
+
+	std::vector<struct gline *> &cell = bucket->second;
+	for (i = 0; i < cell.size(); i++) {
 		double d;
 		double l;
 		double baseZ;
 		double adjust = 0;
-		if (X < lines[i]->minX)
+		if (X < cell[i]->minX)
 			continue;
-		if (X > lines[i]->maxX)
+		if (X > cell[i]->maxX)
 			continue;
-		if (Y < lines[i]->minY)
+		if (Y < cell[i]->minY)
 			continue;
-		if (Y > lines[i]->maxY)
+		if (Y > cell[i]->maxY)
 			continue;
 
-		d = distance_point_from_vector_ll(lines[i]->X1, lines[i]->Y1, lines[i]->X2, lines[i]->Y2, X, Y, &l);	
+		d = distance_point_from_vector_ll(cell[i]->X1, cell[i]->Y1, cell[i]->X2, cell[i]->Y2, X, Y, &l);	
 
-		if (d  > lines[i]->toolradius)
+		if (d  > cell[i]->toolradius)
 			continue;
 
-		baseZ = lines[i]->Z1 + l * (lines[i]->Z2 - lines[i]->Z1);
+		baseZ = cell[i]->Z1 + l * (cell[i]->Z2 - cell[i]->Z1);
 
-		if (lines[i]->toolangle > 0.01) {
-			adjust -= radius_to_depth(d, lines[i]->toolangle);
+		if (cell[i]->toolangle > 0.01) {
+			adjust -= radius_to_depth(d, cell[i]->toolangle);
 
 		}
 
 //		vprintf("XY %5.4f %5.4f    line %5.4f,%5.4f -> %5.4f,%5.4f tool %i at dist %5.4f   est Z %5.4f + %5.4f = %5.4f\n",
-//			X, Y, lines[i]->X1, lines[i]->Y1, lines[i]->X2, lines[i]->Y2, lines[i]->tool, d, baseZ, adjust, baseZ + adjust);
+//			X, Y, cell[i]->X1, cell[i]->Y1, cell[i]->X2, cell[i]->Y2, cell[i]->tool, d, baseZ, adjust, baseZ + adjust);
 
 		baseZ += adjust;
 		depth = fmin(depth, baseZ);
@@ -278,6 +343,104 @@ static double gcode_depth_at_XY(double X, double Y)
 
 	return depth;
 }
+/* resolution of the traverse check; a rib of stock one cell wide is always seen */
+#define TRAVERSE_CELL 0.25
+
+/*
+ * Highest Z the cuts can have left anywhere in the TRAVERSE_CELL square centered at X,Y.
+ * A cut only counts if its footprint covers the whole square; a square that is only
+ * partly cut, or that no cut reaches at all, is taken to be at the stock top (0).
+ */
+static double gcode_cell_top(double X, double Y)
+{
+	double half = TRAVERSE_CELL * M_SQRT1_2;	/* center to corner */
+	double depth = 0;
+	bool covered = false;
+	unsigned int i;
+	auto bucket = line_grid.find(grid_key((int)floor(X / GRID_CELL), (int)floor(Y / GRID_CELL)));
+
+	if (bucket == line_grid.end())
+		return 0;
+
+	std::vector<struct gline *> &cell = bucket->second;
+	for (i = 0; i < cell.size(); i++) {
+		double d, l, top;
+
+		if (X < cell[i]->minX || X > cell[i]->maxX || Y < cell[i]->minY || Y > cell[i]->maxY)
+			continue;
+
+		d = distance_point_from_vector_ll(cell[i]->X1, cell[i]->Y1, cell[i]->X2, cell[i]->Y2, X, Y, &l);
+		if (d + half > cell[i]->toolradius)
+			continue;
+
+		/* the bottom of a sloped cut is highest at its higher end */
+		top = fmax(cell[i]->Z1, cell[i]->Z2);
+		if (cell[i]->toolangle > 0.01)
+			top -= fmin(radius_to_depth(fmax(d - half, 0), cell[i]->toolangle),
+				    radius_to_depth(d + half, cell[i]->toolangle));
+
+		depth = covered ? fmin(depth, top) : top;
+		covered = true;
+	}
+
+	if (!covered || depth > 0)
+		return 0;
+	return depth;
+}
+
+/*
+ * Lowest Z the tool can traverse from X1,Y1 to X2,Y2 at: the highest stock left in any
+ * cell the tool disc sweeps over on the way, plus the clearance
+ */
+static double traverse_height(double X1, double Y1, double X2, double Y2)
+{
+	double R = tool_diameter / 2;
+	/* a cell counts if any part of it is under the tool */
+	double reach = R + TRAVERSE_CELL * M_SQRT1_2;
+	double top = -500000;
+	int x, y, miny, maxy;
+
+	miny = (int)floor((fmin(Y1, Y2) - reach) / TRAVERSE_CELL);
+	maxy = (int)floor((fmax(Y1, Y2) + reach) / TRAVERSE_CELL);
+
+	for (y = miny; y <= maxy; y++) {
+		double Y = (y + 0.5) * TRAVERSE_CELL;
+		double t0 = 0, t1 = 1;
+		int minx, maxx;
+
+		/* only the part of the path within reach of this row matters */
+		if (Y2 != Y1) {
+			t0 = (Y - reach - Y1) / (Y2 - Y1);
+			t1 = (Y + reach - Y1) / (Y2 - Y1);
+			if (t0 > t1) {
+				double tmp = t0;
+				t0 = t1;
+				t1 = tmp;
+			}
+			t0 = fmax(t0, 0);
+			t1 = fmin(t1, 1);
+			if (t0 > t1)
+				continue;
+		}
+		minx = (int)floor((fmin(X1 + t0 * (X2 - X1), X1 + t1 * (X2 - X1)) - reach) / TRAVERSE_CELL);
+		maxx = (int)floor((fmax(X1 + t0 * (X2 - X1), X1 + t1 * (X2 - X1)) + reach) / TRAVERSE_CELL);
+
+		for (x = minx; x <= maxx; x++) {
+			double X = (x + 0.5) * TRAVERSE_CELL;
+			double l;
+
+			if (distance_point_from_vector_ll(X1, Y1, X2, Y2, X, Y, &l) > reach)
+				continue;
+
+			top = fmax(top, gcode_cell_top(X, Y));
+			/* nothing is higher than the stock top */
+			if (top >= 0)
+				return top + low_retract_clearance;
+		}
+	}
+	return top + low_retract_clearance;
+}
+
 static double gcode_point_load(double X, double Y, double Z)
 {
 	double Z2;
@@ -448,6 +611,7 @@ void gcode_mill_to(double X, double Y, double Z, double speedratio)
 		fprintf(gcode, "F%i", (int)(speedratio * tool_feedrate));
 
 	record_motion_XYZ(cX,cY,cZ, X,Y,Z);
+	time_move(cX, cY, cZ, X, Y, Z, speedratio * tool_feedrate);
     cX = X;
     cY = Y;
     cZ = Z;
@@ -525,7 +689,8 @@ void gcode_vmill_to(double X, double Y, double Z, double speedratio)
 	/* slow down for round corners */
 	if (dist(cX,cY,X,Y) < 0.5 * tool_diameter && speedratio > 0.7 && !am_roughing)
 		speedratio = 0.66;
-//	record_motion_XYZ(cX,cY,cZ, X,Y,Z);
+	if (want_low_retract)
+		record_motion_XYZ(cX,cY,cZ, X,Y,Z);
 
 
     if (cX != X) {
@@ -545,6 +710,7 @@ void gcode_vmill_to(double X, double Y, double Z, double speedratio)
     if (cS != toolspeed && command == '1')
         fprintf(gcode, "F%i", (int)(toolspeed));
         
+    time_move(prevX1, prevY1, cZ, X, Y, Z, command == '1' ? toolspeed : 0);
     prev_valid = 1;
 	has_current = 1;
     cZ = Z;
@@ -559,13 +725,21 @@ void gcode_travel_to(double X, double Y)
     char buffer[256];
 //    sprintf(buffer,"Travel distance %5.4fmm", dist(X, Y, cX, cY));
 //    gcode_write_comment(buffer);
-    if (cZ < safe_retract_height)
-        gcode_retract();
+    if (cZ < safe_retract_height) {
+        double Z = safe_retract_height;
+        if (want_low_retract && has_current && fabs(cX) < 100000)
+            Z = traverse_height(cX, cY, X, Y);
+        if (Z < safe_retract_height)
+            gcode_low_retract(Z);
+        else
+            gcode_retract();
+    }
     fprintf(gcode, "G0");
     if (cX != X)
         fprintf(gcode,"X%s", double_to_str(X));
     if (cY != Y)
         fprintf(gcode,"Y%s", double_to_str(Y));
+    time_move(cX, cY, cZ, X, Y, cZ, 0);
     cX = X;
     cY = Y;
     fprintf(gcode, "\n");
@@ -680,6 +854,11 @@ void write_gcode_footer(void)
     fprintf(gcode, "%%\n");
     fclose(gcode);
     vprintf("There were %i retracts in the file and %i milling toolpaths\n", retract_count, mill_count);
+    machinetime_finish(&machinetime);
+    qprintf("Estimated machine time: %5.2f minutes (%5.2f minutes rapids)\n", machinetime.seconds / 60, machinetime.rapid_seconds / 60);
+    if (want_low_retract)
+        qprintf("Low retracts: %i moves, %5.1f mm vertical travel removed, %5.2f minutes saved\n",
+                low_retract_count, low_retract_saved, low_retract_seconds / 60);
 }
 
 double gcode_current_X(void)
@@ -708,6 +887,7 @@ void gcode_tool_change(int toolnr)
 		write_gcode_footer();
 		write_gcode_header(stored_filename);
  }
+ machinetime_stop(&machinetime);
  fprintf(gcode, "M6 T%i\n", abs(toolnr));
  fprintf(gcode, "M3 S%i\n", (int)rippem);  
  fprintf(gcode, "G0 X0Y0\n");
@@ -747,4 +927,10 @@ void gcode_want_separate_files(void)
 void gcode_want_adaptive(void)
 {
 	want_adaptive = true;
+}
+
+void gcode_want_low_retract(double clearance_mm)
+{
+	want_low_retract = true;
+	low_retract_clearance = clearance_mm;
 }
\ No newline at end of file
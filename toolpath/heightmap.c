@@ -0,0 +1,183 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <png.h>
+
+#include "fenrus.h"
+
+/*
+ * Heightmap input: a grayscale PNG (8 or 16 bit, white is high) is kept as a raster
+ * of its raw samples and get_height() interpolates straight from that, instead of
+ * turning every pixel into two triangles that then have to be bucketed.
+ * Sample (x, y) sits at X = x * pixel, Y = y * pixel; the first PNG row is the top.
+ */
+static uint16_t *samples;
+static int width, height;
+static double pixel = 0.1;	/* mm per pixel */
+static int minraw, maxraw;
+static double Zadj, Zfactor = 1.0;
+
+int heightmap_loaded(void)
+{
+	return samples != NULL;
+}
+
+/* once the heightmap is processed, so a later STL does not sample the stale raster */
+void free_heightmap(void)
+{
+	free(samples);
+	samples = NULL;
+	width = 0;
+	height = 0;
+}
+
+int read_heightmap_file(const char *filename, double model_width)
+{
+	FILE *file;
+	png_structp png;
+	png_infop info;
+	png_bytep volatile row = NULL;
+	int bits, x, y;
+
+	file = fopen(filename, "rb");
+	if (!file) {
+		printf("Failed to open file %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	free_heightmap();
+
+	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))) {
+		printf("Failed to read PNG file %s\n", filename);
+		png_destroy_read_struct(&png, &info, NULL);
+		free(row);
+		free(samples);
+		samples = NULL;
+		fclose(file);
+		return -1;
+	}
+
+	png_init_io(png, file);
+	png_read_info(png, info);
+
+	/* whatever the format, end up with one 8 or 16 bit gray channel */
+	png_set_expand(png);
+	png_set_strip_alpha(png);
+	if (png_get_color_type(png, info) & PNG_COLOR_MASK_COLOR)
+		png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+	png_read_update_info(png, info);
+
+	width = png_get_image_width(png, info);
+	height = png_get_image_height(png, info);
+	bits = png_get_bit_depth(png, info);
+
+	if (width < 2 || height < 2) {
+		printf("Heightmap %s is too small\n", filename);
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(file);
+		return -1;
+	}
+
+	samples = malloc((size_t)width * height * sizeof(uint16_t));
+	row = malloc(png_get_rowbytes(png, info));
+
+	minraw = 65535;
+	maxraw = 0;
+	for (y = 0; y < height; y++) {
+		uint16_t *out = &samples[(size_t)(height - 1 - y) * width];
+
+		png_read_row(png, row, NULL);
+		for (x = 0; x < width; x++) {
+			int value;
+
+			if (bits == 16)
+				value = (row[2 * x] << 8) | row[2 * x + 1];
+			else
+				value = row[x] * 257;
+			out[x] = value;
+			if (value < minraw)
+				minraw = value;
+			if (value > maxraw)
+				maxraw = value;
+		}
+	}
+
+	png_read_end(png, NULL);
+	png_destroy_read_struct(&png, &info, NULL);
+	free(row);
+	fclose(file);
+
+	if (model_width > 0)
+		pixel = model_width / (width - 1);
+	else
+		printf("Warning: No heightmap width set, using %5.2fmm per pixel\n", pixel);
+
+	Zadj = minraw;
+	Zfactor = 1.0;
+
+	qprintf("Heightmap size                : %i x %i pixels, %i bit\n", width, height, bits);
+	qprintf("Image size                    : %5.2f  x %5.2f mm\n", heightmap_X(), heightmap_Y());
+	qprintf("Image size                    : %5.2f\" x %5.2f\"\n", mm_to_inch(heightmap_X()), mm_to_inch(heightmap_Y()));
+	return 0;
+}
+
+/* same as scale_design_Z() for triangles: the sample range becomes newheight, minus the offset */
+void scale_heightmap_Z(double newheight, double z_offset)
+{
+	double pct = 100.0 * z_offset / newheight;
+
+	Zadj = ((100 - pct) * minraw + pct * maxraw) / 100;
+	Zfactor = 0;
+	if (maxraw - Zadj > 0)
+		Zfactor = newheight / (maxraw - Zadj);
+}
+
+double heightmap_X(void)
+{
+	return (width - 1) * pixel;
+}
+
+double heightmap_Y(void)
+{
+	return (height - 1) * pixel;
+}
+
+/* bilinear between the 4 samples around X, Y; outside the image is the bottom, like for STL */
+double heightmap_height(double X, double Y)
+{
+	double fX = X / pixel, fY = Y / pixel;
+	double dX, dY, value;
+	uint16_t *s;
+	int x, y;
+
+	if (fX < 0 || fY < 0 || fX > width - 1 || fY > height - 1)
+		return 0;
+
+	x = fX;
+	y = fY;
+	if (x > width - 2)
+		x = width - 2;
+	if (y > height - 2)
+		y = height - 2;
+	dX = fX - x;
+	dY = fY - y;
+
+	s = &samples[(size_t)y * width + x];
+	value = (1 - dY) * ((1 - dX) * s[0] + dX * s[1]) +
+		dY * ((1 - dX) * s[width] + dX * s[width + 1]);
+
+	return (value - Zadj) * Zfactor;
+}
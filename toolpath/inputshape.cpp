@@ -12,6 +12,13 @@
 /* todo: get rid of this addiction to print.h */
 #include "print.h"
 
+#include <CGAL/Cartesian_converter.h>
+
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <unistd.h>
+
 static inline double dist(double X0, double Y0, double X1, double Y1)
 {
   return sqrt((X1-X0)*(X1-X0) + (Y1-Y0)*(Y1-Y0));
@@ -29,6 +36,152 @@ double point_snap2(double D)
     return i / 1000.0;
 }
 
+/* skeleton construction is the bulk of the CAM time; keep track of how much of it there was */
+static long skeleton_count, skeleton_vertices;
+static double skeleton_seconds;
+
+static SsPtr create_skeleton(const PolygonWithHoles &ph)
+{
+    profile_scope profile(PROFILE_SKELETON);
+    auto start = std::chrono::steady_clock::now();
+    SsPtr ss = CGAL::create_interior_straight_skeleton_2(ph);
+
+    skeleton_count++;
+    skeleton_vertices += ph.outer_boundary().size();
+    for (auto h = ph.holes_begin(); h != ph.holes_end(); ++h)
+        skeleton_vertices += h->size();
+    skeleton_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ss;
+}
+
+static long offset_count, offset_fallbacks, offset_nudges, offset_failures;
+
+static Polygon_2_exact to_exact(const Polygon_2 &poly)
+{
+    CGAL::Cartesian_converter<K, Kexact> convert;
+    Polygon_2_exact out;
+
+    for (auto v = poly.vertices_begin(); v != poly.vertices_end(); ++v)
+        out.push_back(convert(*v));
+    return out;
+}
+
+static Polygon_2 from_exact(const Polygon_2_exact &poly)
+{
+    CGAL::Cartesian_converter<Kexact, K> convert;
+    Polygon_2 out;
+
+    for (auto v = poly.vertices_begin(); v != poly.vertices_end(); ++v)
+        out.push_back(convert(*v));
+    return out;
+}
+
+/*
+ * Offsetting on the fast kernel now and then throws on nasty geometry. Rather than
+ * nudging the offset until it stops throwing, redo only that shape on the exact
+ * kernel (its skeleton gets built once and kept in *exact_ss). Nudging is what is
+ * left if even that fails.
+ */
+static PolygonWithHolesPtrVector robust_offset(double offset, SsPtr ss, PolygonWithHoles *ph, SsPtr_exact *exact_ss)
+{
+    profile_scope profile(PROFILE_OFFSET);
+    PolygonWithHolesPtrVector result;
+    int nudge;
+
+    offset_count++;
+    try {
+        return arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(offset, *ss));
+    } catch (...) { }
+
+    offset_fallbacks++;
+    try {
+        if (!*exact_ss) {
+            PolygonWithHoles_exact eph(to_exact(ph->outer_boundary()));
+
+            for (auto h = ph->holes_begin(); h != ph->holes_end(); ++h)
+                eph.add_hole(to_exact(*h));
+            *exact_ss = CGAL::create_interior_straight_skeleton_2(eph);
+        }
+        if (*exact_ss) {
+            auto exact = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2_exact>(offset, **exact_ss));
+
+            for (auto e : exact) {
+                PolygonWithHolesPtr p(new PolygonWithHoles(from_exact(e->outer_boundary())));
+
+                for (auto h = e->holes_begin(); h != e->holes_end(); ++h)
+                    p->add_hole(from_exact(*h));
+                result.push_back(p);
+            }
+            return result;
+        }
+    } catch (...) { }
+
+    for (nudge = 1; nudge <= 5; nudge++) {
+        offset_nudges++;
+        try {
+            return arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(offset + nudge * 0.00001, *ss));
+        } catch (...) { }
+    }
+
+    offset_failures++;
+    printf("Warning: failed to offset a shape by %5.4fmm, skipping it\n", offset);
+    return result;
+}
+
+static void skeleton_edges(SsPtr ss, vector<struct skeleton_edge> &edges)
+{
+    for (auto x = ss->halfedges_begin(); x != ss->halfedges_end(); ++x) {
+        struct skeleton_edge e;
+        e.X1 = CGAL::to_double(x->vertex()->point().x());
+        e.Y1 = CGAL::to_double(x->vertex()->point().y());
+        e.X2 = CGAL::to_double(x->opposite()->vertex()->point().x());
+        e.Y2 = CGAL::to_double(x->opposite()->vertex()->point().y());
+        e.is_inner_bisector = x->is_inner_bisector();
+        e.is_bisector = x->is_bisector();
+        edges.push_back(e);
+    }
+}
+
+/*
+ * robust_offset() with the skeleton cache in front; the skeleton only gets built on a miss.
+ * Its halfedges go into the cache as well, so the SVG view can still show the skeleton
+ * on a later run that does not build it.
+ */
+static PolygonWithHolesPtrVector cached_offset(double offset, struct skeleton_cache *cache, SsPtr *ss, PolygonWithHoles *ph, SsPtr_exact *exact_ss)
+{
+    PolygonWithHolesPtrVector result;
+    long failures = offset_failures;
+
+    if (skeleton_cache_get_offset(cache, offset, &result))
+        return result;
+
+    if (!*ss) {
+        vector<struct skeleton_edge> edges;
+
+        *ss = create_skeleton(*ph);
+        if (cache && !skeleton_cache_get_edges(cache, &edges) && *ss) {
+            skeleton_edges(*ss, edges);
+            skeleton_cache_put_edges(cache, edges);
+        }
+    }
+    result = robust_offset(offset, *ss, ph, exact_ss);
+    /* a failure should warn again next time, not turn into an empty hit */
+    if (offset_failures == failures)
+        skeleton_cache_put_offset(cache, offset, result);
+    return result;
+}
+
+void print_skeleton_stats(void)
+{
+    if (skeleton_count > 0)
+        qprintf("Straight skeletons            : %li over %li vertices in %5.2f seconds\n",
+            skeleton_count, skeleton_vertices, skeleton_seconds);
+    if (offset_count > 0)
+        qprintf("Offsets                       : %li, %li redone on the exact kernel, %li nudged, %li failed\n",
+            offset_count, offset_fallbacks, offset_nudges, offset_failures);
+    print_skeleton_cache_stats();
+}
+
 void inputshape::set_level(int _level)
 {
     level = _level;
@@ -53,6 +206,13 @@ void inputshape::wipe_children(void)
 void inputshape::update_stats(void)
 {
     area = fabs(CGAL::to_double(poly.area()));
+    if (poly.size() > 0) {
+        CGAL::Bbox_2 bb = poly.bbox();
+        bbX1 = bb.xmin();
+        bbY1 = bb.ymin();
+        bbX2 = bb.xmax();
+        bbY2 = bb.ymax();
+    }
 }
 
 void inputshape::print_as_svg(void)
@@ -70,8 +230,17 @@ void inputshape::print_as_svg(void)
 #if 1
     for (auto i : skeleton)
         print_straight_skeleton(*i);
-    if (iss)
+    if (iss) {
         print_straight_skeleton(*iss);
+    } else {
+        /* the skeleton came from the cache, draw it the way print_straight_skeleton() does */
+        vector<struct skeleton_edge> edges;
+
+        if (skeleton_cache_get_edges(ss_cache, &edges))
+            for (auto &e : edges)
+                if (e.is_bisector)
+                    svg_line(e.X2, e.Y2, e.X1, e.Y1, e.is_inner_bisector ? "green" : "orange", e.is_inner_bisector ? 0.15 : 0.04);
+    }
 #endif
     for (auto i : children)
         i->print_as_svg();
@@ -138,6 +307,9 @@ void inputshape::fix_orientation(void)
 
 bool inputshape::fits_inside(class inputshape *shape)
 {
+   /* sticking out of the bounding box means a vertex is outside for sure */
+   if (bbX1 < shape->bbX1 || bbY1 < shape->bbY1 || bbX2 > shape->bbX2 || bbY2 > shape->bbY2)
+     return false;
    for(auto vi = poly.vertices_begin() ; vi != poly.vertices_end() ; ++ vi )
      if (shape->poly.bounded_side(*vi) == CGAL::ON_UNBOUNDED_SIDE) {
        return false;
@@ -193,8 +365,8 @@ void inputshape::create_toolpaths(int toolnr, double depth, int finish_pass, int
 #endif
     }
     
-    if (!iss) {
-        iss =  CGAL::create_interior_straight_skeleton_2(*polyhole);
+    if (!ss_cache) {
+        ss_cache = skeleton_cache_open(*polyhole);
     }
     
     /* first inset is the radius (half diameter) of the tool, after that increment by stepover */
@@ -219,8 +391,6 @@ void inputshape::create_toolpaths(int toolnr, double depth, int finish_pass, int
     do {
         class toollevel *tool = new(class toollevel);
         int added = 0;
-        int had_exception = 1;
-		int exceptioncount = 0;
         
         tool->level = level;
         tool->offset = inset;
@@ -237,25 +407,11 @@ void inputshape::create_toolpaths(int toolnr, double depth, int finish_pass, int
         PolygonWithHolesPtrVector  offset_polygons;
 //        offset_polygons = CGAL::create_interior_skeleton_and_offset_polygons_with_holes_2(inset, *polyhole);
 
-        while (had_exception) {
-            had_exception = 0;
-			if (exceptioncount > 5)
-                offset_polygons = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(inset,*iss) );
-
-            try {
-                offset_polygons = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(inset,*iss) );
-            } catch (...) { had_exception = 1; exceptioncount++;};
-            
-            if (had_exception)
-                inset = inset + 0.00001;
-        }
+        offset_polygons = cached_offset(inset, ss_cache, &iss, polyhole, &exact_iss);
         
         if (level == 0 && want_skeleton_path) {
-			K k;
             for (auto ply : offset_polygons) {
-                SsPtr pp = CGAL::create_interior_straight_skeleton_2(ply->outer_boundary().vertices_begin(),
-                    ply->outer_boundary().vertices_end(),
-                    ply->holes_begin(), ply->holes_end(), k);            
+                SsPtr pp = create_skeleton(*ply);
                 skeleton.push_back(pp);                
             }
         }
@@ -356,13 +512,15 @@ void inputshape::create_toolpaths_cutout(int toolnr, double depth, bool finish_p
 	poly.reverse_orientation();
 	ph->add_hole(poly);
 
-	/* Step 3: Create an ISS */
-	auto ciss = CGAL::create_interior_straight_skeleton_2(*ph);
+	/* Step 3: Create an ISS (lazily, the offsets may all come from the cache) */
+	SsPtr ciss;
+	SsPtr_exact exact_ciss;
+	struct skeleton_cache *ccache = skeleton_cache_open(*ph);
 
 	/* Step 4: Inset the ISS by tool radius */
 	PolygonWithHolesPtrVector  offset_polygons;
 
-	offset_polygons = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(mill->get_diameter()/2 + cutout_offset, *ciss) );
+	offset_polygons = cached_offset(mill->get_diameter()/2 + cutout_offset, ccache, &ciss, ph, &exact_ciss);
 
 
 	/* Step 5: The hole perimiter is now our path for the tool */
@@ -395,23 +553,19 @@ void inputshape::create_toolpaths_cutout(int toolnr, double depth, bool finish_p
 					tool->name = NULL;
 					td->toollevels.push_back(tool);
 
-	    	    	Polygon_2 *p2;
-					p2 = new(Polygon_2);
 					double d1 = currentdepth;
 					double d2 = gradient * dist(	CGAL::to_double((*p)[i].x()), 
 														CGAL::to_double((*p)[i].y()), 
 														CGAL::to_double((*p)[next].x()), 
 														CGAL::to_double((*p)[next].y()));
-					p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-					p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-					tool->add_poly_vcarve(p2, d1, d1 + d2);
+					tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()), CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), d1, d1 + d2);
 					
 				}
 	        }
 		}
 
 	if (finish_pass) {
-		offset_polygons = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(mill->get_diameter()/2 + stock_to_leave, *ciss) );
+		offset_polygons = cached_offset(mill->get_diameter()/2 + stock_to_leave, ccache, &ciss, ph, &exact_ciss);
 	}
 
 
@@ -471,16 +625,12 @@ void inputshape::create_toolpaths_cutout(int toolnr, double depth, bool finish_p
 					tool->name = NULL;
 					td->toollevels.push_back(tool);
 
-	    	    	Polygon_2 *p2;
-					p2 = new(Polygon_2);
 					double d1 = currentdepth;
 					double d2 = gradient * dist(	CGAL::to_double((*p)[i].x()), 
 														CGAL::to_double((*p)[i].y()), 
 														CGAL::to_double((*p)[next].x()), 
 														CGAL::to_double((*p)[next].y()));
-					p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-					p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-					tool->add_poly_vcarve(p2, d1, d1 + d2);
+					tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()), CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), d1, d1 + d2);
 					currentdepth += d2;
 					
 				}
@@ -490,13 +640,9 @@ void inputshape::create_toolpaths_cutout(int toolnr, double depth, bool finish_p
 }
 
 
-static bool should_vcarve(class inputshape *shape, double X1, double Y1, double X2, double Y2, bool is_inner, bool is_bisect) 
+/* the corners a bisector has to start or end at to be worth carving, see should_vcarve() */
+static void collect_vcarve_corners(class inputshape *shape, vector<struct vcarve_corner> &corners)
 {
-	if (is_inner)
-		return true;
-	if (!is_inner && !is_bisect)
-		return false;
-
     for (unsigned int i = 0; i < shape->poly.size(); i++) {
         double BC_x, BC_y, BA_x, BA_y;
         double BC_l, BA_l;
@@ -508,16 +654,9 @@ static bool should_vcarve(class inputshape *shape, double X1, double Y1, double
           a = i - 1;
         b = i;
         c = i + 1;
-		if ( !(approx4(CGAL::to_double(shape->poly[b].x()),X1) && approx4(CGAL::to_double(shape->poly[b].y()), Y1)) 
-			 && !(approx4(CGAL::to_double(shape->poly[b].x()),X2) && approx4(CGAL::to_double(shape->poly[b].y()), Y2)))
-			 continue;
-
-
         if (c >= shape->poly.size())
           c = 0;
 
-
-          
         BA_x = CGAL::to_double((shape->poly)[a].x()) - CGAL::to_double((shape->poly)[b].x());
         BA_y = CGAL::to_double((shape->poly)[a].y()) - CGAL::to_double((shape->poly)[b].y());
 
@@ -533,28 +672,47 @@ static bool should_vcarve(class inputshape *shape, double X1, double Y1, double
 		while (phi < 0)
 			phi  += 360;
 
-//		printf("Angle is %5.2f\n", phi);
-		if (approx4(CGAL::to_double(shape->poly[b].x()),X1) && approx4(CGAL::to_double(shape->poly[b].y()), Y1) && phi < 160)
-			return true;
-		if (approx4(CGAL::to_double(shape->poly[b].x()),X2) && approx4(CGAL::to_double(shape->poly[b].y()), Y2) && phi < 160)
-			return true;
+		if (phi < 160)
+			corners.push_back({CGAL::to_double(shape->poly[b].x()), CGAL::to_double(shape->poly[b].y())});
     }
-	for (auto c : shape->children) {
-		bool ret;
-		ret = should_vcarve(c, X1, Y1, X2, Y2, is_inner, is_bisect);
-		if (ret)
+	for (auto c : shape->children)
+		collect_vcarve_corners(c, corners);
+}
+
+static bool should_vcarve(const vector<struct vcarve_corner> *corners, double X1, double Y1, double X2, double Y2, bool is_inner, bool is_bisect) 
+{
+	if (is_inner)
+		return true;
+	if (!is_inner && !is_bisect)
+		return false;
+
+	for (auto &c : *corners) {
+		if (approx4(c.X, X1) && approx4(c.Y, Y1))
+			return true;
+		if (approx4(c.X, X2) && approx4(c.Y, Y2))
 			return true;
 	}
 	return false;
 }
 
-static void process_vcarve(class toollevel *tool, double X1, double Y1, double X2, double Y2, bool is_inner_bisector, bool is_bisector, class endmill *mill, class scene *parent, double maxdepth, class inputshape *shape, double z_offset)
+static void set_diameter(struct vcarve_job *job, double diameter)
+{
+	job->diameter_set = true;
+	job->diameter = diameter;
+}
+
+static void widen_diameter(struct vcarve_job *job, double diameter)
+{
+	job->diameter = fmax(job->diameter, diameter);
+}
+
+static void process_vcarve(struct vcarve_job *job, double X1, double Y1, double X2, double Y2, bool is_inner_bisector, bool is_bisector, class endmill *mill, class scene *parent, double maxdepth, double z_offset)
 {
 	double d1, d2;
 
 	if (dist(X1, Y1, X2, Y2) > 1 && is_inner_bisector) {
-		process_vcarve(tool, X1, Y1, (X1 + X2)/2, (Y1 + Y2)/2, is_inner_bisector, is_bisector, mill, parent, maxdepth, shape,  z_offset);
-		process_vcarve(tool, (X1 + X2)/2, (Y1 + Y2)/2, X2, Y2, is_inner_bisector, is_bisector, mill, parent, maxdepth, shape,  z_offset);
+		process_vcarve(job, X1, Y1, (X1 + X2)/2, (Y1 + Y2)/2, is_inner_bisector, is_bisector, mill, parent, maxdepth, z_offset);
+		process_vcarve(job, (X1 + X2)/2, (Y1 + Y2)/2, X2, Y2, is_inner_bisector, is_bisector, mill, parent, maxdepth, z_offset);
 		return;
     }
 
@@ -562,8 +720,8 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
 	d2 = -mill->geometry_at_distance(parent->distance_from_edge(X2, Y2, false));
 
 	if (fabs(d2-d1) > 0.4 && is_inner_bisector) {
-		process_vcarve(tool, X1, Y1, (X1 + X2)/2, (Y1 + Y2)/2, is_inner_bisector, is_bisector, mill, parent, maxdepth, shape,  z_offset);
-		process_vcarve(tool, (X1 + X2)/2, (Y1 + Y2)/2, X2, Y2, is_inner_bisector, is_bisector, mill, parent, maxdepth, shape,  z_offset);
+		process_vcarve(job, X1, Y1, (X1 + X2)/2, (Y1 + Y2)/2, is_inner_bisector, is_bisector, mill, parent, maxdepth, z_offset);
+		process_vcarve(job, (X1 + X2)/2, (Y1 + Y2)/2, X2, Y2, is_inner_bisector, is_bisector, mill, parent, maxdepth, z_offset);
 		return;
 	}
 
@@ -572,21 +730,18 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
                 /* four cases to deal with */
 #if 1                
                 /* case 1: d1 and d2 are both ok wrt max depth */
-                if (d1 >= maxdepth && d2 >= maxdepth && should_vcarve(shape, X1, Y1, X2, Y2, is_inner_bisector, is_bisector)) {
+                if (d1 >= maxdepth && d2 >= maxdepth && should_vcarve(job->corners, X1, Y1, X2, Y2, is_inner_bisector, is_bisector)) {
 //                    printf(" CASE 1 \n");
                     if (X1 != X2 || Y1 != Y2) { 
-                            Polygon_2 *p = new(Polygon_2);
-                            p->push_back(Point(X1, Y1));
-                            p->push_back(Point(X2, Y2));
-                            tool->diameter = fmax(tool->diameter, -d1 * 2);
-                            tool->diameter = fmax(tool->diameter, -d2 * 2);
-                            tool->add_poly_vcarve(p, d1 + z_offset, d2 + z_offset, 0, "magenta");
+                            widen_diameter(job, -d1 * 2);
+                            widen_diameter(job, -d2 * 2);
+                            job->segments.push_back({X1, Y1, X2, Y2, d1 + z_offset, d2 + z_offset, 0, "magenta"});
                     }
                 }
 #endif                
 #if 1
                 /* case 2: d1 and d2 are both not ok wrt max depth */
-                if (0 && d1 < maxdepth && d2 < maxdepth && should_vcarve(shape, X1, Y1, X2, Y2, is_inner_bisector, is_bisector)) {
+                if (0 && d1 < maxdepth && d2 < maxdepth && should_vcarve(job->corners, X1, Y1, X2, Y2, is_inner_bisector, is_bisector)) {
                   if (X1 != X2 || Y1 != Y2) { 
                     double x1,y1,x2,y2,x3,y3,x4,y4;
                     double r1, r2;
@@ -609,7 +764,6 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
                                 
                     if (ret == 0) {
                                 
-                      Polygon_2 *p = new(Polygon_2);
                       if (isnan(x1) || isnan(x2) || isnan(y1) || isnan(y2)) {
                         printf("%5.5f,%5.5f   -> %5.5f,%5.5f\n", X1, Y1, X2, Y2);
                         printf("d1 %5.2f   d2 %5.2f\n", d1, d2);
@@ -620,16 +774,11 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
 //                      printf("generate %5.5f %5.5f\n", x1,y1);
 //                      printf("generate %5.5f %5.5f\n", x2,y2);
 
-					  p->push_back(Point(x1, y1));
-    	              p->push_back(Point(x2, y2));
-                      tool->diameter = mill->distance_of_geometry(maxdepth) * 2;
-                      tool->add_poly_vcarve(p, maxdepth + z_offset, maxdepth + z_offset, 0, "cyan");
+                      set_diameter(job, mill->distance_of_geometry(maxdepth) * 2);
+                      job->segments.push_back({x1, y1, x2, y2, maxdepth + z_offset, maxdepth + z_offset, 0, "cyan"});
                     
-                      Polygon_2 *p2 = new(Polygon_2);
-					  p2->push_back(Point(x3, y3));
-        	          p2->push_back(Point(x4, y4));
-                      tool->diameter = mill->distance_of_geometry(maxdepth) * 2;
-                      tool->add_poly_vcarve(p2, maxdepth + z_offset, maxdepth + z_offset, 0, "purple");
+                      set_diameter(job, mill->distance_of_geometry(maxdepth) * 2);
+                      job->segments.push_back({x3, y3, x4, y4, maxdepth + z_offset, maxdepth + z_offset, 0, "purple"});
                     }
                 
 //                    printf(" CASE 2 \n");
@@ -653,7 +802,7 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
                 /* case 4: d1 is ok d2 is not ok */
                 if (d1 >= maxdepth && d2 < maxdepth) {
 				  bool exclusioncase = false;
-				  if (d1 == 0 && !should_vcarve(shape, X1, Y1, X2, Y2, is_inner_bisector, is_bisector))
+				  if (d1 == 0 && !should_vcarve(job->corners, X1, Y1, X2, Y2, is_inner_bisector, is_bisector))
 						exclusioncase = true; 
                   if ( (X1 != X2 || Y1 != Y2) && !exclusioncase) { 
                     double x1,y1;
@@ -676,12 +825,9 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
 //                    printf("Point M (%5.2f,%5.2f) at %5.2f\n", Xm, Ym, d1 + ratio * (d2-d1));
 
                     /* From X1 to Xm is business as usual */
-                    Polygon_2 *p = new(Polygon_2);
-                    p->push_back(Point(X1, Y1));
-                    p->push_back(Point(Xm, Ym));
-                    tool->diameter = fmax(tool->diameter, -d1 * 2);
-                    tool->diameter = fmax(tool->diameter, -fabs(maxdepth) * 2);
-                    tool->add_poly_vcarve(p, d1 + z_offset, maxdepth + z_offset, 0, "blue");
+                    widen_diameter(job, -d1 * 2);
+                    widen_diameter(job, -fabs(maxdepth) * 2);
+                    job->segments.push_back({X1, Y1, Xm, Ym, d1 + z_offset, maxdepth + z_offset, 0, "blue"});
 
 #if 0
                     /* and from Xm to X2 is like case 2 */
@@ -701,21 +847,15 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
                         printf("x3 %5.2f y3 %5.2f   x4 %5.2f  y4 %5.2f\n", x3, y3, x4, y4);
                       }
                                 
-                    Polygon_2 *p3 = new(Polygon_2);
 //                    printf("x1 %5.2f y1 %5.2f   x2 %5.2f  y2 %5.2f\n", x1, y1, x2, y2);
 //                    printf("x3 %5.2f y3 %5.2f   x4 %5.2f  y4 %5.2f\n", x3, y3, x4, y4);
-                    p3->push_back(Point(x1, y1));
-                    p3->push_back(Point(x2, y2));
-                    tool->diameter = depth_to_radius(maxdepth, angle) * 2;
+                    set_diameter(job, depth_to_radius(maxdepth, angle) * 2);
                     if (ret == 0)
-                        tool->add_poly_vcarve(p3, maxdepth + z_offset, maxdepth + z_offset, 0,"red");
+                        job->segments.push_back({x1, y1, x2, y2, maxdepth + z_offset, maxdepth + z_offset, 0, "red"});
                     
-                    Polygon_2 *p2 = new(Polygon_2);
-                    p2->push_back(Point(x3, y3));
-                    p2->push_back(Point(x4, y4));
-                    tool->diameter = depth_to_radius(maxdepth, angle) * 2;
+                    set_diameter(job, depth_to_radius(maxdepth, angle) * 2);
                     if (ret == 0)
-                        tool->add_poly_vcarve(p2, maxdepth + z_offset, maxdepth + z_offset, 0, "red");
+                        job->segments.push_back({x3, y3, x4, y4, maxdepth + z_offset, maxdepth + z_offset, 0, "red"});
                 
 #endif                    
                     }
@@ -725,7 +865,7 @@ static void process_vcarve(class toollevel *tool, double X1, double Y1, double X
 	}
 }
 
-void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double stock_to_leave)
+void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double stock_to_leave, vector<struct vcarve_job> &jobs)
 {
 	class endmill *mill = get_endmill(toolnr);
     if (!polyhole) {
@@ -736,8 +876,8 @@ void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double sto
     
 //    printf("VCarve toolpath\n");
     
-    if (!iss) {
-        iss =  CGAL::create_interior_straight_skeleton_2(*polyhole);
+    if (!ss_cache) {
+        ss_cache = skeleton_cache_open(*polyhole);
     }
     
 
@@ -766,16 +906,7 @@ void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double sto
         
         PolygonWithHolesPtrVector  offset_polygons;
 
-		bool had_exception = true;
-        while (had_exception) {
-            had_exception = false;
-            try {
-                offset_polygons = arrange_offset_polygons_2(CGAL::create_offset_polygons_2<Polygon_2>(diameter,*iss) );
-            } catch (...) { had_exception = true;};
-            
-            if (had_exception)
-                diameter = diameter + 0.00001;
-        }
+        offset_polygons = cached_offset(diameter, ss_cache, &iss, polyhole, &exact_iss);
         
         for (auto ply : offset_polygons) {        
             Polygon_2 *p;
@@ -785,10 +916,7 @@ void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double sto
 				unsigned next = i + 1;
 				if (next >= p->size())
 					next = 0;
-				Polygon_2 *p2 = new(Polygon_2);
-                p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-                p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-	            tool->add_poly_vcarve(p2, maxdepth + z_offset, maxdepth + z_offset, 0, "orange");
+	            tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()), CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), maxdepth + z_offset, maxdepth + z_offset, 0, "orange");
 			}
 
               for(auto hi = ply->holes_begin() ; hi != ply->holes_end() ; ++ hi ) {
@@ -799,10 +927,7 @@ void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double sto
 					unsigned next = i + 1;
 					if (next >= p->size())
 						next = 0;
-					Polygon_2 *p2 = new(Polygon_2);
-					p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-   	             	p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-	            	tool->add_poly_vcarve(p2, maxdepth + z_offset, maxdepth + z_offset, 0, "orange");
+	            	tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()), CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), maxdepth + z_offset, maxdepth + z_offset, 0, "orange");
 				}
               }
         }
@@ -821,16 +946,85 @@ void inputshape::create_toolpaths_vcarve(int toolnr, double maxdepth, double sto
     tool->minY = minY;
     td->toollevels.push_back(tool);
     
-    for (auto x = iss->halfedges_begin(); x != iss->halfedges_end(); ++x) {
-            double X1, Y1, X2, Y2;
-            X1 = point_snap2(CGAL::to_double(x->vertex()->point().x()));
-            Y1 = point_snap2(CGAL::to_double(x->vertex()->point().y()));
-            
-            X2 = point_snap2(CGAL::to_double(x->opposite()->vertex()->point().x()));
-            Y2 = point_snap2(CGAL::to_double(x->opposite()->vertex()->point().y()));
+    vector<struct skeleton_edge> edges;
+    if (!skeleton_cache_get_edges(ss_cache, &edges)) {
+        if (!iss)
+            iss = create_skeleton(*polyhole);
+        skeleton_edges(iss, edges);
+        skeleton_cache_put_edges(ss_cache, edges);
+    }
+
+    /* the halfedges themselves get carved by run_vcarve_jobs() */
+    vcarve_corners.clear();
+    collect_vcarve_corners(this, vcarve_corners);
+    for (auto &x : edges) {
+            struct vcarve_job job;
+            job.X1 = point_snap2(x.X1);
+            job.Y1 = point_snap2(x.Y1);
             
-			process_vcarve(tool, X1, Y1, X2, Y2, x->is_inner_bisector(), x->is_bisector(), mill, parent, maxdepth, this, z_offset + stock_to_leave);
+            job.X2 = point_snap2(x.X2);
+            job.Y2 = point_snap2(x.Y2);
+
+            job.tool = tool;
+            job.parent = parent;
+            job.mill = mill;
+            job.corners = &vcarve_corners;
+            job.is_inner_bisector = x.is_inner_bisector;
+            job.is_bisector = x.is_bisector;
+            job.maxdepth = maxdepth;
+            job.z_offset = z_offset + stock_to_leave;
+            job.diameter_set = false;
+            job.diameter = 0;
+            jobs.push_back(job);
+    }
+}
+
+static std::atomic<unsigned int> next_vcarve_job;
+
+static void *vcarve_thread(void *data)
+{
+    vector<struct vcarve_job> *jobs = (vector<struct vcarve_job> *)data;
+    unsigned int i;
+
+    while ((i = next_vcarve_job++) < jobs->size()) {
+        struct vcarve_job *job = &(*jobs)[i];
+        process_vcarve(job, job->X1, job->Y1, job->X2, job->Y2, job->is_inner_bisector, job->is_bisector, job->mill, job->parent, job->maxdepth, job->z_offset);
+    }
+    return NULL;
+}
+
+void run_vcarve_jobs(vector<struct vcarve_job> &jobs)
+{
+    vector<pthread_t> threads;
+    int nthreads = 1;
+    int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads > (int)jobs.size())
+        nthreads = jobs.size();
+    if (nthreads < 1)
+        nthreads = 1;
+
+    next_vcarve_job = 0;
+    threads.resize(nthreads);
+    for (i = 1; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, vcarve_thread, &jobs);
+    vcarve_thread(&jobs);
+    for (i = 1; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    /* in job order, exactly as if the halfedges had been carved one by one */
+    for (auto &job : jobs) {
+        if (job.diameter_set)
+            job.tool->diameter = job.diameter;
+        else
+            job.tool->diameter = fmax(job.tool->diameter, job.diameter);
+        for (auto &s : job.segments)
+            job.tool->add_vcarve_segment(s.X1, s.Y1, s.X2, s.Y2, s.depth, s.depth2, s.priority, s.color);
     }
+    vprintf("V-carved %i skeleton halfedges on %i threads\n", (int)jobs.size(), nthreads);
 }
 
 void inputshape::consolidate_toolpaths(bool want_inbetween_paths)
@@ -20,6 +20,7 @@ int verbose = 0;
 int quiet = 0;
 
 static int stl_flip = 0;
+static double heightmap_width = 0;
 static int direct = 0;
 
 double option_to_double_mm(char *str, bool metric_default)
@@ -61,6 +62,15 @@ void usage(void)
 	printf("\t--stlZoffset <pct>	(-Z)	Drop <pct> amount from the bottom of the STL model\n");
 	printf("\t--direct			 	(-O)	Force direct toolpath mode\n");
 	printf("\t--quiet				(-q)	suppress non-error prints\n");
+	printf("\t--low-retract <mm>	(-r)	only retract to <mm> above the remaining stock between cuts\n");
+	printf("\t--waterline		(-W)	rough STL files in Z levels instead of raster lines\n");
+	printf("\t--rest-machining		(-R)	STL files: only cut where the previous tools left material\n");
+	printf("\t--optimize-cutout	(-B)	inlay plug: shrink the cutout around the design\n");
+	printf("\t--heightmap-width <mm>	(-H)	X size of a .png heightmap (white is high)\n");
+	printf("\t--curve-tolerance <mm>	(-T)	how far flattened curves may stray from the real curve\n");
+	printf("\t--simplify <mm>		(-S)	drop outline vertices that are within <mm> of the simplified outline\n");
+	printf("\t--cache-dir <dir>	(-C)	keep straight skeleton results in <dir> for the next run\n");
+	printf("\t--profile <file>	(-P)	write time, CPU and allocations per phase and hot routine to <file> as JSON\n");
 	exit(EXIT_SUCCESS);
 }
 
@@ -87,6 +97,15 @@ static struct option long_options[] =
 		  {"Yfront",	required_argument, 0, 'Y'},
 		  {"Xfront",	required_argument, 0, 'X'},
 		  {"stlZoffset",	required_argument, 0, 'Z'},
+		  {"low-retract",	required_argument, 0, 'r'},
+		  {"waterline",	no_argument, 0, 'W'},
+		  {"rest-machining",	no_argument, 0, 'R'},
+		  {"optimize-cutout",	no_argument, 0, 'B'},
+		  {"heightmap-width",	required_argument, 0, 'H'},
+		  {"curve-tolerance",	required_argument, 0, 'T'},
+		  {"simplify",	required_argument, 0, 'S'},
+		  {"cache-dir",	required_argument, 0, 'C'},
+		  {"profile",	required_argument, 0, 'P'},
           {0, 0, 0, 0}
         };
 
@@ -104,7 +123,7 @@ int main(int argc, char **argv)
     
     scene->set_depth(inch_to_mm(0.044));
 
-    while ((opt = getopt_long(argc, argv, "Oqavfsil:t:d:D:xhYXc:o:Z:", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "Oqavfsil:t:d:D:xhYXc:o:Z:r:WRBH:T:S:C:P:", long_options, &option_index)) != -1) {
         switch (opt)
 		{
 			case 'v':
@@ -161,6 +180,39 @@ int main(int argc, char **argv)
 			case 'x':
 				gcode_want_separate_files();
 				break;
+			case 'r': /* mm */
+				gcode_want_low_retract(option_to_double_mm(optarg, true));
+				qprintf("Low retracts with %5.2fmm clearance\n", option_to_double_mm(optarg, true));
+				break;
+			case 'W':
+				scene->enable_waterline();
+				qprintf("Waterline roughing for STL files\n");
+				break;
+			case 'R':
+				scene->enable_rest_machining();
+				qprintf("Rest machining for STL files\n");
+				break;
+			case 'B':
+				scene->enable_optimized_cutout();
+				qprintf("Optimizing the inlay plug cutout\n");
+				break;
+			case 'H': /* mm */
+				heightmap_width = option_to_double_mm(optarg, true);
+				break;
+			case 'T': /* mm */
+				curve_tolerance = option_to_double_mm(optarg, true);
+				qprintf("Curve tolerance set to %5.3fmm\n", curve_tolerance);
+				break;
+			case 'S': /* mm */
+				scene->set_simplify_tolerance(option_to_double_mm(optarg, true));
+				qprintf("Simplifying outlines to %5.3fmm\n", scene->get_simplify_tolerance());
+				break;
+			case 'C':
+				set_skeleton_cache_dir(optarg);
+				break;
+			case 'P':
+				enable_profiling(optarg);
+				break;
 			case 'Y':
 				stl_flip = 1;
 				break;
@@ -198,24 +250,39 @@ int main(int argc, char **argv)
 
    for(; optind < argc; optind++) {      
 		char outputfile[81920], *c;
+		struct profile_mark mark;
+
 		strcpy(outputfile, argv[optind]);
 		c = outputfile;
+		profile_add_input(argv[optind]);
+		profile_phase_start(&mark);
 		if (strstr(argv[optind], ".csv") || direct) {
 			parse_csv_file(scene, argv[optind], tool);
+			profile_phase_stop("parse_csv", &mark);
 			c = strstr(outputfile, ".csv");
 			if (!c)
 				c = strstr(outputfile, ".svg");
 		} else if (strstr(argv[optind], ".stl")) {
 			process_stl_file(scene, argv[optind], stl_flip);
+			profile_phase_stop("process_stl", &mark);
 			c = strstr(outputfile, ".stl");
+		} else if (strstr(argv[optind], ".png")) {
+			process_heightmap_file(scene, argv[optind], heightmap_width);
+			profile_phase_stop("process_heightmap", &mark);
+			c = strstr(outputfile, ".png");
 		} else {
 			c = strstr(outputfile, ".svg");
 			parse_svg_file(scene, argv[optind]);
 			scene->set_filename(argv[optind]);
+			profile_phase_stop("parse_svg", &mark);
 
+			profile_phase_start(&mark);
 			scene->process_nesting();
+			profile_phase_stop("process_nesting", &mark);
 
+			profile_phase_start(&mark);
 			scene->create_toolpaths();
+			profile_phase_stop("create_toolpaths", &mark);
 		}
 
 		if (c)
@@ -223,13 +290,18 @@ int main(int argc, char **argv)
 
 		if (verbose)		
 			scene->write_svg("output.svg");
+		profile_phase_start(&mark);
 		scene->write_gcode(outputfile, "main design");
+		profile_phase_stop("write_gcode", &mark);
 		if (scene->inlay_plug) {
 			if (verbose)
 				scene->inlay_plug->write_svg("inlay.svg");
+			profile_phase_start(&mark);
 			scene->inlay_plug->write_gcode("plug.nc", "inlay plug");
+			profile_phase_stop("write_gcode", &mark);
 		}
     }
     
+    write_profile();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
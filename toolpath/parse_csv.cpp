@@ -30,12 +30,6 @@ static double tooldepth = 0.1;
 static double prio = 0;
 static int toolnr;
 
-#ifndef FINE
-static const double detail_threshold = 0.2;
-#else
-static const double detail_threshold = 0.1;
-#endif
-
 static double dist(double X0, double Y0, double X1, double Y1)
 {
   return sqrt((X1-X0)*(X1-X0) + (Y1-Y0)*(Y1-Y0));
@@ -95,11 +89,7 @@ static void line_to(class inputshape *input, class endmill *mill, double X2, dou
 					tool->name = "Manual toolpath";
 					input->tooldepths[depth]->toollevels.push_back(tool);
 		}
-		Polygon_2 *p2;
-		p2 = new(Polygon_2);
-		p2->push_back(Point(X1, Y1));
-		p2->push_back(Point(X2, Y2));
-		input->tooldepths[depth]->toollevels[0]->add_poly_vcarve(p2, Z1, Z2, prio);
+		input->tooldepths[depth]->toollevels[0]->add_vcarve_segment(X1, Y1, X2, Y2, Z1, Z2, prio);
 		
 		Z1 += tooldepth;
 		Z2 += tooldepth;
@@ -165,44 +155,36 @@ static void sphere(class scene *scene, class endmill *mill, double X, double Y,
 }
 
 
+/* same flatness bound as the SVG parser: n steps in t stay within max|B''| / (8 n^2) */
+static int curve_segments(double max_second_derivative)
+{
+    double n = ceil(sqrt(max_second_derivative / (8 * fmax(curve_tolerance, 0.0001))));
+
+    if (n < 1)
+        n = 1;
+    if (n > 10000)
+        n = 10000;
+    return (int)n;
+}
+
 static void cubic_bezier(class inputshape *inputshape, class endmill *mill,
                          double x0, double y0, double z0,
                          double x1, double y1, double z1,
                          double x2, double y2, double z2,
                          double x3, double y3, double z3)
 {
-    double delta = 0.01;
-    double t;
-    double lX = x0, lY = y0, lZ = z0;
-    
-    if (dist(x0,y0,x3,y3) < 150)
-            delta = 1/40.0;
-    if (dist(x0,y0,x3,y3) < 50)
-            delta = 1/20.0;
-    if (dist(x0,y0,x3,y3) < 10)
-            delta = 1/10.0;
-    if (dist(x0,y0,x3,y3) < 5)
-            delta = 1/5.0;
-
-    if (dist(x0,y0,x3,y3) < detail_threshold)
-            delta = 1.0;
-
-	/* bad stuff happens if we end up and an exect multiple of 1 */
-	delta += 0.000013121;
-	delta = delta / 4;
-    t = 0;
-    while (t < 1.0) {
+    double d1 = dist3(0, 0, 0, x0 - 2*x1 + x2, y0 - 2*y1 + y2, z0 - 2*z1 + z2);
+    double d2 = dist3(0, 0, 0, x1 - 2*x2 + x3, y1 - 2*y2 + y3, z1 - 2*z2 + z3);
+    int i, n;
+
+    n = curve_segments(6 * fmax(d1, d2));
+    for (i = 1; i < n; i++) {
+        double t = (double)i / n;
         double nX, nY, nZ;
         nX = (1-t)*(1-t)*(1-t)*x0 + 3*(1-t)*(1-t)*t*x1 + 3 * (1-t)*t*t*x2 + t*t*t*x3;
         nY = (1-t)*(1-t)*(1-t)*y0 + 3*(1-t)*(1-t)*t*y1 + 3 * (1-t)*t*t*y2 + t*t*t*y3;
         nZ = (1-t)*(1-t)*(1-t)*z0 + 3*(1-t)*(1-t)*t*z1 + 3 * (1-t)*t*t*z2 + t*t*t*z3;
-        if (dist3(lX,lY,lZ,nX,nY,nZ) >= detail_threshold) {
-            line_to(inputshape, mill, nX, nY, nZ);
-            lX = nX;
-            lY = nY;
-			lZ = nZ;
-        }
-        t = t + delta;
+        line_to(inputshape, mill, nX, nY, nZ);
     }
 
 	line_to(inputshape, mill, x3, y3, z3);
@@ -213,39 +195,17 @@ static void quadratic_bezier(class inputshape *inputshape, class endmill *mill,
                          double x1, double y1, double z1,
                          double x3, double y3, double z3)
 {
-    double delta = 0.01;
-    double t;
-    double lX = x0, lY = y0, lZ = z0;
+    double d = dist3(0, 0, 0, x0 - 2*x1 + x3, y0 - 2*y1 + y3, z0 - 2*z1 + z3);
+    int i, n;
 
-    
-    if (dist(x0,y0,x3,y3) < 150)
-            delta = 1/40.0;
-    if (dist(x0,y0,x3,y3) < 50)
-            delta = 1/20.0;
-    if (dist(x0,y0,x3,y3) < 10)
-            delta = 1/10.0;
-    if (dist(x0,y0,x3,y3) < 5)
-            delta = 1/5.0;
-
-    if (dist(x0,y0,x3,y3) < detail_threshold)
-            delta = 1.0;
-
-	delta += 0.0000131313;
-	delta = delta / 4;
-    
-    t = 0;
-    while (t < 1.0) {
+    n = curve_segments(2 * d);
+    for (i = 1; i < n; i++) {
+        double t = (double)i / n;
         double nX, nY, nZ;
         nX = (1-t)*(1-t)*x0 + 2*(1-t)*t*x1 + t*t*x3;
         nY = (1-t)*(1-t)*y0 + 2*(1-t)*t*y1 + t*t*y3;
         nZ = (1-t)*(1-t)*z0 + 2*(1-t)*t*z1 + t*t*z3;
-        if (dist3(lX,lY,lZ, nX,nY,nZ) >= detail_threshold) {
-            line_to(inputshape, mill, nX, nY, nZ);
-            lX = nX;
-            lY = nY;
-			lZ = nZ;
-        }
-        t = t + delta;
+        line_to(inputshape, mill, nX, nY, nZ);
     }
 	line_to(inputshape, mill, x3, y3, z3);
 }                    
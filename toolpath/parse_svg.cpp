@@ -13,37 +13,37 @@
 #include <math.h>
 
 #include "scene.h"
+#include "svgtok.h"
 #include "toolpath.h"
 
 /* SVG path supports relative-to-last coordinates... even across elements */
 static double last_X, last_Y;
 
-#ifndef FINE
-static const double detail_threshold = 1.0;
-#else
-static const double detail_threshold = 0.5;
-#endif
+/* curves are flattened until no point is further than this (in mm) from its chord */
+double curve_tolerance = 0.05;
 
-static double dist(double X0, double Y0, double X1, double Y1)
-{
-  return sqrt((X1-X0)*(X1-X0) + (Y1-Y0)*(Y1-Y0));
-}
+static long curve_count, curve_segment_count;
 
 static double svgheight = 0;
 
-static void chr_replace(char *line, char a, char r)
-{
-    char *c;
-    do {
-        c = strchr(line, a);
-        if (c)
-            *c = r;
-    } while (c);
-}
-
-static inline double distance(double x0, double y0, double x1, double y1)
+/*
+ * With n equal steps in t, a curve stays within max|B''| / (8 n^2) of its chords.
+ * |B''| is bounded by the second differences of the control points: 6x the largest for
+ * a cubic, 2x the (constant) one for a quadratic. Gentle curves get few points, tight
+ * ones as many as the tolerance needs.
+ */
+static int curve_segments(double max_second_derivative)
 {
-    return sqrt( (x1-x0) * (x1-x0) + (y1-y0) * (y1-y0));
+    double tolerance = mm_to_px(fmax(curve_tolerance, 0.0001));
+    double n = ceil(sqrt(max_second_derivative / (8 * tolerance)));
+
+    if (n < 1)
+        n = 1;
+    if (n > 10000)
+        n = 10000;
+    curve_count++;
+    curve_segment_count += (int)n;
+    return (int)n;
 }
 
 static void cubic_bezier(class scene *scene,
@@ -52,35 +52,17 @@ static void cubic_bezier(class scene *scene,
                          double x2, double y2,
                          double x3, double y3)
 {
-    double delta = 0.01;
-    double t;
-    double lX = x0, lY = y0;
-    
-    if (dist(x0,y0,x3,y3) < 150)
-            delta = 1/40.0;
-    if (dist(x0,y0,x3,y3) < 50)
-            delta = 1/20.0;
-    if (dist(x0,y0,x3,y3) < 10)
-            delta = 1/10.0;
-    if (dist(x0,y0,x3,y3) < 5)
-            delta = 1/5.0;
+    double d1 = sqrt((x0 - 2*x1 + x2)*(x0 - 2*x1 + x2) + (y0 - 2*y1 + y2)*(y0 - 2*y1 + y2));
+    double d2 = sqrt((x1 - 2*x2 + x3)*(x1 - 2*x2 + x3) + (y1 - 2*y2 + y3)*(y1 - 2*y2 + y3));
+    int i, n;
 
-    if (dist(x0,y0,x3,y3) < detail_threshold)
-            delta = 1.0;
-
-	/* bad stuff happens if we end up and an exect multiple of 1 */
-	delta += 0.000013121;
-    t = 0;
-    while (t < 1.0) {
+    n = curve_segments(6 * fmax(d1, d2));
+    for (i = 1; i < n; i++) {
+        double t = (double)i / n;
         double nX, nY;
         nX = (1-t)*(1-t)*(1-t)*x0 + 3*(1-t)*(1-t)*t*x1 + 3 * (1-t)*t*t*x2 + t*t*t*x3;
         nY = (1-t)*(1-t)*(1-t)*y0 + 3*(1-t)*(1-t)*t*y1 + 3 * (1-t)*t*t*y2 + t*t*t*y3;
-        if (distance(lX,lY, nX,nY) >= detail_threshold) {
-            scene->add_point_to_poly(px_to_mm(nX), px_to_mm(svgheight + nY));
-            lX = nX;
-            lY = nY;
-        }
-        t = t + delta;
+        scene->add_point_to_poly(px_to_mm(nX), px_to_mm(svgheight + nY));
     }
 
     scene->add_point_to_poly(px_to_mm(x3),px_to_mm(svgheight + y3));
@@ -91,36 +73,16 @@ static void quadratic_bezier(class scene *scene,
                          double x1, double y1,
                          double x3, double y3)
 {
-    double delta = 0.01;
-    double t;
-    double lX = x0, lY = y0;
-
-    
-    if (dist(x0,y0,x3,y3) < 150)
-            delta = 1/40.0;
-    if (dist(x0,y0,x3,y3) < 50)
-            delta = 1/20.0;
-    if (dist(x0,y0,x3,y3) < 10)
-            delta = 1/10.0;
-    if (dist(x0,y0,x3,y3) < 5)
-            delta = 1/5.0;
-
-    if (dist(x0,y0,x3,y3) < detail_threshold)
-            delta = 1.0;
+    double d = sqrt((x0 - 2*x1 + x3)*(x0 - 2*x1 + x3) + (y0 - 2*y1 + y3)*(y0 - 2*y1 + y3));
+    int i, n;
 
-	delta += 0.0000131313;
-    
-    t = 0;
-    while (t < 1.0) {
+    n = curve_segments(2 * d);
+    for (i = 1; i < n; i++) {
+        double t = (double)i / n;
         double nX, nY;
         nX = (1-t)*(1-t)*x0 + 2*(1-t)*t*x1 + t*t*x3;
         nY = (1-t)*(1-t)*y0 + 2*(1-t)*t*y1 + t*t*y3;
-        if (distance(lX,lY, nX,nY) >= detail_threshold) {
-            scene->add_point_to_poly(px_to_mm(nX), px_to_mm(svgheight + nY));
-            lX = nX;
-            lY = nY;
-        }
-        t = t + delta;
+        scene->add_point_to_poly(px_to_mm(nX), px_to_mm(svgheight + nY));
     }
     scene->add_point_to_poly(px_to_mm(x3), px_to_mm(svgheight + y3));
 }                    
@@ -129,23 +91,21 @@ static void quadratic_bezier(class scene *scene,
 /*
 <circle cx="440.422" cy="312.878" r="12" stroke="black" stroke-width="1" fill="none" />
 */
-static void parse_circle(class scene *scene, char *line, double depthratio)
+static void parse_circle(class scene *scene, const struct svg_element *element, double depthratio)
 {
-    char *cx, *cy, *r;
+    struct svg_attribute cx, cy, r;
     double X,Y,R,phi;
-    cx = strstr(line, "cx=\"");
-    cy = strstr(line, "cy=\"");
-    r = strstr(line, "r=\"");
-    if (!cx || !cy || !r) {
-        printf("Failed to parse circle: %s\n", line);
+    if (!svg_find_attribute(element, "cx", &cx) || !svg_find_attribute(element, "cy", &cy) ||
+        !svg_find_attribute(element, "r", &r)) {
+        printf("Failed to parse circle: %.*s\n", (int)element->length, element->text);
         return;
     }
     scene->end_poly();
     scene->set_poly_name("circle");
 	scene->set_depth_ratio(depthratio);
-    X = strtod(cx + 4, NULL);
-    Y = strtod(cy + 4, NULL);
-    R = strtod(r + 3, NULL);
+    X = strtod(cx.value, NULL);
+    Y = strtod(cy.value, NULL);
+    R = strtod(r.value, NULL);
     phi = 0;
     while (phi < 360) {
         double P;
@@ -158,10 +118,36 @@ static void parse_circle(class scene *scene, char *line, double depthratio)
     scene->end_poly();
 }
 
-static void push_chunk(class scene *scene, char *chunk, char *line, double depthratio)
+static bool is_separator(char c)
+{
+    return c == ' ' || c == ',' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/*
+ * next number in a path chunk; strtod() cannot run off the mapping since every
+ * chunk sits inside a quoted value of a complete element
+ */
+static double next_number(const char **c, const char *end)
+{
+    char *e;
+    double value;
+
+    while (*c < end && is_separator(**c))
+        (*c)++;
+    if (*c >= end)
+        return 0.0;
+    value = strtod(*c, &e);
+    if (e > *c && e <= end)
+        *c = e;
+    else
+        *c = end;
+    return value;
+}
+
+static void push_chunk(class scene *scene, const char *chunk, const char *end, const struct svg_element *element, double depthratio)
 {
     char command;
-    char *c;
+    const char *c;
 #if 0
     double distance;
 #endif
@@ -169,17 +155,12 @@ static void push_chunk(class scene *scene, char *chunk, char *line, double depth
     command = chunk[0];
     c = &chunk[0];
     c++;
-    arg1 = strtod(c, &c);
-    if (c && strlen(c) > 0)
-        arg2 = strtod(c, &c);
-    if (c && strlen(c) > 0)
-        arg3 = strtod(c, &c);
-    if (c && strlen(c) > 0)
-        arg4 = strtod(c, &c);
-    if (c && strlen(c) > 0)
-        arg5 = strtod(c, &c);
-    if (c && strlen(c) > 0)
-        arg6 = strtod(c, &c);
+    arg1 = next_number(&c, end);
+    arg2 = next_number(&c, end);
+    arg3 = next_number(&c, end);
+    arg4 = next_number(&c, end);
+    arg5 = next_number(&c, end);
+    arg6 = next_number(&c, end);
     switch (command) {
 		case 'l':
             arg1 += last_X;
@@ -257,26 +238,23 @@ static void push_chunk(class scene *scene, char *chunk, char *line, double depth
             scene->end_poly();
             break;
         default:
-            printf("Unknown command in chunk: %s  (%s)\n", chunk, line);
+            printf("Unknown command in chunk: %.*s  (%.*s)\n", (int)(end - chunk), chunk, (int)element->length, element->text);
     }
     
 }
 
-static const char *valid = "0123456789.eE- ";
+static const char *valid = "0123456789.eE-+, \t\r\n";
 
-static void strip_str(char *line)
-{
-    while (strlen(line) > 0 && line[strlen(line)-1] == '\n')
-            line[strlen(line)-1] = 0;
-    while (strlen(line) > 0 && line[strlen(line)-1] == ' ')
-            line[strlen(line)-1] = 0;
-}
-
-static double parse_fill_to_depth(char *line)
+static double parse_fill_to_depth(const char *value, size_t length)
 {
 	double ratio = 1.0;
-	char *c = strdup(line);
+	char c[256];
 	char *c2;
+	/* a style value is short, a local copy keeps the string functions below simple */
+	if (length >= sizeof(c))
+		length = sizeof(c) - 1;
+	memcpy(c, value, length);
+	c[length] = 0;
 	c2 = strchr(c, ';');
 	if (c2)
 		*c2 = 0;
@@ -293,29 +271,25 @@ static double parse_fill_to_depth(char *line)
 
 	if (strstr(c2, "none"))
 		ratio = 1.0;
-	free(c);
 	vprintf("Found depth ratio %5.4f\n", ratio);
 	return ratio;
 	
 }
 
-static void parse_line(class scene *scene, char *line)
+static void parse_element(class scene *scene, const struct svg_element *element)
 {
-    char *c;
-    char chunk[4095];
-    double height;
+    struct svg_attribute attr;
+    const char *c, *end, *chunk;
 	double depthratio = 1.0;
 
-	c = strstr(line, "style=\"fill:");
-	if (c) {
-		depthratio = parse_fill_to_depth(c + 12);
+	if (svg_find_attribute(element, "style", &attr) && attr.value_length >= 5 &&
+	    strncmp(attr.value, "fill:", 5) == 0) {
+		depthratio = parse_fill_to_depth(attr.value + 5, attr.value_length - 5);
 	}
     
-    c = strstr(line, "height=\"");
-    if (c) {
-        height = strtod(c+8, NULL);
+    if (svg_find_attribute(element, "height", &attr)) {
 //        scene->declare_minY(px_to_mm(-height));
-        svgheight = height;
+        svgheight = strtod(attr.value, NULL);
     }
     /*
     c = strstr(line, "width=\"");
@@ -326,107 +300,55 @@ static void parse_line(class scene *scene, char *line)
     }
     */
     
-    c = strstr(line,"<circle cx=");
-    if (c) {
-        parse_circle(scene, line, depthratio);
+    if (element->name_length == 6 && memcmp(element->name, "circle", 6) == 0) {
+        parse_circle(scene, element, depthratio);
     }
-    c = strstr(line, " d=\"");
-    if (c == NULL)
+    if (!svg_find_attribute(element, "d", &attr))
         return;
-    c += 4;
-    chr_replace(c, '"', 0);
-    chr_replace(line, ',', ' ');
-//    printf("Line is %s\n", c);
-    chunk[0] = 0;
-    memset(chunk, 0, sizeof(chunk));
-    while (*c) {
-        if (strchr(valid, *c)) {
-            chunk[strlen(chunk)] = *c;            
-        } else {
-            strip_str(chunk);
-            if (strlen(chunk) > 0)
-                push_chunk(scene, chunk, line, depthratio);
-            memset(chunk, 0, sizeof(chunk));
-            chunk[strlen(chunk)] = *c;           
+
+    /* a chunk is one command letter plus the numbers that follow it */
+    c = attr.value;
+    end = attr.value + attr.value_length;
+    chunk = c;
+    while (c <= end) {
+        if (c < end && *c && strchr(valid, *c)) {
+            c++;
+            continue;
         }
+        if (c > chunk) {
+            const char *e = c;
+            while (e > chunk && is_separator(e[-1]))
+                e--;
+            while (chunk < e && is_separator(*chunk))
+                chunk++;
+            if (e > chunk)
+                push_chunk(scene, chunk, e, element, depthratio);
+        }
+        chunk = c;
         c++;
     }
-    strip_str(chunk);
-    if (strlen(chunk) > 0)
-        push_chunk(scene, chunk, line, depthratio);
     scene->end_poly();
 }
 
-
-static int count_char(char *string, char c)
-{
-	int count = 0;
-	char *l;
-	l = string;
-	while (*l != 0) {
-		if (*l == c)
-			count++;
-		l++;
-	}
-	return count;
-}
-
-
-static char *str_append(char *str, char *append)
-{
-	int newlen = strlen(append);
-	char *c;
-	char *newstr;
-	if (str)
-		newlen += strlen(str);
-
-	newstr = (char *)calloc(newlen + 1, 1);
-	if (str)
-		strcat(newstr, str);
-	if (append)
-		strcat(newstr, append);
-
-	c = strchr(newstr, '\n');
-	if (c)
-		*c = ' ';
-	c = strchr(newstr, '\n');
-	if (c)
-		*c = ' ';
-	if (str)
-		free(str);
-	return newstr;
-}
-
 void parse_svg_file(class scene *scene, const char *filename)
 {
-    FILE *file;
-	char *l = NULL;
+    struct svg_map map;
+    struct svg_reader reader;
+    struct svg_element element;
     
-    file = fopen(filename, "r");
-    if (!file) {
+    if (!svg_map_file(&map, filename)) {
         printf("Cannot open %s : %s\n", filename, strerror(errno));
         return;
     }
     
-    while (!feof(file)) {
-        char * ret;
-        char line[40960];
-        ret = fgets(&line[0], sizeof(line), file);
-		if (!ret)
-			continue;
-
-		l = str_append(l, line);
-
-        if (count_char(l, '<') == count_char(l, '>') || feof(file)) {
-            parse_line(scene, l);
-			free(l);
-			l = NULL;
-        }
-    }
-	if (l) {
-		parse_line(scene, l);
-		free(l);
-		l = NULL;
-	}
-    fclose(file);
+    curve_count = 0;
+    curve_segment_count = 0;
+    svg_reader_init(&reader, &map);
+    while (svg_next_element(&reader, &element))
+        parse_element(scene, &element);
+    if (curve_count > 0)
+        qprintf("Curves                        : %li flattened into %li segments (%5.3fmm tolerance)\n",
+            curve_count, curve_segment_count, curve_tolerance);
+
+    svg_unmap_file(&map);
 }
@@ -0,0 +1,273 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern "C" {
+  #include "toolpath.h"
+}
+
+/*
+ * --profile: where does the time go.
+ *
+ * Phases are the big steps main() runs (parsing, nesting, toolpath creation, writing
+ * the gcode) and always run on the main thread; they get wall time, CPU time of the
+ * whole process (so including worker threads) and the allocations of all threads.
+ *
+ * Routines are the hot functions inside the phases. They can run on any thread and
+ * are counted per call: wall time, CPU time of the calling thread and the allocations
+ * that thread made. Times are inclusive, a consolidate inside gcode emission counts
+ * for both, and calls from parallel threads add up to more than the elapsed time.
+ * get_height() runs far too often for a CPU clock read per call, it only gets wall
+ * time (it never blocks, so that is its CPU time as well).
+ *
+ * Allocations are the C++ operator new calls; plain malloc() is not seen.
+ * At exit the lot is written out as JSON for comparing runs.
+ */
+
+int profiling;
+
+static char *profile_filename;
+static vector<string> inputs;
+
+struct routine_stats {
+	const char *name;
+	bool want_cpu;
+	std::atomic<long long> calls, wall_ns, cpu_ns, allocations, allocated_bytes;
+};
+
+static struct routine_stats routines[PROFILE_ROUTINES] = {
+	{ "skeleton", true, {0}, {0}, {0}, {0}, {0} },
+	{ "offset", true, {0}, {0}, {0}, {0}, {0} },
+	{ "consolidate", true, {0}, {0}, {0}, {0}, {0} },
+	{ "trim_intersects", true, {0}, {0}, {0}, {0}, {0} },
+	{ "sort", true, {0}, {0}, {0}, {0}, {0} },
+	{ "get_height", false, {0}, {0}, {0}, {0}, {0} },
+	{ "gcode_emit", true, {0}, {0}, {0}, {0}, {0} },
+};
+
+struct phase_stats {
+	string name;
+	long calls;
+	long long wall_ns, cpu_ns, allocations, allocated_bytes;
+};
+
+static vector<struct phase_stats> phases;
+static struct profile_mark run_start;
+
+static thread_local long long thread_allocations, thread_allocated_bytes;
+static std::atomic<long long> total_allocations, total_allocated_bytes;
+
+void *operator new(size_t size)
+{
+	void *p;
+
+	if (profiling) {
+		thread_allocations++;
+		thread_allocated_bytes += size;
+		total_allocations.fetch_add(1, std::memory_order_relaxed);
+		total_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+static long long clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void enable_profiling(const char *filename)
+{
+	free(profile_filename);
+	profile_filename = strdup(filename);
+	profiling = 1;
+	profile_phase_start(&run_start);
+}
+
+void profile_add_input(const char *filename)
+{
+	if (profiling)
+		inputs.push_back(filename);
+}
+
+void profile_start(int routine, struct profile_mark *mark)
+{
+	mark->wall_ns = clock_ns(CLOCK_MONOTONIC);
+	mark->cpu_ns = 0;
+	if (routines[routine].want_cpu)
+		mark->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	mark->allocations = thread_allocations;
+	mark->allocated_bytes = thread_allocated_bytes;
+}
+
+void profile_stop(int routine, struct profile_mark *mark)
+{
+	struct routine_stats *r = &routines[routine];
+
+	r->calls++;
+	r->wall_ns += clock_ns(CLOCK_MONOTONIC) - mark->wall_ns;
+	if (r->want_cpu)
+		r->cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - mark->cpu_ns;
+	r->allocations += thread_allocations - mark->allocations;
+	r->allocated_bytes += thread_allocated_bytes - mark->allocated_bytes;
+}
+
+void profile_phase_start(struct profile_mark *mark)
+{
+	mark->wall_ns = clock_ns(CLOCK_MONOTONIC);
+	mark->cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	mark->allocations = total_allocations;
+	mark->allocated_bytes = total_allocated_bytes;
+}
+
+static void phase_delta(struct profile_mark *mark, struct phase_stats *delta)
+{
+	delta->wall_ns = clock_ns(CLOCK_MONOTONIC) - mark->wall_ns;
+	delta->cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - mark->cpu_ns;
+	delta->allocations = total_allocations - mark->allocations;
+	delta->allocated_bytes = total_allocated_bytes - mark->allocated_bytes;
+}
+
+/* the same phase for a second input file adds to the first one */
+void profile_phase_stop(const char *name, struct profile_mark *mark)
+{
+	struct phase_stats delta;
+	unsigned int i;
+
+	if (!profiling)
+		return;
+	phase_delta(mark, &delta);
+
+	for (i = 0; i < phases.size(); i++)
+		if (phases[i].name == name)
+			break;
+	if (i == phases.size()) {
+		struct phase_stats p = { name, 0, 0, 0, 0, 0 };
+		phases.push_back(p);
+	}
+	phases[i].calls++;
+	phases[i].wall_ns += delta.wall_ns;
+	phases[i].cpu_ns += delta.cpu_ns;
+	phases[i].allocations += delta.allocations;
+	phases[i].allocated_bytes += delta.allocated_bytes;
+}
+
+static void write_json_string(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(file, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(file, "\\u%04x", *str);
+		else
+			fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static void write_json_counts(FILE *file, long long calls, long long wall_ns, long long cpu_ns, bool have_cpu,
+				long long allocations, long long allocated_bytes)
+{
+	fprintf(file, "\"calls\": %lli, \"wall_seconds\": %.6f, ", calls, wall_ns / 1e9);
+	if (have_cpu)
+		fprintf(file, "\"cpu_seconds\": %.6f, ", cpu_ns / 1e9);
+	else
+		fprintf(file, "\"cpu_seconds\": null, ");
+	fprintf(file, "\"allocations\": %lli, \"allocated_bytes\": %lli", allocations, allocated_bytes);
+}
+
+void write_profile(void)
+{
+	struct phase_stats total;
+	FILE *file;
+	unsigned int i;
+	int threads = 1;
+
+	if (!profiling)
+		return;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	phase_delta(&run_start, &total);
+
+	file = fopen(profile_filename, "w");
+	if (!file) {
+		printf("Failed to write profile %s\n", profile_filename);
+		return;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"version\": 1,\n");
+	fprintf(file, "  \"inputs\": [");
+	for (i = 0; i < inputs.size(); i++) {
+		if (i)
+			fprintf(file, ", ");
+		write_json_string(file, inputs[i].c_str());
+	}
+	fprintf(file, "],\n");
+	fprintf(file, "  \"processors\": %i,\n", threads);
+	fprintf(file, "  \"total\": { ");
+	write_json_counts(file, 1, total.wall_ns, total.cpu_ns, true, total.allocations, total.allocated_bytes);
+	fprintf(file, " },\n");
+
+	fprintf(file, "  \"phases\": [\n");
+	for (i = 0; i < phases.size(); i++) {
+		struct phase_stats *p = &phases[i];
+
+		fprintf(file, "    { \"name\": ");
+		write_json_string(file, p->name.c_str());
+		fprintf(file, ", ");
+		write_json_counts(file, p->calls, p->wall_ns, p->cpu_ns, true, p->allocations, p->allocated_bytes);
+		fprintf(file, " }%s\n", i + 1 < phases.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n");
+
+	fprintf(file, "  \"routines\": [\n");
+	for (i = 0; i < PROFILE_ROUTINES; i++) {
+		struct routine_stats *r = &routines[i];
+
+		fprintf(file, "    { \"name\": ");
+		write_json_string(file, r->name);
+		fprintf(file, ", ");
+		write_json_counts(file, r->calls, r->wall_ns, r->cpu_ns, r->want_cpu, r->allocations, r->allocated_bytes);
+		fprintf(file, " }%s\n", i + 1 < PROFILE_ROUTINES ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+	fclose(file);
+
+	qprintf("Profile written to %s\n", profile_filename);
+}
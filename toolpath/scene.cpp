@@ -15,6 +15,19 @@ extern "C" {
 
 #include "endmill.h"
 
+#include <random>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+typedef bg::model::point<double, 2, bg::cs::cartesian> bpoint;
+typedef bg::model::box<bpoint> bbox;
+typedef std::pair<bbox, unsigned int> bvalue;
+
 static inline double dist(double X0, double Y0, double X1, double Y1)
 {
   return sqrt((X1-X0)*(X1-X0) + (Y1-Y0)*(Y1-Y0));
@@ -99,7 +112,6 @@ void scene::end_poly(void)
     shapes.push_back(shape);
   }
   shape = NULL;
-  sort(shapes.begin(), shapes.end(), compare_shape);
 }
 
 void scene::push_tool(int toolnr)
@@ -225,14 +237,25 @@ void scene::flatten_nesting(void)
 }
 
 /* input: a vector of shapes, output: nested shapes are properly parented */
-/* This is an O(N^2) algorithm for now */
+/*
+ * A shape can only fit inside shapes whose bounding box covers its own, so an R-tree
+ * over the bounding boxes hands out those candidates and only they get the full
+ * vertex by vertex test. Same answer as trying every larger shape in turn.
+ */
 void scene::process_nesting(void)
 {
   unsigned int i;
+  vector<bvalue> boxes;
+  vector<int> parent;
+  vector<class inputshape *> top;
+  long tests = 0;
   /* first sort so that the vector is smallest first */
   /* invariant thus is that a shape can only be inside later shapes in the vector */
   /* in order of nesting */
-  sort(shapes.begin(), shapes.end(), compare_shape);
+  {
+    profile_scope profile(PROFILE_SORT);
+    sort(shapes.begin(), shapes.end(), compare_shape);
+  }
 
   /* if we are doing a cutout we need to remove the biggest shape, that's the cutout */
   if (cutout_depth != 0 && cutout == NULL) {
@@ -246,18 +269,41 @@ void scene::process_nesting(void)
 
 
   for (i = 0; i < shapes.size(); i++) {
-    unsigned int j;
-    for (j = i + 1; j < shapes.size(); j++) {
+    CGAL::Bbox_2 bb = shapes[i]->get_bbox();
+    boxes.push_back(make_pair(bbox(bpoint(bb.xmin(), bb.ymin()), bpoint(bb.xmax(), bb.ymax())), i));
+  }
+  bgi::rtree<bvalue, bgi::quadratic<16>> tree(boxes.begin(), boxes.end());
+
+  /* the smallest larger shape that fits around it becomes the parent */
+  parent.resize(shapes.size(), -1);
+  for (i = 0; i < shapes.size(); i++) {
+    vector<bvalue> hits;
+    vector<unsigned int> candidates;
+
+    tree.query(bgi::covers(boxes[i].first), back_inserter(hits));
+    for (auto h : hits)
+      if (h.second > i)
+        candidates.push_back(h.second);
+    sort(candidates.begin(), candidates.end());
+    for (auto j : candidates) {
+      tests++;
       if (shapes[i]->fits_inside(shapes[j])) {
-//        printf("Adding shape %s (%5.2f) to %s (%5.2f) \n", shapes[i]->name, shapes[i]->area, shapes[j]->name, shapes[j]->area);
-        shapes[j]->add_child(shapes[i]);
-        shapes.erase(shapes.begin() + i);
-        i--;
+        parent[i] = j;
         break;
       }
     }
   }
-  
+
+  /* in the same order as the one by one search would, levels depend on it */
+  for (i = 0; i < shapes.size(); i++) {
+    if (parent[i] >= 0)
+      shapes[parent[i]]->add_child(shapes[i]);
+    else
+      top.push_back(shapes[i]);
+  }
+  vprintf("Nesting: %li containment tests, %i top level shapes\n", tests, (int)top.size());
+  shapes = top;
+
   flatten_nesting();
 
   for (i = 0; i < shapes.size(); i++) {
@@ -265,6 +311,12 @@ void scene::process_nesting(void)
       shapes[i]->set_level(0);
       shapes[i]->fix_orientation();
   }
+
+  /* now that it is known which rings are holes of which shape, thin them out */
+  if (simplify_tolerance > 0) {
+      simplify_shapes(shapes, cutout, simplify_tolerance);
+      print_simplify_stats(simplify_tolerance);
+  }
 }
 
 void scene::create_toolpaths(void)
@@ -350,14 +402,20 @@ void scene::create_toolpaths(void)
       
     if (mill->is_vbit() && tool == 0) {
 		double stock_to_leave = 0;
+		/* V-carving asks for the distance to the nearest edge a great many times */
+		edges.build(shapes);
 		while (currentdepth <= -z_offset) {
+			vector<struct vcarve_job> jobs;
           	for (auto i : shapes)
-            	i->create_toolpaths_vcarve(toolnr, currentdepth, stock_to_leave);
+            	i->create_toolpaths_vcarve(toolnr, currentdepth, stock_to_leave, jobs);
+			run_vcarve_jobs(jobs);
 			currentdepth += depthstep;
 			depthstep = mill->get_depth_of_cut();
 			if (want_finishing_pass())
 				stock_to_leave = 0.1;
         }
+		edges.print_stats();
+		edges.clear();
     } else {
       vprintf("Tool %i goes from %5.2f mm to %5.2f mm\n", toolnr, start, end);
 	  bool inbetween = want_inbetween_paths();
@@ -399,6 +457,8 @@ void scene::create_toolpaths(void)
     
     tool--;
   }
+  print_skeleton_stats();
+  write_skeleton_caches();
   consolidate_toolpaths();
 }
 void scene::consolidate_toolpaths(void)
@@ -448,6 +508,9 @@ scene::scene(const char *filename)
        _want_finishing_pass = false;
        _want_inbetween_paths = false;
        _want_skeleton_paths = false;
+       _want_waterline = false;
+       _want_rest_machining = false;
+       _want_optimized_cutout = false;
        shape = NULL;
        filename = strdup(filename);
        parse_svg_file(this, filename);
@@ -456,6 +519,8 @@ scene::scene(const char *filename)
 double scene::distance_from_edge(double X, double Y, bool exclude_zero)
 {
   double d = 1000000000;
+  if (edges.is_built())
+       return edges.distance_from_edge(X, Y, exclude_zero);
   for (auto i : shapes) {
        d = fmin(d, i->distance_from_edge(X, Y, exclude_zero));
   }
@@ -514,135 +579,399 @@ static double poly_length(Polygon_2 *poly)
 	return len;
 }
 
-static Polygon_2 *clone_mutate(Polygon_2 *poly, double alpha)
-{
-	unsigned int target;
-
-	Polygon_2 *clone = NULL;
-
-	clone = new(Polygon_2);
-	
-	target = rand() % poly->size();
+/*
+ * Cutout optimizer: shrink the cutout polygon around the design by moving one vertex
+ * at a time. A fixed number of annealing chains, each with its own fixed seed, run on
+ * the available cores. They run in rounds of EXCHANGE_INTERVAL tries; between rounds
+ * the chains compare notes in chain order and the ones that fell behind restart from
+ * the best polygon found so far. Together with a budget in tries instead of seconds
+ * this gives the same cutout on every machine and every run.
+ *
+ * A move only changes the two edges at the moved vertex, so that is all that gets
+ * checked: they may not touch the rest of the cutout, they may not touch a design
+ * edge, and no design vertex may end up in the area between the old and new edges.
+ */
 
-	double dX = 0;
-	double dY = 0;
+#define ITER 800
+#define ALPHA 2
+/* moves between comparing with the other chains */
+#define EXCHANGE_INTERVAL 200
+#define CUTOUT_CHAINS 8
+/* tries per chain per optimize_bb() */
+#define CUTOUT_BUDGET 40000
+/* start temperature, in mm of cutout length */
+#define ANNEAL_TEMPERATURE 0.2
+
+struct bbvertex {
+	double X, Y;
+};
+
+struct design_edge {
+	double X1, Y1, X2, Y2;
+};
+
+/* the edges of the design in buckets; cell i holds cell_edges[cell_start[i] .. cell_start[i + 1]) */
+struct design_grid {
+	vector<struct design_edge> edges;
+	vector<int> cell_start;
+	vector<int> cell_edges;
+	double X0, Y0, cell;
+	int nx, ny;
+};
+
+struct cutout_chain {
+	std::mt19937 rng;
+	vector<struct bbvertex> poly, best;
+	double len, best_length;
+	double alpha;
+	/* tries left before the chain gives up without finding anything better */
+	int stall;
+	long tries, moves;
+};
+
+struct cutout_search {
+	struct design_grid *grid;
+	bool quick;
+	long budget;
+	/* every chain runs until it has made this many tries */
+	long round_end;
+
+	struct cutout_chain chains[CUTOUT_CHAINS];
+	std::atomic<unsigned int> next_chain;
+};
+
+static void grid_range(struct design_grid *g, double minX, double minY, double maxX, double maxY, int *x1, int *y1, int *x2, int *y2)
+{
+	*x1 = std::max(0, std::min(g->nx - 1, (int)floor((minX - g->X0) / g->cell)));
+	*y1 = std::max(0, std::min(g->ny - 1, (int)floor((minY - g->Y0) / g->cell)));
+	*x2 = std::max(0, std::min(g->nx - 1, (int)floor((maxX - g->X0) / g->cell)));
+	*y2 = std::max(0, std::min(g->ny - 1, (int)floor((maxY - g->Y0) / g->cell)));
+}
 
-	int element = rand() % 8;
-	switch (element) {
-		case 0:
-			dX = alpha;
-			break;
-		case 1:
-			dX = -alpha;
-			break;
-		case 2:
-			dY = alpha;
-			break;
-		case 3:
-			dY = -alpha;
-			break;
+static void build_design_grid(class scene *scene, struct design_grid *g)
+{
+	double minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30;
+	vector<int> count;
+	int x, y, x1, y1, x2, y2;
+
+	for (auto s : scene->shapes) {
+		for (unsigned int i = 0; i < s->poly.size(); i++) {
+			unsigned int next = (i + 1) % s->poly.size();
+			struct design_edge e;
+
+			e.X1 = CGAL::to_double(s->poly[i].x());
+			e.Y1 = CGAL::to_double(s->poly[i].y());
+			e.X2 = CGAL::to_double(s->poly[next].x());
+			e.Y2 = CGAL::to_double(s->poly[next].y());
+			g->edges.push_back(e);
+			minX = fmin(minX, e.X1);
+			minY = fmin(minY, e.Y1);
+			maxX = fmax(maxX, e.X1);
+			maxY = fmax(maxY, e.Y1);
+		}
+	}
+	if (g->edges.size() == 0) {
+		minX = minY = maxX = maxY = 0;
+	}
 
-		case 4:
-			dX = alpha/1.4;
-			dY = alpha/1.4;
-			break;
-		case 5:
-			dX = -alpha/1.4;
-			dY = -alpha/1.4;
-			break;
-		case 6:
-			dX = -alpha/1.4;
-			dY = alpha/1.4;
-			break;
-		case 7:
-			dX = alpha/1.4;
-			dY = -alpha/1.4;
-			break;
+	g->X0 = minX;
+	g->Y0 = minY;
+	g->cell = sqrt(fmax((maxX - minX) * (maxY - minY), 1e-6) * 2 / fmax(g->edges.size(), 1));
+	g->cell = fmax(g->cell, fmax(maxX - minX, maxY - minY) / 1000);
+	g->cell = fmax(g->cell, 0.001);
+	g->nx = (int)floor((maxX - minX) / g->cell) + 1;
+	g->ny = (int)floor((maxY - minY) / g->cell) + 1;
+
+	count.resize(g->nx * g->ny, 0);
+	for (auto &e : g->edges) {
+		grid_range(g, fmin(e.X1, e.X2), fmin(e.Y1, e.Y2), fmax(e.X1, e.X2), fmax(e.Y1, e.Y2), &x1, &y1, &x2, &y2);
+		for (y = y1; y <= y2; y++)
+			for (x = x1; x <= x2; x++)
+				count[y * g->nx + x]++;
 	}
+	g->cell_start.resize(g->nx * g->ny + 1, 0);
+	for (x = 0; x < g->nx * g->ny; x++)
+		g->cell_start[x + 1] = g->cell_start[x] + count[x];
+	g->cell_edges.resize(g->cell_start[g->nx * g->ny]);
+	for (auto &e : g->edges) {
+		grid_range(g, fmin(e.X1, e.X2), fmin(e.Y1, e.Y2), fmax(e.X1, e.X2), fmax(e.Y1, e.Y2), &x1, &y1, &x2, &y2);
+		for (y = y1; y <= y2; y++)
+			for (x = x1; x <= x2; x++)
+				g->cell_edges[g->cell_start[y * g->nx + x + 1] - count[y * g->nx + x]--] = &e - &g->edges[0];
+	}
+}
 
+static double cross(double aX, double aY, double bX, double bY, double cX, double cY)
+{
+	return (bX - aX) * (cY - aY) - (bY - aY) * (cX - aX);
+}
 
-	for (unsigned int i = 0; i < poly->size(); i++) {
-		double X1, Y1;
+/* errs on the side of "touching", which only costs a rejected move */
+static bool segments_touch(double aX, double aY, double bX, double bY, double cX, double cY, double dX, double dY)
+{
+	const double eps = 1e-9;
+	double d1, d2, d3, d4;
 
-		X1 = CGAL::to_double((*poly)[i].x());
-		Y1 = CGAL::to_double((*poly)[i].y());
+	if (fmax(aX, bX) < fmin(cX, dX) - eps || fmax(cX, dX) < fmin(aX, bX) - eps ||
+	    fmax(aY, bY) < fmin(cY, dY) - eps || fmax(cY, dY) < fmin(aY, bY) - eps)
+		return false;
 
-		if (i == target) {
-			X1 += dX;
-			Y1 += dY;
-		}
+	d1 = cross(cX, cY, dX, dY, aX, aY);
+	d2 = cross(cX, cY, dX, dY, bX, bY);
+	if ((d1 > eps && d2 > eps) || (d1 < -eps && d2 < -eps))
+		return false;
+	d3 = cross(aX, aY, bX, bY, cX, cY);
+	d4 = cross(aX, aY, bX, bY, dX, dY);
+	if ((d3 > eps && d4 > eps) || (d3 < -eps && d4 < -eps))
+		return false;
+	return true;
+}
 
-		clone->push_back(Point(X1, Y1));
+/*
+ * Swapping the edges p-o-n for p-m-n flips the inside/outside state of exactly the
+ * points inside the loop p, m, n, o (even-odd rule).
+ */
+static bool inside_loop(const struct bbvertex *loop, double X, double Y)
+{
+	bool inside = false;
+	int i, j;
+
+	for (i = 0, j = 3; i < 4; j = i++) {
+		if ((loop[i].Y > Y) != (loop[j].Y > Y) &&
+		    X < (loop[j].X - loop[i].X) * (Y - loop[i].Y) / (loop[j].Y - loop[i].Y) + loop[i].X)
+			inside = !inside;
 	}
-	return clone;
+	return inside;
 }
 
-static bool poly_valid(Polygon_2 *poly, class scene *scene)
+static bool move_is_valid(vector<struct bbvertex> &poly, unsigned int target, struct bbvertex m, struct design_grid *g)
 {
-	if (!poly->is_simple())
+	unsigned int n = poly.size();
+	struct bbvertex p = poly[(target + n - 1) % n];
+	struct bbvertex o = poly[target];
+	struct bbvertex q = poly[(target + 1) % n];
+	struct bbvertex pp = poly[(target + n - 2) % n];
+	struct bbvertex qq = poly[(target + 2) % n];
+	struct bbvertex loop[4] = { p, m, q, o };
+	int x, y, x1, y1, x2, y2;
+	unsigned int i;
+
+	/* the two new edges may not fold back onto each other */
+	if (fabs(cross(p.X, p.Y, m.X, m.Y, q.X, q.Y)) < 1e-9 &&
+	    (p.X - m.X) * (q.X - m.X) + (p.Y - m.Y) * (q.Y - m.Y) >= 0)
 		return false;
-	return scene->fits_inside(poly);
-}
 
+	/* nor onto the edges before and after them */
+	if (fabs(cross(pp.X, pp.Y, p.X, p.Y, m.X, m.Y)) < 1e-9 &&
+	    (pp.X - p.X) * (m.X - p.X) + (pp.Y - p.Y) * (m.Y - p.Y) >= 0)
+		return false;
+	if (fabs(cross(m.X, m.Y, q.X, q.Y, qq.X, qq.Y)) < 1e-9 &&
+	    (m.X - q.X) * (qq.X - q.X) + (m.Y - q.Y) * (qq.Y - q.Y) >= 0)
+		return false;
 
-#define ITER 800
-#define ALPHA 2
-static Polygon_2 * optimize_bb(class scene *scene, Polygon_2 *boundingbox, bool quick, double best_bb_length) 
+	/* cutout stays simple: the new edges against all edges not sharing a vertex with them */
+	for (i = 0; i < n; i++) {
+		unsigned int next = (i + 1) % n;
+
+		if (i == target || next == target)
+			continue;
+		if (next != (target + n - 1) % n && i != (target + n - 1) % n &&
+		    segments_touch(p.X, p.Y, m.X, m.Y, poly[i].X, poly[i].Y, poly[next].X, poly[next].Y))
+			return false;
+		if (i != (target + 1) % n && next != (target + 1) % n &&
+		    segments_touch(m.X, m.Y, q.X, q.Y, poly[i].X, poly[i].Y, poly[next].X, poly[next].Y))
+			return false;
+	}
+
+	/* and the design stays inside */
+	grid_range(g, fmin(fmin(p.X, q.X), fmin(o.X, m.X)), fmin(fmin(p.Y, q.Y), fmin(o.Y, m.Y)),
+		   fmax(fmax(p.X, q.X), fmax(o.X, m.X)), fmax(fmax(p.Y, q.Y), fmax(o.Y, m.Y)), &x1, &y1, &x2, &y2);
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++)
+			for (i = g->cell_start[y * g->nx + x]; i < (unsigned int)g->cell_start[y * g->nx + x + 1]; i++) {
+				struct design_edge *e = &g->edges[g->cell_edges[i]];
+
+				if (segments_touch(p.X, p.Y, m.X, m.Y, e->X1, e->Y1, e->X2, e->Y2) ||
+				    segments_touch(m.X, m.Y, q.X, q.Y, e->X1, e->Y1, e->X2, e->Y2))
+					return false;
+				if (inside_loop(loop, e->X1, e->Y1))
+					return false;
+			}
+	return true;
+}
+
+static double bb_length(vector<struct bbvertex> &poly)
 {
-	int maxiter = ITER;
-	int i = ITER;
-	double alpha;
-	time_t target;
+	double len = 0.0;
 
-	alpha = ALPHA;
+	for (unsigned int i = 0; i < poly.size(); i++) {
+		unsigned int next = (i + 1) % poly.size();
+		len += dist(poly[i].X, poly[i].Y, poly[next].X, poly[next].Y);
+	}
+	return len;
+}
 
-	target = time(NULL) + 5;
+static void run_chain(struct cutout_search *search, struct cutout_chain *chain)
+{
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	vector<struct bbvertex> &poly = chain->poly;
+	int maxiter = search->quick ? ITER * 2 : ITER;
+
+	while (chain->tries < search->round_end && chain->stall > 0 && poly.size() >= 3) {
+		unsigned int n = poly.size(), target;
+		struct bbvertex m, p, o, q;
+		double dX = 0, dY = 0, newlen, temperature;
+		double alpha = chain->alpha;
+
+		chain->stall--;
+		chain->tries++;
+
+		target = chain->rng() % n;
+		switch (chain->rng() % 8) {
+			case 0: dX = alpha; break;
+			case 1: dX = -alpha; break;
+			case 2: dY = alpha; break;
+			case 3: dY = -alpha; break;
+			case 4: dX = alpha/1.4; dY = alpha/1.4; break;
+			case 5: dX = -alpha/1.4; dY = -alpha/1.4; break;
+			case 6: dX = -alpha/1.4; dY = alpha/1.4; break;
+			case 7: dX = alpha/1.4; dY = -alpha/1.4; break;
+		}
+		chain->alpha = alpha * 0.99;
+
+		p = poly[(target + n - 1) % n];
+		o = poly[target];
+		q = poly[(target + 1) % n];
+		m.X = o.X + dX;
+		m.Y = o.Y + dY;
+		newlen = chain->len - dist(p.X, p.Y, o.X, o.Y) - dist(o.X, o.Y, q.X, q.Y) + dist(p.X, p.Y, m.X, m.Y) + dist(m.X, m.Y, q.X, q.Y);
+
+		/* downhill always, uphill now and then while the chain is still hot */
+		temperature = ANNEAL_TEMPERATURE * (1.0 - (double)chain->tries / search->budget);
+		if (newlen >= chain->len && (temperature <= 0 || uniform(chain->rng) >= exp(-(newlen - chain->len) / temperature)))
+			continue;
+		if (!move_is_valid(poly, target, m, search->grid))
+			continue;
 
-	if (quick) {
-		maxiter = ITER * 2;
-		i = maxiter;
-		target = time(NULL) + 2;
-		alpha = 1;
+		poly[target] = m;
+		chain->moves++;
+		if (newlen < chain->best_length - 0.0001 || (chain->rng() % 400) == 21) {
+			chain->alpha *= 2;
+			if (chain->alpha < 0.1)
+				chain->alpha = 0.1;
+			if (chain->alpha > 8 && !search->quick)
+				chain->alpha = 8;
+			if (chain->alpha > 16 && search->quick)
+				chain->alpha = 16;
+			if (!search->quick)
+				chain->stall = maxiter;
+		}
+		chain->len = newlen;
+		if (chain->len < chain->best_length) {
+			chain->best = poly;
+			chain->best_length = chain->len;
+		}
 	}
+}
 
+static void *cutout_chain_thread(void *data)
+{
+	struct cutout_search *search = (struct cutout_search *)data;
+	unsigned int i;
 
-	while (i > 0) {
-		Polygon_2 *next;
-		double len;
-		i--;
+	while ((i = search->next_chain++) < CUTOUT_CHAINS)
+		run_chain(search, &search->chains[i]);
+	return NULL;
+}
 
-		if (time(NULL) > target)
-			break;
+static Polygon_2 * optimize_bb(struct design_grid *grid, Polygon_2 *boundingbox, bool quick, double best_bb_length) 
+{
+	struct cutout_search search;
+	vector<struct bbvertex> start, best;
+	vector<pthread_t> threads;
+	double best_length = best_bb_length;
+	long tries = 0, moves = 0;
+	int nthreads = 1;
+	int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (nthreads > CUTOUT_CHAINS)
+		nthreads = CUTOUT_CHAINS;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	for (unsigned int v = 0; v < boundingbox->size(); v++)
+		start.push_back({ CGAL::to_double((*boundingbox)[v].x()), CGAL::to_double((*boundingbox)[v].y()) });
+	best = start;
+
+	search.grid = grid;
+	search.quick = quick;
+	search.budget = quick ? CUTOUT_BUDGET * 2 : CUTOUT_BUDGET;
+	search.round_end = 0;
+	for (i = 0; i < CUTOUT_CHAINS; i++) {
+		struct cutout_chain *chain = &search.chains[i];
+
+		chain->rng.seed(1 + i);
+		chain->poly = start;
+		chain->best = start;
+		chain->len = bb_length(start);
+		chain->best_length = chain->len;
+		chain->alpha = quick ? 1 : ALPHA;
+		chain->stall = quick ? ITER * 2 : ITER;
+		chain->tries = 0;
+		chain->moves = 0;
+	}
 
-		next = clone_mutate(boundingbox, alpha);
-		alpha = alpha * 0.99;
-		len = poly_length(next);
+	threads.resize(nthreads);
+	while (search.round_end < search.budget) {
+		bool running = false;
 
-		if (best_bb_length <= len) {
-			delete next;
-			continue;
-		}
-		if (!poly_valid(next, scene)) {
-			delete next;
-			continue;
+		for (i = 0; i < CUTOUT_CHAINS; i++)
+			if (search.chains[i].stall > 0)
+				running = true;
+		if (!running)
+			break;
+
+		search.round_end = std::min(search.round_end + EXCHANGE_INTERVAL, search.budget);
+		search.next_chain = 0;
+		for (i = 1; i < nthreads; i++)
+			pthread_create(&threads[i], NULL, cutout_chain_thread, &search);
+		cutout_chain_thread(&search);
+		for (i = 1; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+
+		/* in chain order, so which chain wins a tie does not depend on the threads */
+		for (i = 0; i < CUTOUT_CHAINS; i++) {
+			if (search.chains[i].best_length < best_length) {
+				best = search.chains[i].best;
+				best_length = search.chains[i].best_length;
+			}
 		}
-		delete boundingbox;
-		boundingbox = next;
-		if (len <= best_bb_length || (rand() % 400) == 21) {
-			alpha *= 2;
-			if (alpha < 0.1)
-				alpha = 0.1;
-			if (alpha > 8 && quick == 0)
-				alpha = 8;
-			if (alpha > 16 && quick == 1)
-				alpha = 16;
-			if (!quick)
-				i = maxiter;
+		for (i = 0; i < CUTOUT_CHAINS; i++) {
+			struct cutout_chain *chain = &search.chains[i];
+
+			if (best_length < chain->len && chain->stall > 0) {
+				chain->poly = best;
+				chain->len = best_length;
+				chain->best = best;
+				chain->best_length = best_length;
+			}
 		}
-		best_bb_length = len;
 	}
-	vprintf("Winner with %5.2f  q %i\n", best_bb_length, quick);
 
+	for (i = 0; i < CUTOUT_CHAINS; i++) {
+		tries += search.chains[i].tries;
+		moves += search.chains[i].moves;
+	}
+	vprintf("Winner with %5.2f  q %i  (%i chains on %i threads, %li tries, %li moves)\n", best_length, quick,
+		CUTOUT_CHAINS, nthreads, tries, moves);
+
+	delete boundingbox;
+	boundingbox = new(Polygon_2);
+	for (auto v : best)
+		boundingbox->push_back(Point(v.X, v.Y));
 	return boundingbox;
 }
 
@@ -650,9 +979,9 @@ static Polygon_2 * optimize_bb(class scene *scene, Polygon_2 *boundingbox, bool
 void scene::optimize_cutout(void) 
 {
 	Polygon_2 *boundingbox;
+	struct design_grid grid;
 
-	return;
-
+	build_design_grid(this, &grid);
 	boundingbox = cutout_clone_split(&cutout->poly, 1000);
 	unsigned int iter = 0;
 	double best_bb_length;
@@ -663,10 +992,10 @@ void scene::optimize_cutout(void)
 		prev = best_bb_length;
 		boundingbox = cutout_clone_split(boundingbox, 4);
 
-		boundingbox = optimize_bb(this, boundingbox, false, best_bb_length);
+		boundingbox = optimize_bb(&grid, boundingbox, false, best_bb_length);
 
 //		if (iter % 2 == 1 )
-//			boundingbox = optimize_bb(this, boundingbox, false, best_bb_length);
+//			boundingbox = optimize_bb(&grid, boundingbox, false, best_bb_length);
 
 		best_bb_length = poly_length(boundingbox);
 
@@ -681,7 +1010,7 @@ void scene::optimize_cutout(void)
 		iter++;
 	} while (1);
 
-	boundingbox = optimize_bb(this, boundingbox, false, best_bb_length);
+	boundingbox = optimize_bb(&grid, boundingbox, false, best_bb_length);
 
 	best_bb_length = poly_length(boundingbox);
 
@@ -731,7 +1060,8 @@ class scene * scene::clone_scene(class scene *input, int mirror, double Xadd)
 	  scene->cutout->is_cutout = true;
 	  scene->cutout->set_cutout_offset(5);
 
-	  scene->optimize_cutout();
+	  if (want_optimized_cutout())
+		  scene->optimize_cutout();
   }
 
   /* box for area clearance */
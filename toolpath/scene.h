@@ -12,12 +12,43 @@
 using namespace std;
 
 #include <vector>
+#include <atomic>
 
 
 #include "tool.h"
 
 class input_shape;
 
+/* nearest edge lookups over all shapes of a scene, see edgeindex.cpp */
+class edge_index {
+public:
+        void build(vector<class inputshape *> &shapes);
+        void clear(void);
+        bool is_built(void) { return built; };
+        double distance_from_edge(double X, double Y, bool exclude_zero);
+        void print_stats(void);
+
+private:
+        struct edge {
+            double X1, Y1, X2, Y2;
+        };
+        vector<struct edge> edges;
+        /* the edges of cell i are cell_edges[cell_start[i] .. cell_start[i + 1]) */
+        vector<int> cell_start;
+        vector<int> cell_edges;
+        double X0 = 0, Y0 = 0, cell = 1;
+        int nx = 0, ny = 0;
+        bool built = false;
+
+        /* queries come in from several threads at once */
+        std::atomic<long> queries{0};
+        std::atomic<long> tests{0};
+        std::atomic<long> nanoseconds{0};
+
+        void add_shape(class inputshape *shape);
+        void cell_range(double minX, double minY, double maxX, double maxY, int *x1, int *y1, int *x2, int *y2);
+};
+
 class scene {
 public:
         scene() {
@@ -29,6 +60,9 @@ public:
             _want_inbetween_paths = true;
             _want_skeleton_paths = false;
 			_want_inlay = false;
+			_want_waterline = false;
+			_want_rest_machining = false;
+			_want_optimized_cutout = false;
             shape = NULL;
 			cutout = NULL;
 			inlay_plug = NULL;
@@ -37,6 +71,7 @@ public:
 			depth = 0;	
 			stock_to_leave = 0.1;
 			finishing_pass_stepover = -1;
+			simplify_tolerance = 0;
 	    z_offset = 0;
         }
         
@@ -79,6 +114,15 @@ public:
         void enable_inlay(void) { _want_inlay = true; };
         bool want_inlay(void) { return _want_inlay; };
 
+        void enable_waterline(void) { _want_waterline = true; };
+        bool want_waterline(void) { return _want_waterline; };
+
+        void enable_rest_machining(void) { _want_rest_machining = true; };
+        bool want_rest_machining(void) { return _want_rest_machining; };
+
+        void enable_optimized_cutout(void) { _want_optimized_cutout = true; };
+        bool want_optimized_cutout(void) { return _want_optimized_cutout; };
+
 		void set_z_offset(double d) { z_offset = d; };
 		double get_z_offset(void) { return z_offset; };
 
@@ -94,6 +138,9 @@ public:
 		void set_depth(double d) { depth = d; };
 		double get_depth(void) { return depth; };
 
+		void set_simplify_tolerance(double d) { simplify_tolerance = d; };
+		double get_simplify_tolerance(void) { return simplify_tolerance; };
+
         void enable_skeleton_paths(void);
         bool want_skeleton_paths(void);
         void set_filename(const char *f) { filename = strdup(f);};
@@ -116,6 +163,7 @@ public:
 private:
         vector<int> toollist;
 		class inputshape * cutout;
+		class edge_index edges;
 
         class inputshape *shape;
 
@@ -124,10 +172,14 @@ private:
 		double z_offset;
 		double stock_to_leave;
 		double finishing_pass_stepover;
+		double simplify_tolerance;
         bool _want_finishing_pass;
         bool _want_inbetween_paths;
         bool _want_skeleton_paths;
 		bool _want_inlay;
+		bool _want_waterline;
+		bool _want_rest_machining;
+		bool _want_optimized_cutout;
         const char *filename;
 		double cutout_depth;
 		double depth;
@@ -140,6 +192,7 @@ private:
 
 
 extern void parse_svg_file(class scene * scene, const char *filename);
+extern double curve_tolerance;
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include "tool.h"
+
+#include "scene.h"
+
+extern "C" {
+  #include "toolpath.h"
+}
+
+#include <algorithm>
+
+/*
+ * Optional clean up of the input polygons before any straight skeleton gets built.
+ *
+ * Traced bitmaps come with lots of (near) collinear and duplicate vertices, and the
+ * skeleton cost grows faster than the vertex count. Every ring of a shape (the outline
+ * and its holes) first loses its duplicate and exactly collinear vertices, then goes
+ * through Douglas-Peucker with the user tolerance. Only existing vertices are kept, no
+ * new points are made.
+ *
+ * The result has to be a valid polygon with holes again: every ring simple and with
+ * the same orientation, no two rings crossing or touching, and the holes still inside
+ * the outline. If any of that fails, the whole shape keeps its original rings.
+ *
+ * After flatten_nesting() an island inside a hole is a shape of its own, so a simplified
+ * hole can also run into an island or a neighbouring shape. simplify_shapes() checks all
+ * rings of all shapes against each other once every shape is done, and puts both shapes
+ * of every crossing back to their original rings until nothing crosses anymore.
+ */
+
+static long simplify_before, simplify_after;
+static int simplify_rejected;
+
+static double point_distance_from_chord(const Point &p, const Point &a, const Point &b)
+{
+	return distance_point_from_vector(CGAL::to_double(a.x()), CGAL::to_double(a.y()),
+					  CGAL::to_double(b.x()), CGAL::to_double(b.y()),
+					  CGAL::to_double(p.x()), CGAL::to_double(p.y()));
+}
+
+static void remove_redundant_vertices(vector<Point> &ring)
+{
+	vector<Point> out;
+	unsigned int i;
+	bool changed = true;
+
+	/* collinear runs can wrap around the start, so go until nothing changes */
+	while (changed && ring.size() >= 3) {
+		changed = false;
+		out.clear();
+		for (i = 0; i < ring.size(); i++) {
+			const Point &prev = out.size() > 0 ? out.back() : ring[ring.size() - 1];
+			const Point &next = ring[(i + 1) % ring.size()];
+
+			if (ring[i] == prev || CGAL::collinear(prev, ring[i], next)) {
+				changed = true;
+				continue;
+			}
+			out.push_back(ring[i]);
+		}
+		ring.swap(out);
+	}
+}
+
+/* Douglas-Peucker on ring[first .. last] (indices modulo the ring size), marks what to keep */
+static void douglas_peucker(const vector<Point> &ring, unsigned int first, unsigned int last, double tolerance, vector<bool> &keep)
+{
+	vector<pair<unsigned int, unsigned int>> todo;
+	unsigned int n = ring.size();
+
+	todo.push_back(make_pair(first, last));
+	while (todo.size() > 0) {
+		unsigned int a = todo.back().first, b = todo.back().second, i, best = a;
+		double bestdist = -1;
+
+		todo.pop_back();
+		for (i = a + 1; i < b; i++) {
+			double d = point_distance_from_chord(ring[i % n], ring[a % n], ring[b % n]);
+			if (d > bestdist) {
+				bestdist = d;
+				best = i;
+			}
+		}
+		if (bestdist > tolerance) {
+			keep[best % n] = true;
+			todo.push_back(make_pair(a, best));
+			todo.push_back(make_pair(best, b));
+		}
+	}
+}
+
+static void simplify_ring(vector<Point> &ring, double tolerance)
+{
+	vector<bool> keep;
+	vector<Point> out;
+	unsigned int i, far = 0, n;
+	double fardist = -1;
+
+	remove_redundant_vertices(ring);
+	n = ring.size();
+	if (n <= 4)
+		return;
+
+	/* a closed ring needs two anchors: vertex 0 and the vertex furthest away from it */
+	for (i = 1; i < n; i++) {
+		double d = CGAL::to_double(CGAL::squared_distance(ring[0], ring[i]));
+		if (d > fardist) {
+			fardist = d;
+			far = i;
+		}
+	}
+
+	keep.resize(n, false);
+	keep[0] = true;
+	keep[far] = true;
+	douglas_peucker(ring, 0, far, tolerance, keep);
+	douglas_peucker(ring, far, n, tolerance, keep);
+
+	for (i = 0; i < n; i++)
+		if (keep[i])
+			out.push_back(ring[i]);
+	if (out.size() >= 3)
+		ring.swap(out);
+}
+
+static bool segments_intersect(const Point &p1, const Point &p2, const Point &q1, const Point &q2)
+{
+	CGAL::Orientation o1 = CGAL::orientation(p1, p2, q1);
+	CGAL::Orientation o2 = CGAL::orientation(p1, p2, q2);
+	CGAL::Orientation o3 = CGAL::orientation(q1, q2, p1);
+	CGAL::Orientation o4 = CGAL::orientation(q1, q2, p2);
+
+	if (o1 != o2 && o3 != o4)
+		return true;
+	/* collinear: only overlapping if the projections do */
+	if (o1 == CGAL::COLLINEAR && o2 == CGAL::COLLINEAR)
+		return !(CGAL::compare_xy(max(p1, p2), min(q1, q2)) == CGAL::SMALLER ||
+			 CGAL::compare_xy(max(q1, q2), min(p1, p2)) == CGAL::SMALLER);
+	return false;
+}
+
+/*
+ * do any two edges of rings in different groups meet; a grid keeps this about linear.
+ * With crossing set, every ring that meets another one gets marked instead of stopping
+ * at the first.
+ */
+bool rings_cross(vector<Polygon_2 *> &rings, vector<unsigned int> &group, vector<bool> *crossing)
+{
+	struct gridedge {
+		Point a, b;
+		unsigned int ring;
+	};
+	vector<struct gridedge> edges;
+	vector<vector<unsigned int>> cells;
+	double minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30, cell;
+	int nx, ny;
+	bool found = false;
+
+	for (unsigned int r = 0; r < rings.size(); r++) {
+		Polygon_2 *p = rings[r];
+		for (auto e = p->edges_begin(); e != p->edges_end(); ++e) {
+			struct gridedge g = { e->source(), e->target(), r };
+			edges.push_back(g);
+		}
+		CGAL::Bbox_2 bb = p->bbox();
+		minX = fmin(minX, bb.xmin());
+		minY = fmin(minY, bb.ymin());
+		maxX = fmax(maxX, bb.xmax());
+		maxY = fmax(maxY, bb.ymax());
+	}
+
+	cell = sqrt(fmax((maxX - minX) * (maxY - minY), 1e-6) * 2 / edges.size());
+	cell = fmax(cell, fmax(maxX - minX, maxY - minY) / 1000);
+	cell = fmax(cell, 0.001);
+	nx = (int)((maxX - minX) / cell) + 1;
+	ny = (int)((maxY - minY) / cell) + 1;
+	cells.resize(nx * ny);
+
+	for (unsigned int i = 0; i < edges.size(); i++) {
+		CGAL::Bbox_2 bb = edges[i].a.bbox() + edges[i].b.bbox();
+		int x1 = (int)((bb.xmin() - minX) / cell), x2 = (int)((bb.xmax() - minX) / cell);
+		int y1 = (int)((bb.ymin() - minY) / cell), y2 = (int)((bb.ymax() - minY) / cell);
+
+		for (int y = max(y1, 0); y <= min(y2, ny - 1); y++)
+			for (int x = max(x1, 0); x <= min(x2, nx - 1); x++) {
+				for (auto j : cells[y * nx + x]) {
+					if (group[edges[j].ring] == group[edges[i].ring])
+						continue;
+					if (!segments_intersect(edges[i].a, edges[i].b, edges[j].a, edges[j].b))
+						continue;
+					if (!crossing)
+						return true;
+					found = true;
+					(*crossing)[edges[i].ring] = true;
+					(*crossing)[edges[j].ring] = true;
+				}
+				cells[y * nx + x].push_back(i);
+			}
+	}
+	return found;
+}
+
+static bool ring_is_valid(Polygon_2 *p, CGAL::Orientation orientation)
+{
+	if (p->size() < 3)
+		return false;
+	if (!p->is_simple())
+		return false;
+	return p->orientation() == orientation;
+}
+
+void inputshape::simplify(double tolerance)
+{
+	vector<Polygon_2> original;
+	vector<Polygon_2 *> rings;
+	vector<unsigned int> group;
+	long before = 0, after = 0;
+	bool valid = true;
+
+	rings.push_back(&poly);
+	for (auto c : children)
+		rings.push_back(&c->poly);
+	for (unsigned int i = 0; i < rings.size(); i++)
+		group.push_back(i);
+
+	for (auto r : rings) {
+		vector<Point> points(r->vertices_begin(), r->vertices_end());
+		CGAL::Orientation orientation = r->orientation();
+
+		original.push_back(*r);
+		before += r->size();
+		simplify_ring(points, tolerance);
+		*r = Polygon_2(points.begin(), points.end());
+		after += r->size();
+		if (!ring_is_valid(r, orientation))
+			valid = false;
+	}
+
+	for (unsigned int i = 1; valid && i < rings.size(); i++)
+		if (poly.bounded_side(*rings[i]->vertices_begin()) != CGAL::ON_BOUNDED_SIDE)
+			valid = false;
+
+	if (valid && rings.size() > 1 && rings_cross(rings, group))
+		valid = false;
+
+	if (!valid) {
+		for (unsigned int i = 0; i < rings.size(); i++)
+			*rings[i] = original[i];
+		after = before;
+		simplify_rejected++;
+	}
+
+	simplify_before += before;
+	simplify_after += after;
+
+	update_stats();
+	for (auto c : children)
+		c->update_stats();
+}
+
+static void shape_rings(class inputshape *shape, vector<Polygon_2 *> &rings)
+{
+	rings.push_back(&shape->poly);
+	for (auto c : shape->children)
+		rings.push_back(&c->poly);
+}
+
+void simplify_shapes(vector<class inputshape *> &shapes, class inputshape *cutout, double tolerance)
+{
+	vector<vector<Polygon_2>> original;
+	vector<bool> restored;
+	unsigned int i;
+
+	for (auto s : shapes) {
+		vector<Polygon_2 *> rings;
+
+		shape_rings(s, rings);
+		original.push_back(vector<Polygon_2>());
+		for (auto r : rings)
+			original.back().push_back(*r);
+		s->simplify(tolerance);
+	}
+
+	if (shapes.size() < 2 && !cutout)
+		return;
+
+	/* originals do not cross, so every round restores at least one shape or ends */
+	restored.resize(shapes.size(), false);
+	while (true) {
+		vector<Polygon_2 *> rings;
+		vector<unsigned int> group;
+		vector<bool> crossing;
+		bool again = false;
+
+		for (i = 0; i < shapes.size(); i++) {
+			shape_rings(shapes[i], rings);
+			group.resize(rings.size(), i);
+		}
+		/* the cutout is not simplified but the shapes must not run into it either */
+		if (cutout) {
+			rings.push_back(&cutout->poly);
+			group.resize(rings.size(), shapes.size());
+		}
+		crossing.resize(rings.size(), false);
+		if (!rings_cross(rings, group, &crossing))
+			break;
+
+		for (unsigned int r = 0; r < rings.size(); r++) {
+			unsigned int g = group[r];
+			vector<Polygon_2 *> own;
+			bool changed = false;
+
+			if (!crossing[r] || g >= shapes.size() || restored[g])
+				continue;
+			restored[g] = true;
+
+			shape_rings(shapes[g], own);
+			for (unsigned int j = 0; j < own.size(); j++) {
+				if (own[j]->size() == original[g][j].size())
+					continue;
+				simplify_after += (long)original[g][j].size() - (long)own[j]->size();
+				*own[j] = original[g][j];
+				changed = true;
+			}
+			if (!changed)
+				continue;
+			again = true;
+			shapes[g]->update_stats();
+			for (auto c : shapes[g]->children)
+				c->update_stats();
+			simplify_rejected++;
+		}
+		if (!again)
+			break;
+	}
+}
+
+void print_simplify_stats(double tolerance)
+{
+	qprintf("Simplified                    : %li vertices down to %li (%5.3fmm tolerance)\n",
+		simplify_before, simplify_after, tolerance);
+	if (simplify_rejected)
+		vprintf("%i shapes kept their original outline to stay valid\n", simplify_rejected);
+}
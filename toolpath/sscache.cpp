@@ -0,0 +1,456 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <CGAL/version.h>
+
+#include "tool.h"
+
+extern "C" {
+  #include "toolpath.h"
+}
+
+/*
+ * The same design gets run through here over and over while tuning depth, tools and
+ * stepover, and every run builds the same straight skeletons again.
+ *
+ * A CGAL straight skeleton has no file format, so what gets stored is what the
+ * skeleton is used for: the halfedges the V-carving walks and the offset polygons per
+ * inset. One file per shape, <cache dir>/<hash>.ss, where the hash covers every vertex
+ * of the polygon with holes, the kernel and the CGAL version. The skeleton itself only
+ * gets built when something is asked for that is not in the file yet; whatever got
+ * added is written back at the end of create_toolpaths(), after which the entry is
+ * dropped from memory until it is asked for again.
+ *
+ * A file keeps at most CACHE_MAX_OFFSETS insets. When there are more, the ones this run
+ * used are kept first and the rest are dropped, smallest offsets first in both groups.
+ *
+ * The file is plain host endian binary:
+ *	"FSSC", version, hash
+ *	have_edges, edge count, { X1 Y1 X2 Y2 inner bisector } ...
+ *	offset count, { offset, polygon count, { ring count, { point count, { X Y } ... } ... } ... } ...
+ * Anything that does not parse is a miss, never an error.
+ */
+
+#define CACHE_MAGIC "FSSC"
+#define CACHE_VERSION 1
+#define CACHE_MAX_OFFSETS 256
+
+static char *cache_dir;
+static map<uint64_t, struct skeleton_cache *> caches;
+
+static long cache_offset_hits, cache_offset_misses;
+static long cache_edge_hits, cache_edge_misses;
+static int cache_loaded, cache_written, cache_write_failures;
+
+void set_skeleton_cache_dir(const char *dir)
+{
+	free(cache_dir);
+	cache_dir = strdup(dir);
+#ifdef _WIN32
+	mkdir(cache_dir);
+#else
+	mkdir(cache_dir, 0755);
+#endif
+}
+
+/* FNV-1a, 64 bit */
+static void hash_bytes(uint64_t *hash, const void *data, size_t length)
+{
+	const unsigned char *c = (const unsigned char *)data;
+
+	while (length--) {
+		*hash ^= *c++;
+		*hash *= 1099511628211ULL;
+	}
+}
+
+static void hash_ring(uint64_t *hash, const Polygon_2 &poly)
+{
+	uint32_t size = poly.size();
+
+	hash_bytes(hash, &size, sizeof(size));
+	for (auto v = poly.vertices_begin(); v != poly.vertices_end(); ++v) {
+		double X = CGAL::to_double(v->x()), Y = CGAL::to_double(v->y());
+
+		hash_bytes(hash, &X, sizeof(X));
+		hash_bytes(hash, &Y, sizeof(Y));
+	}
+}
+
+static uint64_t hash_shape(const PolygonWithHoles &ph)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const char *kernel = "epick";
+	long version = CGAL_VERSION_NR;
+	uint32_t cache_version = CACHE_VERSION;
+
+	hash_bytes(&hash, kernel, strlen(kernel));
+	hash_bytes(&hash, &version, sizeof(version));
+	hash_bytes(&hash, &cache_version, sizeof(cache_version));
+	hash_ring(&hash, ph.outer_boundary());
+	for (auto h = ph.holes_begin(); h != ph.holes_end(); ++h)
+		hash_ring(&hash, *h);
+	return hash;
+}
+
+static void cache_filename(char *filename, size_t size, uint64_t hash)
+{
+	snprintf(filename, size, "%s/%016llx.ss", cache_dir, (unsigned long long)hash);
+}
+
+struct cache_reader {
+	const unsigned char *cursor, *end;
+	bool ok;
+};
+
+static void get_bytes(struct cache_reader *reader, void *data, size_t length)
+{
+	if (!reader->ok || (size_t)(reader->end - reader->cursor) < length) {
+		reader->ok = false;
+		memset(data, 0, length);
+		return;
+	}
+	memcpy(data, reader->cursor, length);
+	reader->cursor += length;
+}
+
+static uint32_t get_u32(struct cache_reader *reader)
+{
+	uint32_t value;
+
+	get_bytes(reader, &value, sizeof(value));
+	return value;
+}
+
+static double get_double(struct cache_reader *reader)
+{
+	double value;
+
+	get_bytes(reader, &value, sizeof(value));
+	return value;
+}
+
+/* a count can never be more than what is left in the file */
+static uint32_t get_count(struct cache_reader *reader, size_t element_size)
+{
+	uint32_t count = get_u32(reader);
+
+	if (reader->ok && count > (size_t)(reader->end - reader->cursor) / element_size)
+		reader->ok = false;
+	return reader->ok ? count : 0;
+}
+
+static void get_ring(struct cache_reader *reader, Polygon_2 *poly)
+{
+	uint32_t i, count = get_count(reader, 2 * sizeof(double));
+
+	for (i = 0; i < count; i++) {
+		double X = get_double(reader);
+		double Y = get_double(reader);
+
+		poly->push_back(Point(X, Y));
+	}
+}
+
+static bool parse_cache_file(struct skeleton_cache *cache, const unsigned char *data, size_t size)
+{
+	struct cache_reader reader = { data, data + size, true };
+	char magic[4];
+	uint64_t hash;
+	uint32_t i, j, k, count;
+
+	get_bytes(&reader, magic, sizeof(magic));
+	if (!reader.ok || memcmp(magic, CACHE_MAGIC, 4) != 0)
+		return false;
+	if (get_u32(&reader) != CACHE_VERSION)
+		return false;
+	get_bytes(&reader, &hash, sizeof(hash));
+	if (hash != cache->hash)
+		return false;
+
+	cache->have_edges = get_u32(&reader) != 0;
+	count = get_count(&reader, 4 * sizeof(double) + 2);
+	for (i = 0; i < count && reader.ok; i++) {
+		struct skeleton_edge e;
+		unsigned char flags[2];
+
+		e.X1 = get_double(&reader);
+		e.Y1 = get_double(&reader);
+		e.X2 = get_double(&reader);
+		e.Y2 = get_double(&reader);
+		get_bytes(&reader, flags, sizeof(flags));
+		e.is_inner_bisector = flags[0];
+		e.is_bisector = flags[1];
+		cache->edges.push_back(e);
+	}
+
+	count = get_count(&reader, sizeof(double) + sizeof(uint32_t));
+	for (i = 0; i < count && reader.ok; i++) {
+		PolygonWithHolesPtrVector polys;
+		double offset = get_double(&reader);
+		uint32_t nrpolys = get_count(&reader, sizeof(uint32_t));
+
+		for (j = 0; j < nrpolys && reader.ok; j++) {
+			uint32_t rings = get_count(&reader, sizeof(uint32_t));
+			Polygon_2 outer;
+
+			if (rings == 0) {
+				reader.ok = false;
+				break;
+			}
+			get_ring(&reader, &outer);
+			PolygonWithHolesPtr p(new PolygonWithHoles(outer));
+			for (k = 1; k < rings && reader.ok; k++) {
+				Polygon_2 hole;
+
+				get_ring(&reader, &hole);
+				p->add_hole(hole);
+			}
+			polys.push_back(p);
+		}
+		cache->offsets[offset] = { polys, false };
+	}
+
+	return reader.ok && reader.cursor == reader.end;
+}
+
+static void load_cache_file(struct skeleton_cache *cache)
+{
+	char filename[4096];
+	vector<unsigned char> data;
+	FILE *file;
+	long size;
+
+	cache_filename(filename, sizeof(filename), cache->hash);
+	file = fopen(filename, "rb");
+	if (!file)
+		return;
+
+	if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+		data.resize(size);
+		if (fread(&data[0], 1, size, file) == (size_t)size && parse_cache_file(cache, &data[0], size)) {
+			cache_loaded++;
+			fclose(file);
+			return;
+		}
+	}
+	fclose(file);
+
+	/* half written or from some other version: start over */
+	cache->have_edges = false;
+	cache->edges.clear();
+	cache->offsets.clear();
+}
+
+struct skeleton_cache *skeleton_cache_open(const PolygonWithHoles &ph)
+{
+	struct skeleton_cache *cache;
+	uint64_t hash;
+
+	if (!cache_dir)
+		return NULL;
+
+	hash = hash_shape(ph);
+	if (caches.count(hash))
+		return caches[hash];
+
+	cache = new struct skeleton_cache;
+	cache->hash = hash;
+	cache->dirty = false;
+	cache->loaded = true;
+	cache->have_edges = false;
+	load_cache_file(cache);
+	caches[hash] = cache;
+	return cache;
+}
+
+static void ensure_loaded(struct skeleton_cache *cache)
+{
+	if (cache->loaded)
+		return;
+	cache->loaded = true;
+	load_cache_file(cache);
+}
+
+bool skeleton_cache_get_offset(struct skeleton_cache *cache, double offset, PolygonWithHolesPtrVector *result)
+{
+	if (!cache)
+		return false;
+	ensure_loaded(cache);
+
+	/* insets are computed the same way every run, so an exact match is what to look for */
+	auto o = cache->offsets.find(offset);
+	if (o != cache->offsets.end()) {
+		*result = o->second.polys;
+		o->second.used = true;
+		cache_offset_hits++;
+		return true;
+	}
+	cache_offset_misses++;
+	return false;
+}
+
+void skeleton_cache_put_offset(struct skeleton_cache *cache, double offset, const PolygonWithHolesPtrVector &result)
+{
+	if (!cache)
+		return;
+	ensure_loaded(cache);
+	cache->offsets[offset] = { result, true };
+	cache->dirty = true;
+}
+
+bool skeleton_cache_get_edges(struct skeleton_cache *cache, vector<struct skeleton_edge> *edges)
+{
+	if (!cache)
+		return false;
+	ensure_loaded(cache);
+	if (!cache->have_edges) {
+		cache_edge_misses++;
+		return false;
+	}
+	*edges = cache->edges;
+	cache_edge_hits++;
+	return true;
+}
+
+void skeleton_cache_put_edges(struct skeleton_cache *cache, const vector<struct skeleton_edge> &edges)
+{
+	if (!cache)
+		return;
+	ensure_loaded(cache);
+	cache->edges = edges;
+	cache->have_edges = true;
+	cache->dirty = true;
+}
+
+static void put_bytes(vector<unsigned char> &out, const void *data, size_t length)
+{
+	const unsigned char *c = (const unsigned char *)data;
+
+	out.insert(out.end(), c, c + length);
+}
+
+static void put_u32(vector<unsigned char> &out, uint32_t value)
+{
+	put_bytes(out, &value, sizeof(value));
+}
+
+static void put_double(vector<unsigned char> &out, double value)
+{
+	put_bytes(out, &value, sizeof(value));
+}
+
+static void put_ring(vector<unsigned char> &out, const Polygon_2 &poly)
+{
+	put_u32(out, poly.size());
+	for (auto v = poly.vertices_begin(); v != poly.vertices_end(); ++v) {
+		put_double(out, CGAL::to_double(v->x()));
+		put_double(out, CGAL::to_double(v->y()));
+	}
+}
+
+static void write_cache_file(struct skeleton_cache *cache)
+{
+	char filename[4096], tmpname[4200];
+	vector<unsigned char> out;
+	vector<pair<const double, struct skeleton_offset> *> keep;
+	FILE *file;
+	bool ok;
+
+	for (int used = 1; used >= 0; used--)
+		for (auto &o : cache->offsets)
+			if (o.second.used == (used == 1) && keep.size() < CACHE_MAX_OFFSETS)
+				keep.push_back(&o);
+
+	put_bytes(out, CACHE_MAGIC, 4);
+	put_u32(out, CACHE_VERSION);
+	put_bytes(out, &cache->hash, sizeof(cache->hash));
+
+	put_u32(out, cache->have_edges);
+	put_u32(out, cache->edges.size());
+	for (auto &e : cache->edges) {
+		unsigned char flags[2] = { e.is_inner_bisector, e.is_bisector };
+
+		put_double(out, e.X1);
+		put_double(out, e.Y1);
+		put_double(out, e.X2);
+		put_double(out, e.Y2);
+		put_bytes(out, flags, sizeof(flags));
+	}
+
+	put_u32(out, keep.size());
+	for (auto o : keep) {
+		put_double(out, o->first);
+		put_u32(out, o->second.polys.size());
+		for (auto p : o->second.polys) {
+			put_u32(out, 1 + p->number_of_holes());
+			put_ring(out, p->outer_boundary());
+			for (auto h = p->holes_begin(); h != p->holes_end(); ++h)
+				put_ring(out, *h);
+		}
+	}
+
+	/* write to the side and rename, so a concurrent run never sees half a file */
+	cache_filename(filename, sizeof(filename), cache->hash);
+	snprintf(tmpname, sizeof(tmpname), "%s.%i", filename, (int)getpid());
+	file = fopen(tmpname, "wb");
+	if (!file) {
+		cache_write_failures++;
+		return;
+	}
+	ok = fwrite(&out[0], 1, out.size(), file) == out.size();
+	ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+	/* rename() does not replace an existing file on windows */
+	if (ok)
+		remove(filename);
+#endif
+	if (!ok || rename(tmpname, filename) != 0) {
+		remove(tmpname);
+		cache_write_failures++;
+		return;
+	}
+	cache->dirty = false;
+	cache_written++;
+}
+
+/* once it is all in the file, it gets read back from there if it is needed again */
+static void release_cache(struct skeleton_cache *cache)
+{
+	cache->loaded = false;
+	cache->have_edges = false;
+	vector<struct skeleton_edge>().swap(cache->edges);
+	cache->offsets.clear();
+}
+
+void write_skeleton_caches(void)
+{
+	for (auto c : caches) {
+		if (c.second->dirty)
+			write_cache_file(c.second);
+		if (!c.second->dirty)
+			release_cache(c.second);
+	}
+}
+
+void print_skeleton_cache_stats(void)
+{
+	if (!cache_dir)
+		return;
+	qprintf("Skeleton cache                : %li/%li offsets and %li/%li halfedge sets from %s\n",
+		cache_offset_hits, cache_offset_hits + cache_offset_misses,
+		cache_edge_hits, cache_edge_hits + cache_edge_misses, cache_dir);
+	vprintf("Skeleton cache: %i entries loaded, %i written, %i failed to write\n",
+		cache_loaded, cache_written, cache_write_failures);
+}
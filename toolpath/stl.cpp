@@ -12,13 +12,16 @@
 #include <errno.h>
 #include <string.h>
 
+#include "scene.h"
+#include "endmill.h"
 extern "C" {
 #include <math.h>
 #include "fenrus.h"
 #include "toolpath.h"
 }
-#include "scene.h"
-#include "endmill.h"
+
+#include <vector>
+#include <algorithm>
 
 struct stltriangle {
 	float normal[3];
@@ -223,6 +226,211 @@ static int read_stl_file(const char *filename, int flip)
 	return 0;
 }
 
+/*
+ * Rest machining.
+ *
+ * rest_Z is the stock surface the tools that already ran leave behind (0 is the
+ * untouched top), stamped from every cutting move line_to() emits. A later tool only
+ * rasters the islands where that stock is more than REST_THRESHOLD above the model,
+ * widened by the tool radius, one island at a time so it does not travel over the
+ * parts that are already done.
+ */
+#define REST_GRID 0.25
+#define REST_MAX_NODES 4000000
+#define REST_THRESHOLD 0.02
+
+struct rest_island {
+	int id;
+	double minX, minY, maxX, maxY;
+};
+
+static int rest_nx, rest_ny;
+static double rest_X0, rest_Y0, rest_step;
+static std::vector<float> rest_Z;
+static std::vector<int> rest_id;
+static std::vector<struct rest_island> rest_islands;
+static bool rest_stamping, rest_active;
+/* only emit raster points inside this island, -1 for everything */
+static int scan_island = -1;
+
+static void rest_init(double margin)
+{
+	rest_step = REST_GRID;
+	do {
+		rest_nx = (int)ceil((stl_image_X() + 2 * margin) / rest_step) + 1;
+		rest_ny = (int)ceil((stl_image_Y() + 2 * margin) / rest_step) + 1;
+		if ((long)rest_nx * rest_ny > REST_MAX_NODES)
+			rest_step *= 1.5;
+	} while ((long)rest_nx * rest_ny > REST_MAX_NODES);
+	rest_X0 = -margin;
+	rest_Y0 = -margin;
+	rest_Z.assign(rest_nx * rest_ny, 0);
+	rest_id.assign(rest_nx * rest_ny, -1);
+}
+
+static inline int rest_node(double X, double Y)
+{
+	int i = (int)lround((X - rest_X0) / rest_step);
+	int j = (int)lround((Y - rest_Y0) / rest_step);
+
+	if (i < 0 || j < 0 || i >= rest_nx || j >= rest_ny)
+		return -1;
+	return j * rest_nx + i;
+}
+
+static inline bool rest_in_island(double X, double Y)
+{
+	int n = rest_node(X, Y);
+
+	return n >= 0 && rest_id[n] == scan_island;
+}
+
+/* lower the stock to what the tool sweeps moving in a straight line from 1 to 2 */
+static void rest_stamp(class endmill *mill, double X1, double Y1, double Z1, double X2, double Y2, double Z2)
+{
+	double R = mill->get_diameter() / 2;
+	double dX = X2 - X1, dY = Y2 - Y1;
+	double len2 = dX * dX + dY * dY;
+	int i, j, i0, i1, j0, j1;
+
+	if (Z1 >= 0 && Z2 >= 0)
+		return;
+
+	i0 = (int)floor((fmin(X1, X2) - R - rest_X0) / rest_step);
+	i1 = (int)ceil((fmax(X1, X2) + R - rest_X0) / rest_step);
+	j0 = (int)floor((fmin(Y1, Y2) - R - rest_Y0) / rest_step);
+	j1 = (int)ceil((fmax(Y1, Y2) + R - rest_Y0) / rest_step);
+	i0 = std::max(i0, 0);
+	j0 = std::max(j0, 0);
+	i1 = std::min(i1, rest_nx - 1);
+	j1 = std::min(j1, rest_ny - 1);
+
+	for (j = j0; j <= j1; j++) {
+		for (i = i0; i <= i1; i++) {
+			double X = rest_X0 + i * rest_step, Y = rest_Y0 + j * rest_step;
+			double t = 0, d, Z, half, ts[3];
+			int k;
+
+			if (len2 > 0)
+				t = fmin(fmax(((X - X1) * dX + (Y - Y1) * dY) / len2, 0), 1);
+			d = dist(X, Y, X1 + t * dX, Y1 + t * dY);
+			if (d > R)
+				continue;
+
+			/* on a sloped move the lowest pass over the node is not the closest one: also try where it enters and leaves the tool */
+			half = len2 > 0 ? sqrt(R * R - d * d) / sqrt(len2) : 0;
+			ts[0] = t;
+			ts[1] = fmax(t - half, 0);
+			ts[2] = fmin(t + half, 1);
+			for (k = 0; k < 3; k++) {
+				d = dist(X, Y, X1 + ts[k] * dX, Y1 + ts[k] * dY);
+				if (d > R)
+					continue;
+				Z = Z1 + ts[k] * (Z2 - Z1) + mill->geometry_at_distance(d);
+				if (Z < rest_Z[j * rest_nx + i])
+					rest_Z[j * rest_nx + i] = Z;
+			}
+		}
+	}
+}
+
+/* find the islands the tool still has work in, nearest one next */
+static void rest_plan(class endmill *mill, double offset, double maxZ)
+{
+	std::vector<int> excess(rest_nx * rest_ny), wide(rest_nx * rest_ny), stack;
+	std::vector<struct rest_island> found;
+	int w = (int)ceil(mill->get_diameter() / 2 / rest_step) + 1;
+	int i, j, k, n, ids = 0;
+	long needed = 0;
+	double X = 0, Y = 0;
+
+	for (j = 0; j < rest_ny; j++)
+		for (i = 0; i < rest_nx; i++) {
+			double model = get_height(rest_X0 + i * rest_step, rest_Y0 + j * rest_step) - maxZ;
+			excess[j * rest_nx + i] = rest_Z[j * rest_nx + i] - (model + offset) > REST_THRESHOLD;
+		}
+
+	/* a tool position can reach material up to its radius away: dilate with a box, rows then columns */
+	for (j = 0; j < rest_ny; j++) {
+		int count = 0;
+		for (i = 0; i < rest_nx + w; i++) {
+			if (i < rest_nx)
+				count += excess[j * rest_nx + i];
+			if (i - 2 * w - 1 >= 0)
+				count -= excess[j * rest_nx + i - 2 * w - 1];
+			if (i - w >= 0 && i - w < rest_nx)
+				wide[j * rest_nx + i - w] = count > 0;
+		}
+	}
+	for (i = 0; i < rest_nx; i++) {
+		int count = 0;
+		for (j = 0; j < rest_ny + w; j++) {
+			if (j < rest_ny)
+				count += wide[j * rest_nx + i];
+			if (j - 2 * w - 1 >= 0)
+				count -= wide[(j - 2 * w - 1) * rest_nx + i];
+			if (j - w >= 0 && j - w < rest_ny)
+				excess[(j - w) * rest_nx + i] = count > 0;
+		}
+	}
+
+	rest_id.assign(rest_nx * rest_ny, -1);
+	for (n = 0; n < rest_nx * rest_ny; n++) {
+		struct rest_island island;
+
+		if (!excess[n] || rest_id[n] >= 0)
+			continue;
+
+		island.id = ids++;
+		island.minX = island.maxX = rest_X0 + (n % rest_nx) * rest_step;
+		island.minY = island.maxY = rest_Y0 + (n / rest_nx) * rest_step;
+		rest_id[n] = island.id;
+		stack.push_back(n);
+		while (stack.size() > 0) {
+			int c = stack.back();
+			int nb[4] = { c - 1, c + 1, c - rest_nx, c + rest_nx };
+
+			stack.pop_back();
+			needed++;
+			island.minX = fmin(island.minX, rest_X0 + (c % rest_nx) * rest_step);
+			island.maxX = fmax(island.maxX, rest_X0 + (c % rest_nx) * rest_step);
+			island.minY = fmin(island.minY, rest_Y0 + (c / rest_nx) * rest_step);
+			island.maxY = fmax(island.maxY, rest_Y0 + (c / rest_nx) * rest_step);
+			for (k = 0; k < 4; k++) {
+				if (nb[k] < 0 || nb[k] >= rest_nx * rest_ny)
+					continue;
+				if (k < 2 && nb[k] / rest_nx != c / rest_nx)
+					continue;
+				if (!excess[nb[k]] || rest_id[nb[k]] >= 0)
+					continue;
+				rest_id[nb[k]] = island.id;
+				stack.push_back(nb[k]);
+			}
+		}
+		found.push_back(island);
+	}
+
+	rest_islands.clear();
+	while (found.size() > 0) {
+		unsigned int best = 0;
+		double bestd = 1e100;
+
+		for (unsigned int f = 0; f < found.size(); f++) {
+			double d = dist(X, Y, found[f].minX, found[f].minY);
+			if (d < bestd) {
+				bestd = d;
+				best = f;
+			}
+		}
+		rest_islands.push_back(found[best]);
+		X = found[best].maxX;
+		Y = found[best].maxY;
+		found.erase(found.begin() + best);
+	}
+
+	vprintf("Rest machining: %i islands covering %4.1f%% of the stock\n", (int)rest_islands.size(), 100.0 * needed / (rest_nx * rest_ny));
+}
+
 static double last_X,  last_Y, last_Z;
 static double cur_X, cur_Y, cur_Z;
 static bool first;
@@ -252,6 +460,9 @@ static void line_to(class inputshape *input, class endmill *mill, double X2, dou
 		return;
 	}
 
+	if (rest_stamping)
+		rest_stamp(mill, X1, Y1, Z1, X2, Y2, Z2);
+
 	while (Z1 < -0.000001 || Z2 < -0.00001) {
 //		printf("at depth %i    %5.2f %5.2f %5.2f -> %5.2f %5.2f %5.2f\n", depth, X1, Y1, Z1, X2, Y2, Z2);
 		depth++;
@@ -284,11 +495,7 @@ static void line_to(class inputshape *input, class endmill *mill, double X2, dou
 					tool->no_sort = true;
 					input->tooldepths[depth]->toollevels.push_back(tool);
 		}
-		Polygon_2 *p2;
-		p2 = new(Polygon_2);
-		p2->push_back(Point(X1, Y1));
-		p2->push_back(Point(X2, Y2));
-		input->tooldepths[depth]->toollevels[0]->add_poly_vcarve(p2, Z1, Z2);
+		input->tooldepths[depth]->toollevels[0]->add_vcarve_segment(X1, Y1, X2, Y2, Z1, Z2);
 
 		Z1 += tooldepth;
 		Z2 += tooldepth;
@@ -462,12 +669,9 @@ static void create_cutout(class scene *scene, class endmill *mill)
 		tool->name = "Cutout";
 		td->toollevels.push_back(tool);
 
-	    Polygon_2 *p2;
-		p2 = new(Polygon_2);
 		double d1 = currentdepth;
-		p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-		p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-		tool->add_poly_vcarve(p2, d1, d1);
+		tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()),
+					 CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), d1, d1);
 	}			
 
 	for (unsigned int i = 0; i < p->size(); i++) {
@@ -510,16 +714,12 @@ static void create_cutout(class scene *scene, class endmill *mill)
 			tool->name = NULL;
 			td->toollevels.push_back(tool);
 
-			Polygon_2 *p2;
-			p2 = new(Polygon_2);
 			double d1 = currentdepth;
 			double d2 = gradient * dist(	CGAL::to_double((*p)[i].x()), 
 														CGAL::to_double((*p)[i].y()), 
 														CGAL::to_double((*p)[next].x()), 
 														CGAL::to_double((*p)[next].y()));
-			p2->push_back(Point(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y())));
-			p2->push_back(Point(CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y())));
-			tool->add_poly_vcarve(p2, d1, d1 + d2);
+			tool->add_vcarve_segment(CGAL::to_double((*p)[i].x()), CGAL::to_double((*p)[i].y()), CGAL::to_double((*p)[next].x()), CGAL::to_double((*p)[next].y()), d1, d1 + d2);
 			currentdepth += d2;
 					
 		}
@@ -541,6 +741,215 @@ static bool outside_area(double X, double Y, double mX, double mY, double diam)
 
 }
 
+/*
+ * Point reduction along a raster scanline.
+ *
+ * The scanline is sampled at every stepover, and only the points needed to keep every
+ * sample within SCAN_TOLERANCE of the emitted polyline go to line_to(): an interval is
+ * split at its worst sample until all samples in it fit the straight line between its
+ * ends (Douglas-Peucker), then runs of collinear points are merged.
+ * Checking only some of the samples is not enough, an S-shaped profile can have its
+ * midpoint on the line and both halves off it.
+ */
+#define SCAN_TOLERANCE (0.5 / ACC)
+/* in roughing, bigger height jumps than this get a lift over the edge */
+#define SCAN_JUMP 0.5
+
+static double scan_radius, scan_offset, scan_maxZ, scan_stepover;
+static bool scan_roughing;
+static long scan_queries, scan_points;
+
+static double scan_height(class endmill *mill, double X, double Y)
+{
+	scan_queries++;
+	return get_height_tool(X, Y, scan_radius, mill) + scan_offset - scan_maxZ;
+}
+
+/* marks the samples between a and b that have to stay for the rest to fit straight lines */
+static void scan_refine(std::vector<double> &d, std::vector<bool> &keep, int a, int b)
+{
+	std::vector<std::pair<int, int>> todo;
+
+	todo.push_back(std::make_pair(a, b));
+	while (todo.size() > 0) {
+		int from = todo.back().first, to = todo.back().second;
+		int i, worst = -1;
+		double worstd = SCAN_TOLERANCE;
+
+		todo.pop_back();
+		if (to - from <= 1)
+			continue;
+
+		for (i = from + 1; i < to; i++) {
+			double dev = fabs(d[i] - (d[from] + (d[to] - d[from]) * (i - from) / (to - from)));
+			if (dev > worstd) {
+				worstd = dev;
+				worst = i;
+			}
+		}
+		/* in roughing, intervals with a jump go all the way down to the stepover */
+		if (worst < 0 && scan_roughing && fabs(d[to] - d[from]) > SCAN_JUMP)
+			worst = (from + to) / 2;
+		if (worst < 0)
+			continue;
+
+		keep[worst] = true;
+		todo.push_back(std::make_pair(worst, to));
+		todo.push_back(std::make_pair(from, worst));
+	}
+}
+
+/* can everything sampled strictly between from and to be replaced by a straight line */
+static bool scan_collinear(std::vector<double> &d, int from, int to)
+{
+	int i;
+
+	if (scan_roughing && fabs(d[to] - d[from]) > SCAN_JUMP)
+		return false;
+	for (i = from + 1; i < to; i++) {
+		if (fabs(d[i] - (d[from] + (d[to] - d[from]) * (i - from) / (to - from))) > SCAN_TOLERANCE)
+			return false;
+	}
+	return true;
+}
+
+/* walk the scanline from X,Y in steps of dX,dY until it passes limit */
+static void scan_line(class inputshape *input, class endmill *mill, double X, double Y, double dX, double dY,
+		      double limit, bool clip)
+{
+	std::vector<double> pX, pY, d;
+	std::vector<bool> keep, edge;
+	int n, i, anchor, prev;
+
+	while ((dX > 0 && X < limit) || (dX < 0 && X > limit) || (dY > 0 && Y < limit) || (dY < 0 && Y > limit)) {
+		pX.push_back(X);
+		pY.push_back(Y);
+		X += dX;
+		Y += dY;
+	}
+	n = pX.size();
+	if (n == 0)
+		return;
+
+	d.resize(n);
+	keep.resize(n, false);
+	edge.resize(n, false);
+
+	for (i = 0; i < n; i++)
+		d[i] = scan_height(mill, pX[i], pY[i]);
+	keep[0] = true;
+	keep[n - 1] = true;
+
+	/* the points on both sides of an island border must stay */
+	if (scan_island >= 0) {
+		for (i = 1; i < n; i++) {
+			if (rest_in_island(pX[i], pY[i]) == rest_in_island(pX[i - 1], pY[i - 1]))
+				continue;
+			keep[i - 1] = true;
+			keep[i] = true;
+			edge[i - 1] = true;
+			edge[i] = true;
+		}
+	}
+	prev = 0;
+	for (i = 1; i < n; i++) {
+		if (!keep[i])
+			continue;
+		scan_refine(d, keep, prev, i);
+		prev = i;
+	}
+
+	/* merge collinear runs: extend from the anchor for as long as everything in between fits */
+	anchor = 0;
+	prev = 0;
+	for (i = 1; i < n; i++) {
+		if (!keep[i])
+			continue;
+		if (prev != anchor && (edge[prev] || !scan_collinear(d, anchor, i)))
+			anchor = prev;
+		else if (prev != anchor)
+			keep[prev] = false;
+		prev = i;
+	}
+
+	for (i = 0; i < n; i++) {
+		double x = pX[i], y = pY[i], z = d[i];
+
+		if (!keep[i])
+			continue;
+
+		if (scan_island >= 0 && !rest_in_island(x, y)) {
+			first = true;
+			continue;
+		}
+
+		if (fabs(z - last_Z) > SCAN_JUMP && scan_roughing && !first && i > 0) {
+			x = pX[i - 1] + dX / 3;
+			y = pY[i - 1] + dY / 3;
+			z = scan_height(mill, x, y);
+			if (fabs(z - last_Z) > SCAN_JUMP) {
+				line_to(input, mill,  last_X, last_Y, fmax(last_Z, z));
+				line_to(input, mill,  x, y, fmax(last_Z, z));
+			}
+		}
+
+		if (!clip || !outside_area(x, y, stl_image_X(), stl_image_Y(), mill->get_diameter())) {
+			line_to(input, mill,  x, y, z);
+			scan_points++;
+		}
+	}
+}
+
+
+/* one row of an island; lift over the edge from the previous row like the full raster does */
+static void rest_row(class inputshape *input, class endmill *mill, double X, double Y, double dX, double dY, double limit)
+{
+	if (!first && rest_in_island(X, Y)) {
+		double d = scan_height(mill, X, Y);
+		if (fabs(d - last_Z) > 0.1) {
+			line_to(input, mill,  last_X, last_Y, fmax(last_Z, d));
+			line_to(input, mill,  X, Y, fmax(last_Z, d));
+		}
+	}
+	scan_line(input, mill, X, Y, dX, dY, limit, true);
+}
+
+static void create_rest_raster(class scene *scene, class endmill *mill, double stepover, bool even)
+{
+	unsigned int nr = 0;
+
+	for (auto island : rest_islands) {
+		class inputshape *input;
+		double X, Y;
+		bool forward = true;
+
+		input = new(class inputshape);
+		input->set_name("STL rest path");
+		scene->shapes.push_back(input);
+		first = true;
+		scan_island = island.id;
+
+		if (even) {
+			for (Y = island.minY; Y <= island.maxY + 0.0001; Y += stepover) {
+				if (forward)
+					rest_row(input, mill, island.minX, Y, stepover, 0, island.maxX + 0.0001);
+				else
+					rest_row(input, mill, island.maxX, Y, -stepover, 0, island.minX - 0.0001);
+				forward = !forward;
+			}
+		} else {
+			for (X = island.minX; X <= island.maxX + 0.0001; X += stepover) {
+				if (forward)
+					rest_row(input, mill, X, island.minY, 0, stepover, island.maxY + 0.0001);
+				else
+					rest_row(input, mill, X, island.maxY, 0, -stepover, island.minY - 0.0001);
+				forward = !forward;
+			}
+		}
+		print_progress(100.0 * ++nr / rest_islands.size());
+	}
+	scan_island = -1;
+}
 
 static void create_toolpath(class scene *scene, int tool, bool roughing, bool has_cutout, bool even)
 {
@@ -605,34 +1014,30 @@ static void create_toolpath(class scene *scene, int tool, bool roughing, bool ha
 	if (roughing)
 		gcode_set_roughing(1);
 
+	scan_radius = radius + offset;
+	scan_offset = offset;
+	scan_maxZ = maxZ;
+	scan_stepover = stepover;
+	scan_roughing = roughing;
+	scan_queries = 0;
+	scan_points = 0;
+
+	if (rest_active) {
+		create_rest_raster(scene, mill, stepover, even);
+		qprintf("                                                          \r");
+		vprintf("STL raster: %li height queries, %li points\n", scan_queries, scan_points);
+		first = true;
+		return;
+	}
+
 	if (even) {
 		input = new(class inputshape);
 		input->set_name("STL path");
 		scene->shapes.push_back(input);
 		first = true;
 		while (Y < maxY) {
-			double prevX;
 			X = -overshoot;
-			prevX = X;
-			while (X < maxX) {
-				double d;
-				d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-
-				if (fabs(d - last_Z) > 0.5 && roughing && !first) {
-					X = prevX + stepover / 3;
-					d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-					if (fabs(d - last_Z) > 0.5) {
-						line_to(input, mill,  last_X, last_Y, fmax(last_Z, d));
-						line_to(input, mill,  X, Y, fmax(last_Z, d));
-					}
-				}
-
-				if (!outside_area(X, Y, stl_image_X(), stl_image_Y(), diam))
-					line_to(input, mill,  X, Y, d);
-
-				prevX = X;
-				X = X + stepover;
-			}
+			scan_line(input, mill, X, Y, stepover, 0, maxX, true);
 			print_progress(100.0 * Y / maxY);
 			Y = Y + stepover;
 			X = maxX;
@@ -644,24 +1049,7 @@ static void create_toolpath(class scene *scene, int tool, bool roughing, bool ha
 				}
 				line_to(input, mill,  X, Y, d);
 			}
-			prevX = X;
-			while (X > -overshoot) {
-				double d;
-				d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-				if (fabs(d - last_Z) > 0.5 && roughing && !first) {
-					X = prevX - stepover / 3;
-					d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-					if (fabs(d - last_Z) > 0.5) {
-						line_to(input, mill,  last_X, last_Y, fmax(last_Z, d));
-						line_to(input, mill,  X, Y, fmax(last_Z, d));
-					}
-				}
-
-				line_to(input, mill,  X, Y, d);
-
-				prevX = X;
-				X = X - stepover;
-			}
+			scan_line(input, mill, X, Y, -stepover, 0, -overshoot, false);
 
 			X = -overshoot;
 			print_progress(100.0 * Y / maxY);
@@ -684,28 +1072,8 @@ static void create_toolpath(class scene *scene, int tool, bool roughing, bool ha
 		first = true;
 		X = -overshoot;
 		while (X < maxX) {
-			double prevY;
 			Y = -overshoot;
-			prevY = Y;
-			while (Y < maxY) {
-				double d;
-				d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-				if (fabs(d - last_Z) > 0.5 && roughing && !first) {
-					Y = prevY + stepover / 3;
-					d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-					if (fabs(d - last_Z) > 0.5) {
-						line_to(input, mill,  last_X, last_Y, fmax(last_Z, d));
-						line_to(input, mill,  X, Y, fmax(last_Z, d));
-					}
-				}
-
-
-				if (!outside_area(X, Y, stl_image_X(), stl_image_Y(), diam)) {
-					line_to(input, mill,  X, Y, d);
-				}
-				prevY = Y;
-				Y = Y + stepover;
-			}
+			scan_line(input, mill, X, Y, 0, stepover, maxY, true);
 			print_progress(100.0 * X / maxX);
 			X = X + stepover;
 			Y = maxY;
@@ -717,25 +1085,7 @@ static void create_toolpath(class scene *scene, int tool, bool roughing, bool ha
 					}
 					line_to(input, mill,  X, Y, d);
 			}
-			prevY = Y;
-			while (Y > - overshoot) {
-				double d;
-				d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-				if (fabs(d - last_Z) > 0.5 && roughing && !first) {
-					Y = prevY - stepover / 3;
-					d = get_height_tool(X, Y, radius + offset, mill) + offset - maxZ;
-					if (fabs(d - last_Z) > 0.5) {
-						line_to(input, mill,  last_X, last_Y, fmax(last_Z, d));
-						line_to(input, mill,  X, Y, fmax(last_Z, d));
-					}
-				}
-
-
-				if (!outside_area(X, Y, stl_image_X(), stl_image_Y(), diam))
-					line_to(input, mill,  X, Y, d);
-				prevY = Y;
-				Y = Y - stepover;
-			}
+			scan_line(input, mill, X, Y, 0, -stepover, -overshoot, true);
 			print_progress(100.0 * X / maxX);
 			X = X + stepover;
 			Y = -overshoot;
@@ -753,9 +1103,364 @@ static void create_toolpath(class scene *scene, int tool, bool roughing, bool ha
 	}
 
 	qprintf("                                                          \r");
+	vprintf("STL raster: %li height queries, %li points\n", scan_queries, scan_points);
 	first = true;
 }
 
+/*
+ * Waterline (Z-level) roughing.
+ *
+ * The tool-offset heightfield (the lowest Z the tool tip can go at a given XY, stock
+ * to leave included) is sampled on a grid once. At every depth-of-cut level the area
+ * where the tool can go that deep is traced into closed contours with marching
+ * squares, and each contour is cleared with the regular pocketing code
+ * (inputshape::create_toolpaths) instead of rastering the whole stock.
+ */
+struct wl_point {
+	double X, Y;
+};
+
+struct wl_grid {
+	int nx, ny;
+	double X0, Y0, step;
+	std::vector<double> H;
+};
+
+static inline double wl_H(struct wl_grid *g, int i, int j)
+{
+	return g->H[j * g->nx + i];
+}
+
+/* a node is inside when the tool fits there and at its 4 neighbours, which keeps the contour off the model in between samples */
+static bool wl_inside(struct wl_grid *g, int i, int j, double Z)
+{
+	if (i <= 0 || j <= 0 || i >= g->nx - 1 || j >= g->ny - 1)
+		return false;
+	return wl_H(g, i, j) <= Z && wl_H(g, i - 1, j) <= Z && wl_H(g, i + 1, j) <= Z &&
+		wl_H(g, i, j - 1) <= Z && wl_H(g, i, j + 1) <= Z;
+}
+
+/* edge 2*node is the horizontal edge to the right of a node, 2*node+1 the vertical edge above it */
+static struct wl_point wl_edge_point(struct wl_grid *g, int edge)
+{
+	struct wl_point p;
+	int node = edge / 2;
+
+	p.X = g->X0 + (node % g->nx) * g->step;
+	p.Y = g->Y0 + (node / g->nx) * g->step;
+	if (edge & 1)
+		p.Y += g->step / 2;
+	else
+		p.X += g->step / 2;
+	return p;
+}
+
+static double wl_area(std::vector<struct wl_point> &loop)
+{
+	double a = 0;
+	for (unsigned int i = 0; i < loop.size(); i++) {
+		unsigned int n = (i + 1) % loop.size();
+		a += loop[i].X * loop[n].Y - loop[n].X * loop[i].Y;
+	}
+	return a / 2;
+}
+
+static double wl_dist_to_line(struct wl_point a, struct wl_point b, struct wl_point p)
+{
+	double dX = b.X - a.X, dY = b.Y - a.Y;
+	double len = sqrt(dX * dX + dY * dY);
+	if (len < 0.000001)
+		return dist(a.X, a.Y, p.X, p.Y);
+	return fabs(dX * (a.Y - p.Y) - dY * (a.X - p.X)) / len;
+}
+
+/* drop points that stay within tolerance of the line that replaces them */
+static void wl_simplify(std::vector<struct wl_point> &loop, double tolerance)
+{
+	std::vector<struct wl_point> out;
+	unsigned int anchor = 0, i, k;
+
+	out.push_back(loop[0]);
+	for (i = 2; i <= loop.size(); i++) {
+		struct wl_point end = loop[i % loop.size()];
+		bool fits = true;
+		for (k = anchor + 1; k < i; k++)
+			if (wl_dist_to_line(loop[anchor], end, loop[k]) > tolerance)
+				fits = false;
+		if (!fits) {
+			anchor = i - 1;
+			out.push_back(loop[anchor]);
+		}
+	}
+	loop = out;
+}
+
+static int wl_unsimplified, wl_dropped;
+
+static bool wl_is_simple(std::vector<struct wl_point> &loop)
+{
+	Polygon_2 poly;
+
+	if (loop.size() < 3)
+		return false;
+	for (auto p : loop)
+		poly.push_back(Point(p.X, p.Y));
+	return poly.is_simple();
+}
+
+/*
+ * Simplifying can make a contour touch or cross itself, and a shape that is not simple
+ * would be mangled by close_shape(). Fall back to the traced points in that case; a
+ * contour is only dropped if even those are not simple.
+ */
+static bool wl_pick_points(std::vector<struct wl_point> &loop, double tolerance)
+{
+	std::vector<struct wl_point> simplified = loop;
+
+	wl_simplify(simplified, tolerance);
+	if (wl_is_simple(simplified)) {
+		loop = simplified;
+		return true;
+	}
+	if (wl_is_simple(loop)) {
+		wl_unsimplified++;
+		return true;
+	}
+	wl_dropped++;
+	return false;
+}
+
+static void wl_set_points(class inputshape *shape, std::vector<struct wl_point> &loop)
+{
+	shape->poly.clear();
+	for (auto p : loop)
+		shape->add_point(p.X, p.Y);
+	shape->close_shape();
+}
+
+/* the holes are simplified on their own, so they can end up crossing their outer or each other */
+static bool wl_rings_cross(class inputshape *outer)
+{
+	std::vector<Polygon_2 *> rings;
+	std::vector<unsigned int> group;
+
+	if (outer->children.size() == 0)
+		return false;
+	rings.push_back(&outer->poly);
+	for (auto c : outer->children)
+		rings.push_back(&c->poly);
+	for (unsigned int r = 0; r < rings.size(); r++)
+		group.push_back(r);
+	return rings_cross(rings, group);
+}
+
+static void wl_delete_shape(class inputshape *shape)
+{
+	for (auto c : shape->children)
+		delete c;
+	delete shape;
+}
+
+/* closed contours around the area where the tool can reach Z, counter clockwise outside, clockwise for islands */
+static void wl_contours(struct wl_grid *g, double Z, std::vector<std::vector<struct wl_point>> &loops)
+{
+	std::vector<int> next(2 * g->nx * g->ny, -1);
+	std::vector<char> in(g->nx * g->ny);
+	int i, j, e;
+
+	for (j = 0; j < g->ny; j++)
+		for (i = 0; i < g->nx; i++)
+			in[j * g->nx + i] = wl_inside(g, i, j, Z);
+
+	for (j = 0; j < g->ny - 1; j++) {
+		for (i = 0; i < g->nx - 1; i++) {
+			/* corners and edges counter clockwise, starting bottom left / bottom */
+			int c[4] = { j * g->nx + i, j * g->nx + i + 1, (j + 1) * g->nx + i + 1, (j + 1) * g->nx + i };
+			int edge[4] = { 2 * c[0], 2 * c[1] + 1, 2 * c[3], 2 * c[0] + 1 };
+			bool center = in[c[0]] + in[c[1]] + in[c[2]] + in[c[3]] >= 2;
+			int k;
+
+			for (k = 0; k < 4; k++) {
+				int l, step;
+				/* an exit edge goes from inside to outside */
+				if (!in[c[k]] || in[c[(k + 1) % 4]])
+					continue;
+				/* pair it with the next entry edge if the middle of the cell is inside, the previous otherwise */
+				step = center ? 1 : 3;
+				for (l = (k + step) % 4; l != k; l = (l + step) % 4)
+					if (!in[c[l]] && in[c[(l + 1) % 4]])
+						break;
+				next[edge[k]] = edge[l];
+			}
+		}
+	}
+
+	for (e = 0; e < (int)next.size(); e++) {
+		std::vector<struct wl_point> loop;
+		int cur = e;
+
+		if (next[e] < 0)
+			continue;
+		while (next[cur] >= 0) {
+			int n = next[cur];
+			loop.push_back(wl_edge_point(g, cur));
+			next[cur] = -1;
+			cur = n;
+		}
+		if (loop.size() >= 4)
+			loops.push_back(loop);
+	}
+}
+
+static void create_waterline_roughing(class scene *scene, int tool, bool has_cutout)
+{
+	class endmill *mill = get_endmill(tool);
+	struct wl_grid grid;
+	double diam = mill->get_diameter();
+	double offset = scene->get_stock_to_leave();
+	double maxZ = scene->get_cutout_depth();
+	double stepdown = mill->get_depth_of_cut();
+	double overshoot = 0;
+	double Z, bottom = 0;
+	int i, j, levels = 0, contours = 0;
+	std::vector<double> reached;
+
+	if (has_cutout)
+		overshoot = diam / 2 * 0.9;
+	wl_unsimplified = 0;
+	wl_dropped = 0;
+
+	/* one extra (blocked) row of nodes on every side closes the contours at the stock edge */
+	grid.step = fmin(fmax(mill->get_stepover() / 2, 0.1), 1.0);
+	grid.X0 = -overshoot - grid.step;
+	grid.Y0 = -overshoot - grid.step;
+	grid.nx = (int)ceil((stl_image_X() + 2 * overshoot) / grid.step) + 3;
+	grid.ny = (int)ceil((stl_image_Y() + 2 * overshoot) / grid.step) + 3;
+	grid.H.resize(grid.nx * grid.ny);
+	reached.resize(grid.nx * grid.ny, 0);
+
+	for (j = 0; j < grid.ny; j++) {
+		for (i = 0; i < grid.nx; i++) {
+			double d = get_height_tool(grid.X0 + i * grid.step, grid.Y0 + j * grid.step, diam / 2 + offset, mill) + offset - maxZ;
+			grid.H[j * grid.nx + i] = d;
+			bottom = fmin(bottom, d);
+		}
+		print_progress(50.0 * j / grid.ny);
+	}
+
+	gcode_set_roughing(1);
+
+	Z = 0;
+	while (Z > bottom + 0.001) {
+		std::vector<std::vector<struct wl_point>> loops;
+		std::vector<class inputshape *> outers;
+		std::map<class inputshape *, std::vector<struct wl_point>> traced;
+
+		Z = fmax(Z - stepdown, bottom);
+		levels++;
+		print_progress(50 + 50.0 * Z / bottom);
+
+		wl_contours(&grid, Z, loops);
+
+		if (rest_stamping)
+			for (j = 0; j < grid.ny; j++)
+				for (i = 0; i < grid.nx; i++)
+					if (wl_inside(&grid, i, j, Z))
+						reached[j * grid.nx + i] = Z;
+
+		/* outer contours first, smallest first so an island lands in the tightest outer around it */
+		sort(loops.begin(), loops.end(), [](std::vector<struct wl_point> &A, std::vector<struct wl_point> &B) {
+			return fabs(wl_area(A)) < fabs(wl_area(B));
+		});
+
+		for (auto loop : loops) {
+			std::vector<struct wl_point> points = loop;
+			class inputshape *input;
+
+			if (wl_area(loop) <= 0)
+				continue;
+			if (!wl_pick_points(loop, grid.step / 4))
+				continue;
+			input = new(class inputshape);
+			input->set_name("STL waterline");
+			wl_set_points(input, loop);
+			if (input->poly.size() < 3) {
+				delete input;
+				continue;
+			}
+			outers.push_back(input);
+			traced[input] = points;
+		}
+		for (auto loop : loops) {
+			std::vector<struct wl_point> points = loop;
+			class inputshape *hole;
+			bool placed = false;
+
+			if (wl_area(loop) >= 0)
+				continue;
+			if (!wl_pick_points(loop, grid.step / 4))
+				continue;
+			hole = new(class inputshape);
+			wl_set_points(hole, loop);
+			if (hole->poly.size() < 3) {
+				delete hole;
+				continue;
+			}
+			for (auto outer : outers) {
+				if (outer->poly.bounded_side(Point(loop[0].X, loop[0].Y)) == CGAL::ON_BOUNDED_SIDE) {
+					outer->add_child(hole);
+					placed = true;
+					break;
+				}
+			}
+			if (!placed) {
+				delete hole;
+				continue;
+			}
+			traced[hole] = points;
+		}
+
+		/* traced contours of one level never cross, so go back to those when the simplified ones do */
+		for (auto outer : outers) {
+			if (!wl_rings_cross(outer))
+				continue;
+			wl_unsimplified += 1 + outer->children.size();
+			wl_set_points(outer, traced[outer]);
+			for (auto c : outer->children)
+				wl_set_points(c, traced[c]);
+		}
+
+		for (auto outer : outers) {
+			if (!outer->poly.is_simple() || wl_rings_cross(outer)) {
+				wl_dropped++;
+				wl_delete_shape(outer);
+				continue;
+			}
+			outer->set_level(0);
+			outer->create_toolpaths(tool, Z, 0, 0, -diam / 2 + 0.001, 100000, false);
+			scene->shapes.push_back(outer);
+			contours++;
+		}
+	}
+
+	/* the tool cleared every contour down to its level */
+	if (rest_stamping) {
+		for (j = 0; j < rest_ny; j++)
+			for (i = 0; i < rest_nx; i++) {
+				int gi = (int)lround((rest_X0 + i * rest_step - grid.X0) / grid.step);
+				int gj = (int)lround((rest_Y0 + j * rest_step - grid.Y0) / grid.step);
+				if (gi < 0 || gj < 0 || gi >= grid.nx || gj >= grid.ny)
+					continue;
+				rest_Z[j * rest_nx + i] = fmin(rest_Z[j * rest_nx + i], reached[gj * grid.nx + gi]);
+			}
+	}
+
+	qprintf("                                                          \r");
+	vprintf("Waterline roughing: %i levels, %i contours, %i of them not simplified\n", levels, contours, wl_unsimplified);
+	if (wl_dropped > 0)
+		printf("Warning: waterline roughing skipped %i contours that are not simple, the level below cuts those areas deeper than the depth of cut\n", wl_dropped);
+}
+
 
 static void process_vertical(class scene *scene, class endmill *mill, bool roughing)
 {
@@ -895,51 +1600,104 @@ static void process_vertical(class scene *scene, class endmill *mill, bool rough
 	first = true;
 }
 
-void process_stl_file(class scene *scene, const char *filename, int flip)
+/* without a cutout depth the model height comes from the depth, and there is no cutout */
+static bool check_model_depth(class scene *scene)
 {
-	bool omit_cutout = false;
-	bool even = true;
-
-	read_stl_file(filename, flip);
-	normalize_design_to_zero();
-
 	if (scene->get_cutout_depth() < 0.01) {
 		scene->set_cutout_depth(scene->get_depth());
 		printf("Warning: No depth set, using %5.2fmm for the model height\n", scene->get_cutout_depth());
-		omit_cutout = true;
+		return true;
 	}
+	return false;
+}
 
-	scale_design_Z(scene->get_cutout_depth(), scene->get_z_offset());
-	print_triangle_stats();
+/* runs all the tools over the loaded model, be it triangles or a heightmap */
+static void create_model_toolpaths(class scene *scene, bool omit_cutout)
+{
+	int count = scene->get_tool_count();
+	double margin = 0;
 
+	if (scene->want_rest_machining()) {
+		for (int i = 0; i < count; i++)
+			margin = fmax(margin, get_endmill(scene->get_tool_nr(i))->get_diameter());
+		rest_init(margin + 1);
+	}
+
+	/* rest machining needs the tools in the order they cut, otherwise the order does not matter */
+	for (int n = 0; n < count; n++) {
+		int i = scene->want_rest_machining() ? n : count - 1 - n;
+		bool roughing = i < count - 1;
+		/* raster directions alternate between the tools, finishing first */
+		bool even = ((count - 1 - i) + (roughing && scene->want_finishing_pass())) % 2 == 0;
 
-	for ( int i = scene->get_tool_count() - 1; i >= 0 ; i-- ) {
 		activate_tool(scene->get_tool_nr(i));
 
 		qprintf("Create toolpaths for tool %i \n", scene->get_tool_nr(i));
 
 		tooldepth = get_tool_maxdepth();
 
-		process_vertical(scene, get_endmill(scene->get_tool_nr(i)), i < (int)scene->get_tool_count() - 1);
+		rest_stamping = scene->want_rest_machining() && roughing;
+		rest_active = false;
+
+		if (scene->want_waterline() && roughing) {
+			create_waterline_roughing(scene, scene->get_tool_nr(i), !omit_cutout);
+			continue;
+		}
+
+		process_vertical(scene, get_endmill(scene->get_tool_nr(i)), roughing);
 
 		/* only for the first roughing tool do we need to honor the max tool depth */
 		if (i != 0) 
 			tooldepth = 5000;
 
-		create_toolpath(scene, scene->get_tool_nr(i), i < (int)scene->get_tool_count() - 1, !omit_cutout, even);
-
-		even = !even;
-		if (i == (int)scene->get_tool_count() - 1 && scene->want_finishing_pass()) {
-			create_toolpath(scene, scene->get_tool_nr(i), i < (int)scene->get_tool_count() - 1, !omit_cutout, even);
-
-			even = !even;
+		if (scene->want_rest_machining() && i > 0) {
+			rest_plan(get_endmill(scene->get_tool_nr(i)), roughing ? scene->get_stock_to_leave() : 0, scene->get_cutout_depth());
+			rest_active = true;
 		}
 
+		create_toolpath(scene, scene->get_tool_nr(i), roughing, !omit_cutout, even);
+
+		if (i == count - 1 && scene->want_finishing_pass())
+			create_toolpath(scene, scene->get_tool_nr(i), roughing, !omit_cutout, !even);
 	}
+	rest_stamping = false;
+	rest_active = false;
 	if (!omit_cutout) { 
 		activate_tool(scene->get_tool_nr(0));
 		create_cutout(scene, get_endmill(scene->get_tool_nr(0)));
 	}
 }
 
+void process_stl_file(class scene *scene, const char *filename, int flip)
+{
+	bool omit_cutout;
+
+	free_heightmap();
+	read_stl_file(filename, flip);
+	normalize_design_to_zero();
+
+	omit_cutout = check_model_depth(scene);
+
+	scale_design_Z(scene->get_cutout_depth(), scene->get_z_offset());
+	print_triangle_stats();
+
+	create_model_toolpaths(scene, omit_cutout);
+}
+
+/* a grayscale PNG relief, white is high, model_width is the X size in mm */
+void process_heightmap_file(class scene *scene, const char *filename, double model_width)
+{
+	bool omit_cutout;
+
+	if (read_heightmap_file(filename, model_width) < 0)
+		return;
+
+	omit_cutout = check_model_depth(scene);
+
+	scale_heightmap_Z(scene->get_cutout_depth(), scene->get_z_offset());
+
+	create_model_toolpaths(scene, omit_cutout);
+	free_heightmap();
+}
+
 
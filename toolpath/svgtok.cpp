@@ -0,0 +1,234 @@
+/*
+ * (C) Copyright 2019  -  Arjan van de Ven <arjanvandeven@gmail.com>
+ *
+ * This file is part of FenrusCNCtools
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "svgtok.h"
+
+bool svg_map_file(struct svg_map *map, const char *filename)
+{
+	struct stat st;
+	int fd;
+
+	map->data = NULL;
+	map->size = 0;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+	map->size = st.st_size;
+	if (map->size == 0) {
+		close(fd);
+		return true;
+	}
+
+#ifdef _WIN32
+	/* no mmap() on windows, just read the whole thing in */
+	char *buffer = (char *)malloc(map->size);
+	size_t done = 0;
+	while (buffer && done < map->size) {
+		ssize_t ret = read(fd, buffer + done, map->size - done);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	map->size = done;
+	map->data = buffer;
+#else
+	void *p = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		p = NULL;
+	else
+		madvise(p, map->size, MADV_SEQUENTIAL);
+	map->data = (const char *)p;
+#endif
+	close(fd);
+
+	if (!map->data) {
+		map->size = 0;
+		return false;
+	}
+	return true;
+}
+
+void svg_unmap_file(struct svg_map *map)
+{
+	if (map->data) {
+#ifdef _WIN32
+		free((void *)map->data);
+#else
+		munmap((void *)map->data, map->size);
+#endif
+	}
+	map->data = NULL;
+	map->size = 0;
+}
+
+void svg_reader_init(struct svg_reader *reader, const struct svg_map *map)
+{
+	reader->cursor = map->data;
+	reader->end = map->data + map->size;
+}
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char *skip_space(const char *c, const char *end)
+{
+	while (c < end && is_space(*c))
+		c++;
+	return c;
+}
+
+/* a '>' inside a quoted attribute value does not end the element */
+static const char *find_element_end(const char *c, const char *end)
+{
+	char quote = 0;
+
+	while (c < end) {
+		if (quote) {
+			if (*c == quote)
+				quote = 0;
+		} else if (*c == '"' || *c == '\'') {
+			quote = *c;
+		} else if (*c == '>') {
+			return c;
+		}
+		c++;
+	}
+	return NULL;
+}
+
+bool svg_next_element(struct svg_reader *reader, struct svg_element *element)
+{
+	const char *c = reader->cursor, *end = reader->end;
+
+	while (c < end) {
+		const char *close, *n;
+
+		c = (const char *)memchr(c, '<', end - c);
+		if (!c)
+			break;
+
+		if (end - c >= 4 && memcmp(c, "<!--", 4) == 0) {
+			const char *p = c + 4;
+
+			close = NULL;
+			while (p + 3 <= end) {
+				p = (const char *)memchr(p, '-', end - p);
+				if (!p || p + 3 > end)
+					break;
+				if (memcmp(p, "-->", 3) == 0) {
+					close = p + 2;
+					break;
+				}
+				p++;
+			}
+			if (!close)
+				break;
+			c = close + 1;
+			continue;
+		}
+
+		close = find_element_end(c + 1, end);
+		if (!close)
+			break;
+
+		element->text = c;
+		element->length = close - c + 1;
+		element->name = c + 1;
+		n = c + 1;
+		while (n < close && !is_space(*n) && *n != '>' && !(*n == '/' && n > c + 1))
+			n++;
+		element->name_length = n - element->name;
+
+		reader->cursor = close + 1;
+		return true;
+	}
+
+	reader->cursor = end;
+	return false;
+}
+
+bool svg_next_attribute(const struct svg_element *element, const char **cursor, struct svg_attribute *attr)
+{
+	const char *end = element->text + element->length - 1;
+	const char *c = *cursor;
+
+	if (!c)
+		c = element->name + element->name_length;
+
+	while (c < end) {
+		const char *n;
+
+		c = skip_space(c, end);
+		if (c >= end || *c == '/' || *c == '?')
+			break;
+
+		n = c;
+		while (c < end && *c != '=' && !is_space(*c) && *c != '/')
+			c++;
+		attr->name = n;
+		attr->name_length = c - n;
+		attr->value = c;
+		attr->value_length = 0;
+
+		c = skip_space(c, end);
+		if (c < end && *c == '=') {
+			c = skip_space(c + 1, end);
+			if (c < end && (*c == '"' || *c == '\'')) {
+				const char *q = (const char *)memchr(c + 1, *c, end - c - 1);
+
+				if (!q)
+					q = end;
+				attr->value = c + 1;
+				attr->value_length = q - c - 1;
+				c = q + 1;
+			} else {
+				/* unquoted, not valid XML but cheap to accept */
+				attr->value = c;
+				while (c < end && !is_space(*c))
+					c++;
+				attr->value_length = c - attr->value;
+			}
+		}
+		if (attr->name_length == 0) {
+			c++;
+			continue;
+		}
+		*cursor = c;
+		return true;
+	}
+	*cursor = end;
+	return false;
+}
+
+bool svg_find_attribute(const struct svg_element *element, const char *name, struct svg_attribute *attr)
+{
+	const char *cursor = NULL;
+	size_t len = strlen(name);
+
+	while (svg_next_attribute(element, &cursor, attr)) {
+		if (attr->name_length == len && memcmp(attr->name, name, len) == 0)
+			return true;
+	}
+	return false;
+}
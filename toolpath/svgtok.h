@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * Zero-copy SVG tag tokenizer.
+ *
+ * The input file is mmap()ed and walked once from start to end; every complete
+ * <...> element and every attribute in it comes back as a span pointing straight
+ * into the mapping, without copying or allocating. Comments are skipped, text
+ * between elements is ignored. The spans are NOT nul terminated.
+ */
+
+#include <stddef.h>
+
+struct svg_map {
+	const char *data;
+	size_t size;
+};
+
+struct svg_reader {
+	const char *cursor;
+	const char *end;
+};
+
+struct svg_element {
+	const char *text;		/* the '<' */
+	size_t length;			/* up to and including the '>' */
+	const char *name;		/* "path", "/g", "?xml", ... */
+	unsigned int name_length;
+};
+
+struct svg_attribute {
+	const char *name;
+	unsigned int name_length;
+	const char *value;		/* inside of the quotes */
+	size_t value_length;
+};
+
+extern bool svg_map_file(struct svg_map *map, const char *filename);
+extern void svg_unmap_file(struct svg_map *map);
+
+extern void svg_reader_init(struct svg_reader *reader, const struct svg_map *map);
+/* false at the end of the file; an unterminated element at the end is dropped */
+extern bool svg_next_element(struct svg_reader *reader, struct svg_element *element);
+
+/* start *cursor at NULL, returns false after the last attribute */
+extern bool svg_next_attribute(const struct svg_element *element, const char **cursor, struct svg_attribute *attr);
+extern bool svg_find_attribute(const struct svg_element *element, const char *name, struct svg_attribute *attr);
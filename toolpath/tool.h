@@ -9,6 +9,8 @@
 #define __INCLUDE_GUARD_TOOL_H_
 
 #include <vector>
+#include <map>
+#include <stdint.h>
 #include <boost/shared_ptr.hpp>
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Exact_predicates_exact_constructions_kernel.h>
@@ -20,11 +22,7 @@
 
 
 using namespace std;
-#ifndef FINE
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K ;
-#else
-typedef CGAL::Exact_predicates_exact_constructions_kernel K ;
-#endif
 typedef K::Point_2                   Point ;
 typedef CGAL::Polygon_2<K>           Polygon_2 ;
 typedef CGAL::Vector_2<K>            Vector_2 ;
@@ -37,6 +35,13 @@ typedef boost::shared_ptr<PolygonWithHoles> PolygonWithHolesPtr ;
 typedef std::vector<PolygonWithHolesPtr> PolygonWithHolesPtrVector;
 typedef CGAL::Polygon_with_holes_2<K> Polygon_with_holes ;
 
+/* the exact kernel, for the odd shape the fast one cannot offset */
+typedef CGAL::Exact_predicates_exact_constructions_kernel Kexact ;
+typedef CGAL::Polygon_2<Kexact> Polygon_2_exact ;
+typedef CGAL::Polygon_with_holes_2<Kexact> PolygonWithHoles_exact ;
+typedef CGAL::Straight_skeleton_2<Kexact> Ss_exact ;
+typedef boost::shared_ptr<Ss_exact> SsPtr_exact ;
+
 class inputshape;
 typedef class inputshape inputshape;
 
@@ -81,7 +86,6 @@ public:
     void add_polygon(Polygon_2 *poly);
     bool fits_inside(class toolpath *shape);
     double distance_from(double X, double Y);
-	int output_gcode_vcarve_would_retract(void);
 
 
     void print_as_svg(const char *color);
@@ -95,7 +99,18 @@ public:
 private:
     void output_gcode_slotting(void);
     void output_gcode_reverse(void);
-    void output_gcode_vcarve(void);
+};
+
+/*
+ * A single straight V-carve or raster move. Levels made of these (V-carving, STL
+ * rasters, cutouts) hold millions of them, so they are stored by value in one
+ * array per toollevel instead of as a toolpath with its own Polygon_2 each.
+ */
+struct vsegment {
+    double X1, Y1, X2, Y2;
+    double depth, depth2;
+    double priority;
+    const char *color;
 };
 
 class toollevel {
@@ -126,8 +141,9 @@ public:
     double minY;
     
     void add_poly(Polygon_2 *poly, bool is_hole);
-    void add_poly_vcarve(Polygon_2 *poly, double depth1, double depth2, double prio = 0.0, const char *color = NULL);
+    void add_vcarve_segment(double X1, double Y1, double X2, double Y2, double depth1, double depth2, double prio = 0.0, const char *color = NULL);
     vector<class toolpath*> toolpaths;
+    vector<struct vsegment> segments;
 
 	void consolidate(void);
 	void consolidate_quick(void);
@@ -153,6 +169,9 @@ public:
     void output_gcode(void);
     
     void sort_if_slotting(void);
+private:
+    void output_segment(const struct vsegment *s);
+    int segment_would_retract(const struct vsegment *s);
 };
 
 class tooldepth {
@@ -187,12 +206,19 @@ public:
     void sort_if_slotting(void);
 };
 
+/* a corner of a shape or one of its holes that is sharper than 160 degrees */
+struct vcarve_corner {
+    double X, Y;
+};
+
 class inputshape {
 public:
     inputshape() {
         level = 0;
         polyhole = NULL;
         iss = NULL;
+        exact_iss = NULL;
+        ss_cache = NULL;
         name = "unknown";
         minY = 0;
 		is_cutout = false;
@@ -200,6 +226,8 @@ public:
 		stock_to_leave = 0.1;
 		cutout_offset = 0.0;
 		depth = 0.0;
+		area = 0.0;
+		bbX1 = bbY1 = bbX2 = bbY2 = 0.0;
     }
     void set_level(int _level);
     void add_child(class inputshape *child);
@@ -207,6 +235,7 @@ public:
     void update_stats(void);
     void add_point(double X, double Y);
     void close_shape(void);
+    void simplify(double tolerance);
 
     void fix_orientation(void);
     void print_as_svg(void);
@@ -216,7 +245,7 @@ public:
 
 
     void create_toolpaths(int toolnr, double depth, int finish_pass, int is_optional, double start_inset, double end_inset, bool _want_skeleton_path);
-    void create_toolpaths_vcarve(int toolnr, double maxdepth, double stock_to_leave);
+    void create_toolpaths_vcarve(int toolnr, double maxdepth, double stock_to_leave, vector<struct vcarve_job> &jobs);
     void create_toolpaths_cutout(int toolnr, double depth, bool finish_pass);
     void create_toolpaths_inlayplug(int toolnr, double maxdepth);
     void consolidate_toolpaths(bool _want_inbetween_paths);
@@ -259,6 +288,9 @@ private:
     PolygonWithHoles *polyhole;
     vector<SsPtr>	skeleton;
     SsPtr iss;
+    SsPtr_exact exact_iss;
+    struct skeleton_cache *ss_cache;
+    vector<struct vcarve_corner> vcarve_corners;
     
     
     double bbX1, bbY1, bbX2, bbY2;
@@ -268,7 +300,72 @@ private:
 	double stock_to_leave;
 	double depth;
 };
-    
+
+/*
+ * One skeleton halfedge to V-carve. Working out the depths along it only reads the
+ * scene, so the jobs of all shapes run on a thread pool; what each one wants added to
+ * its toollevel is buffered and added afterwards in job order, so the output does not
+ * depend on the threads.
+ */
+struct vcarve_job {
+    class toollevel *tool;
+    class scene *parent;
+    class endmill *mill;
+    /* plain double copy of the shape corners, the workers never touch shape->poly */
+    const vector<struct vcarve_corner> *corners;
+    double X1, Y1, X2, Y2;
+    bool is_inner_bisector, is_bisector;
+    double maxdepth, z_offset;
+
+    /* what carving does to tool->diameter: set it to diameter, or else widen it to that */
+    bool diameter_set;
+    double diameter;
+    vector<struct vsegment> segments;
+};
+
+extern void run_vcarve_jobs(vector<struct vcarve_job> &jobs);
+extern void print_skeleton_stats(void);
+extern bool rings_cross(vector<Polygon_2 *> &rings, vector<unsigned int> &group, vector<bool> *crossing = NULL);
+extern void simplify_shapes(vector<class inputshape *> &shapes, class inputshape *cutout, double tolerance);
+extern void print_simplify_stats(double tolerance);
+
+/*
+ * On disk cache of what the straight skeleton of a shape gets used for: its halfedges
+ * (for V-carving and the SVG view) and the offset polygons per inset, up to
+ * CACHE_MAX_OFFSETS of them. An entry is keyed by a hash of the polygon with holes
+ * and the kernel, see sscache.cpp.
+ * All functions accept a NULL cache, which is what skeleton_cache_open() gives when
+ * no cache directory is set.
+ */
+struct skeleton_edge {
+    double X1, Y1, X2, Y2;
+    bool is_inner_bisector, is_bisector;
+};
+
+struct skeleton_offset {
+    PolygonWithHolesPtrVector polys;
+    /* asked for or added in this run, these win when the file is over its limit */
+    bool used;
+};
+
+struct skeleton_cache {
+    uint64_t hash;
+    bool dirty;
+    /* false once written out; the contents get read back from the file when needed again */
+    bool loaded;
+    bool have_edges;
+    vector<struct skeleton_edge> edges;
+    std::map<double, struct skeleton_offset> offsets;
+};
+
+extern void set_skeleton_cache_dir(const char *dir);
+extern struct skeleton_cache *skeleton_cache_open(const PolygonWithHoles &ph);
+extern bool skeleton_cache_get_offset(struct skeleton_cache *cache, double offset, PolygonWithHolesPtrVector *result);
+extern void skeleton_cache_put_offset(struct skeleton_cache *cache, double offset, const PolygonWithHolesPtrVector &result);
+extern bool skeleton_cache_get_edges(struct skeleton_cache *cache, vector<struct skeleton_edge> *edges);
+extern void skeleton_cache_put_edges(struct skeleton_cache *cache, const vector<struct skeleton_edge> &edges);
+extern void write_skeleton_caches(void);
+extern void print_skeleton_cache_stats(void);
 
 
 #include "scene.h"
@@ -276,5 +373,6 @@ private:
 extern void parse_svg_file(class scene * scene, const char *filename);
 extern void parse_csv_file(class scene *scene, const char *filename, int toolnr);
 extern void process_stl_file(class scene *scene, const char *filename, int flip);
+extern void process_heightmap_file(class scene *scene, const char *filename, double model_width);
 
 #endif
\ No newline at end of file
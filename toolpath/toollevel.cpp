@@ -24,6 +24,12 @@ void toollevel::print_as_svg(void)
     for (auto i : toolpaths) {
         i->print_as_svg(color);
     }
+    for (auto &s : segments) {
+        const char *c = s.color ? s.color : "purple";
+        svg_line(s.X1, s.Y1, s.X2, s.Y2, c, 0.5);
+        svg_circle(s.X1, s.Y1, 0.25, c, 0);
+        svg_circle(s.X2, s.Y2, 0.25, c, 0);
+    }
 }
 
 
@@ -45,66 +51,43 @@ static bool compare_path(class toolpath *A, class toolpath *B)
     return (A->distance_from(sortX, sortY) < B->distance_from(sortX, sortY));
 }
 
-static class toolpath *clone_tp(class toolpath *tp1)
+/* the merged segment keeps the depths of the first one, like a cloned toolpath would */
+static bool merged(const struct vsegment *tp1, struct vsegment *out, double X1, double Y1, double X2, double Y2)
 {
-	class toolpath *newtp;
-	newtp = new(class toolpath);
-	newtp->level = tp1->level;
-	newtp->minY = tp1->minY;
-	newtp->is_optional = tp1->is_optional;
-	newtp->is_hole = tp1->is_hole;
-	newtp->is_slotting = tp1->is_slotting;
-	newtp->is_single = tp1->is_single;
-	newtp->is_vcarve = tp1->is_vcarve;
-	newtp->run_reverse = tp1->run_reverse;
-	newtp->diameter = tp1->diameter;
-	newtp->depth = tp1->depth;
-	newtp->depth2 = tp1->depth2;
-	newtp->toolnr = tp1->toolnr;
-	return newtp;
+	out->X1 = X1;
+	out->Y1 = Y1;
+	out->X2 = X2;
+	out->Y2 = Y2;
+	out->depth = tp1->depth;
+	out->depth2 = tp1->depth2;
+	out->priority = 0.0;
+	out->color = NULL;
+	return true;
 }
 
-static class toolpath *can_merge(class toolpath *tp1, class toolpath *tp2)
+static bool can_merge(const struct vsegment *tp1, const struct vsegment *tp2, struct vsegment *out)
 {
-	double X1 = 0, Y1 = 0, X2 = 0, Y2 = 0;
-	double X3 = 0, Y3 = 0, X4 = 0, Y4 = 0;
+	double X1, Y1, X2, Y2;
+	double X3, Y3, X4, Y4;
 	double x2,y2,x4,y4;
 	double ox2, oy2, ox4, oy4;
 	double len;
 
 	if (!approx4(tp1->depth,tp2->depth)) 
-		return NULL;
+		return false;
 	if (!approx4(tp1->depth2, tp2->depth2)) 
-		return NULL;
+		return false;
 	if (!approx4(tp1->depth, tp1->depth2))
-		return NULL;
-	if (tp1->polygons.size() > 1)
-		return NULL;
-	if (tp2->polygons.size() > 1)
-		return NULL;
-	if (!tp1->is_single)
-		return NULL;
-	if (!tp2->is_single)
-		return NULL;
-	if (!tp1->is_vcarve)
-		return NULL;
-	if (!tp2->is_vcarve)
-		return NULL;
-	if (tp1->toolnr != tp2->toolnr)
-		return NULL;
-
-	for (auto p : tp1->polygons) {
-			X1 = CGAL::to_double((*p)[0].x());
-			Y1 = CGAL::to_double((*p)[0].y());
-			X2 = CGAL::to_double((*p)[1].x());
-			Y2 = CGAL::to_double((*p)[1].y());
-	}
-	for (auto p : tp2->polygons) {
-			X3 = CGAL::to_double((*p)[0].x());
-			Y3 = CGAL::to_double((*p)[0].y());
-			X4 = CGAL::to_double((*p)[1].x());
-			Y4 = CGAL::to_double((*p)[1].y());
-	}
+		return false;
+
+	X1 = tp1->X1;
+	Y1 = tp1->Y1;
+	X2 = tp1->X2;
+	Y2 = tp1->Y2;
+	X3 = tp2->X1;
+	Y3 = tp2->Y1;
+	X4 = tp2->X2;
+	Y4 = tp2->Y2;
 
 	x2 = X2 - X1;
 	y2 = Y2 - Y1;
@@ -122,169 +105,93 @@ static class toolpath *can_merge(class toolpath *tp1, class toolpath *tp2)
 	if ((approx3(ox2, ox4) && approx3(oy2, oy4)) || (len <= 0.00001)) {
 		/* same start point same unit vector -> pick the longest*/
 		if (approx4(X1,X3) && approx4(Y1,Y3)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X3, Y3));
-			    p->push_back(Point(X4, Y4));
-			}
-			newtp->add_polygon(p);
-			return newtp;
+			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X3, Y3, X4, Y4);
 		}
 
 		/* consecutive paths */
-		if (approx4(X1,X4) && approx4(Y1,Y4)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			p->push_back(Point(X2, Y2));
-		    p->push_back(Point(X3, Y3));
-			newtp->add_polygon(p);
-			return newtp;
-		}
+		if (approx4(X1,X4) && approx4(Y1,Y4))
+			return merged(tp1, out, X2, Y2, X3, Y3);
 
 
 		/* consecutive paths */
-		if (approx4(X2,X3) && approx4(Y2,Y3)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			p->push_back(Point(X1, Y1));
-		    p->push_back(Point(X4, Y4));
-			newtp->add_polygon(p);
-			return newtp;
-		}
+		if (approx4(X2,X3) && approx4(Y2,Y3))
+			return merged(tp1, out, X1, Y1, X4, Y4);
 
 		/* same end point same unit vector */
 		if (approx4(X2,X4) && approx4(Y2,Y4)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X3, Y3));
-			    p->push_back(Point(X4, Y4));
-			}
-			newtp->add_polygon(p);
-			return newtp;
+			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X3, Y3, X4, Y4);
 		}
 
 		/* if X3,Y3 is a point on the first vector and same unit vector ... */
 		if (distance_point_from_vector(X1,Y1,X2,Y2,X3,Y3) < 0.0000001) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X1,Y1,X4,Y4)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X4, Y4));
-			}
-			newtp->add_polygon(p);
-			return newtp;			
+			if (dist(X1,Y1,X2,Y2) > dist(X1,Y1,X4,Y4))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X1, Y1, X4, Y4);
 		}
 	}
 
 	if ( (approx3(ox2, -ox4) && approx3(oy2, -oy4)) || (len <= 0.0001)) {
-		if (approx4(X1,X3) && approx4(Y1,Y3)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			p->push_back(Point(X2, Y2));
-			p->push_back(Point(X4, Y4));
-			newtp->add_polygon(p);
-			return newtp;
-		}
+		if (approx4(X1,X3) && approx4(Y1,Y3))
+			return merged(tp1, out, X2, Y2, X4, Y4);
 
 		if (approx4(X1,X4) && approx4(Y1,Y4)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X3, Y3));
-			    p->push_back(Point(X4, Y4));
-			}
-			newtp->add_polygon(p);
-			return newtp;
+			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X3, Y3, X4, Y4);
 		}
 
 		if (approx4(X2,X3) && approx4(Y2,Y3)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X3, Y3));
-			    p->push_back(Point(X4, Y4));
-			}
-			newtp->add_polygon(p);
-			return newtp;
+			if (dist(X1,Y1,X2,Y2) > dist(X3,Y3,X4,Y4))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X3, Y3, X4, Y4);
 		}
 
 		/* same end point opposing unit vector */
-		if (approx4(X2,X4) && approx4(Y2,Y4)) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			p->push_back(Point(X1, Y1));
-		    p->push_back(Point(X3, Y3));
-			newtp->add_polygon(p);
-			return newtp;
-		}
+		if (approx4(X2,X4) && approx4(Y2,Y4))
+			return merged(tp1, out, X1, Y1, X3, Y3);
 
 #if 1
 		/* if X4,Y4 is a point on the first vector and same unit vector ... */
 		if (distance_point_from_vector(X1,Y1,X2,Y2,X4,Y4) < 0.0000001) {
-			class toolpath *newtp = clone_tp(tp1);
-			Polygon_2 *p = new(Polygon_2);
-			if (dist(X1,Y1,X2,Y2) > dist(X1,Y1,X3,Y3)) {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X2, Y2));
-			} else {
-				p->push_back(Point(X1, Y1));
-			    p->push_back(Point(X3, Y3));
-			}
-			newtp->add_polygon(p);
-			return newtp;			
+			if (dist(X1,Y1,X2,Y2) > dist(X1,Y1,X3,Y3))
+				return merged(tp1, out, X1, Y1, X2, Y2);
+			return merged(tp1, out, X1, Y1, X3, Y3);
 		}
 #endif
 	}
 
 
-	return NULL;
+	return false;
 }
 
 
 void toollevel::consolidate_quick(void)
 {
 	unsigned int i;
-	class toolpath *tp;
+	struct vsegment tp;
 
-	if (toolpaths.size() < 5)
+	if (segments.size() < 5)
 		return; /* nothing to consolidate */
 
 	/* first, we do +1 and +2 as that's a common case */
 
-	for (i = toolpaths.size() - 4; i < toolpaths.size() - 2; i++) {
-		tp = can_merge(toolpaths[i], toolpaths[i + 1]);
-		if (tp) {
-			toolpaths[i] = tp;
-			toolpaths.erase(toolpaths.begin() + i + 1);
+	for (i = segments.size() - 4; i < segments.size() - 2; i++) {
+		if (can_merge(&segments[i], &segments[i + 1], &tp)) {
+			segments[i] = tp;
+			segments.erase(segments.begin() + i + 1);
 			if (i >= 2)
 				i -= 2;	
-//			vprintf("Can merge %i, %i \n", i, i+1);
 			continue;
 		}
-		tp = can_merge(toolpaths[i], toolpaths[i + 2]);
-		if (tp) {
-			toolpaths[i] = tp;
-			toolpaths.erase(toolpaths.begin() + i + 2);
+		if (can_merge(&segments[i], &segments[i + 2], &tp)) {
+			segments[i] = tp;
+			segments.erase(segments.begin() + i + 2);
 			if (i >= 2)
 				i -= 2;	
-//			vprintf("Can merge2 %i, %i \n", i, i+2);
 			continue;
 		}
 	}
@@ -292,31 +199,28 @@ void toollevel::consolidate_quick(void)
 
 void toollevel::consolidate(void)
 {
+	profile_scope profile(PROFILE_CONSOLIDATE);
 	unsigned int i, j;
-	class toolpath *tp;
+	struct vsegment tp;
 
-	if (toolpaths.size() < 2)
+	if (segments.size() < 2)
 		return; /* nothing to consolidate */
 
 	/* first, we do +1 and +2 as that's a common case */
 
-	for (i = 0; i < toolpaths.size() - 2; i++) {
-		tp = can_merge(toolpaths[i], toolpaths[i + 1]);
-		if (tp) {
-			toolpaths[i] = tp;
-			toolpaths.erase(toolpaths.begin() + i + 1);
+	for (i = 0; i < segments.size() - 2; i++) {
+		if (can_merge(&segments[i], &segments[i + 1], &tp)) {
+			segments[i] = tp;
+			segments.erase(segments.begin() + i + 1);
 			if (i >= 2)
 				i -= 2;	
-//			vprintf("Can merge %i, %i \n", i, i+1);
 			continue;
 		}
-		tp = can_merge(toolpaths[i], toolpaths[i + 2]);
-		if (tp) {
-			toolpaths[i] = tp;
-			toolpaths.erase(toolpaths.begin() + i + 2);
+		if (can_merge(&segments[i], &segments[i + 2], &tp)) {
+			segments[i] = tp;
+			segments.erase(segments.begin() + i + 2);
 			if (i >= 2)
 				i -= 2;	
-//			vprintf("Can merge2 %i, %i \n", i, i+2);
 			continue;
 		}
 	}
@@ -325,15 +229,13 @@ void toollevel::consolidate(void)
 		return;
 	/* now the O(N^2) part */
 
-	for (i = 0; i < toolpaths.size(); i++) {
-	  for (j = 0; j < toolpaths.size(); j++) {
+	for (i = 0; i < segments.size(); i++) {
+	  for (j = 0; j < segments.size(); j++) {
 		if (i == j)
 			continue;
-		tp = can_merge(toolpaths[i], toolpaths[j]);
-		if (tp && i != j) {
-			toolpaths[i] = tp;
-			toolpaths.erase(toolpaths.begin() + j);
-//			vprintf("Can merge square %i, %i \n", i, j);
+		if (can_merge(&segments[i], &segments[j], &tp)) {
+			segments[i] = tp;
+			segments.erase(segments.begin() + j);
 			if (i >= 2)
 				i -= 2;	
 			if (j >= 2)
@@ -347,62 +249,141 @@ void toollevel::consolidate(void)
 
 void toollevel::trim_intersects(void)
 {
+	profile_scope profile(PROFILE_TRIM_INTERSECTS);
 	unsigned int i, j;
 
-	if (toolpaths.size() < 2)
+	if (segments.size() < 2)
 		return; /* nothing to intersect */
 
-	if (!toolpaths[0]->is_vcarve)
-		return;
-
-	for (i = 0; i < toolpaths.size(); i++) {
+	for (i = 0; i < segments.size(); i++) {
 		int count = 0;
 		double min_l = 1.0;
 		double max_l = 0;
 
 		double X1, Y1, X2, Y2;
 
-		for (auto p : toolpaths[i]->polygons) {
-				X1 = CGAL::to_double((*p)[0].x());
-				Y1 = CGAL::to_double((*p)[0].y());
-				X2 = CGAL::to_double((*p)[1].x());
-				Y2 = CGAL::to_double((*p)[1].y());
-		}
-		for (j = 0; j < toolpaths.size(); j++) {
+		X1 = segments[i].X1;
+		Y1 = segments[i].Y1;
+		X2 = segments[i].X2;
+		Y2 = segments[i].Y2;
+		for (j = 0; j < segments.size(); j++) {
 			double this_l;
-			double X3 = 0,Y3 = 0,X4 = 0,Y4 = 0;
 			if (i == j)
 				continue;
 
-			for (auto p : toolpaths[j]->polygons) {
-				X3 = CGAL::to_double((*p)[0].x());
-				Y3 = CGAL::to_double((*p)[0].y());
-				X4 = CGAL::to_double((*p)[1].x());
-				Y4 = CGAL::to_double((*p)[1].y());
-			}
-			if (vector_intersects_vector_l(X1,Y1,X2,Y2,X3,Y3,X4,Y4, &this_l)) {
+			if (vector_intersects_vector_l(X1,Y1,X2,Y2, segments[j].X1, segments[j].Y1, segments[j].X2, segments[j].Y2, &this_l)) {
 				count++;
 				min_l = fmin(min_l, this_l);
 				max_l = fmax(max_l, this_l);
-//				printf("Intersect %i with l %5.3f  (%5.4f - %5.4f)\n", count, this_l, min_l, max_l);
 			}
 		}
 		if (count >= 2 && max_l >= 0.90 && min_l < 0.10) {
-			class toolpath *newtp = clone_tp(toolpaths[i]);
-			Polygon_2 *p = new(Polygon_2);
 			vector_apply_l(&X1,&Y1, &X2, &Y2, min_l, max_l);
-			p->push_back(Point(X1, Y1));
-		    p->push_back(Point(X2, Y2));
-			newtp->add_polygon(p);
-			toolpaths[i] = newtp;
-//			printf("Reducing toolpath %i due to %i intersects   (%5.2f - %5.2f)\n", i, count, min_l, max_l);
+			merged(&segments[i], &segments[i], X1, Y1, X2, Y2);
 		}
 	}
 }
 
+static double segment_distance_from(const struct vsegment *s, double X, double Y)
+{
+	return fmin(dist(X, Y, s->X1, s->Y1), dist(X, Y, s->X2, s->Y2));
+}
+
+static bool compare_segment(const struct vsegment *A, const struct vsegment *B)
+{
+	double dA = segment_distance_from(A, sortX, sortY);
+	double dB = segment_distance_from(B, sortX, sortY);
+
+	if (dA > 0.1 && dB > 0.1) {
+		if (fabs(A->depth - B->depth) > 0.1) {
+			if (A->depth > B->depth)
+				return true;
+			if (A->depth < B->depth)
+				return false;
+		}
+	}
+	if (A->priority < B->priority)
+		return true;
+	if (A->priority > B->priority)
+		return false;
+    return dA < dB;
+}
+
+/* cut one segment, from whichever end continues the current position */
+void toollevel::output_segment(const struct vsegment *s)
+{
+  double speed = 1.0;
+  double X1 = s->X1, Y1 = s->Y1 - minY, X2 = s->X2, Y2 = s->Y2 - minY;
+  double d0, d1;
+
+  d0 = dist(gcode_current_X(), gcode_current_Y(), X1, Y1);
+  d1 = dist(gcode_current_X(), gcode_current_Y(), X2, Y2);
+
+  if (gcode_has_current() && d0 < 0.001) {
+    gcode_vconditional_travel_to(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+    gcode_vmill_to(X2, Y2, s->depth2, speed);
+    return;
+  }
+  if (gcode_has_current() && d1 < 0.001) {
+    gcode_vconditional_travel_to(X2, Y2, s->depth2, speed, X1, Y1, s->depth);
+    gcode_vmill_to(X1, Y1, s->depth, speed);
+    return;
+  }
+  if (s->depth > s->depth2) {
+    gcode_vconditional_travel_to(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+    gcode_vmill_to(X2, Y2, s->depth2, speed);
+    return;
+  }
+  if (gcode_has_current() && d0 > d1) {
+    gcode_vconditional_travel_to(X2, Y2, s->depth2, speed, X1, Y1, s->depth);
+    gcode_vmill_to(X1, Y1, s->depth, speed);
+    return;
+  }
+
+  gcode_vconditional_travel_to(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+  gcode_vmill_to(X2, Y2, s->depth2, speed);
+}
+
+int toollevel::segment_would_retract(const struct vsegment *s)
+{
+  double speed = 1.0;
+  double X1 = s->X1, Y1 = s->Y1 - minY, X2 = s->X2, Y2 = s->Y2 - minY;
+  double d0, d1;
+
+  d0 = dist(gcode_current_X(), gcode_current_Y(), X1, Y1);
+  d1 = dist(gcode_current_X(), gcode_current_Y(), X2, Y2);
+
+  if (d0 < 0.001)
+    return gcode_vconditional_would_retract(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+  if (d1 < 0.001)
+    return gcode_vconditional_would_retract(X2, Y2, s->depth2, speed, X1, Y1, s->depth);
+  if (s->depth > s->depth2)
+    return gcode_vconditional_would_retract(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+  if (d0 > d1)
+    return gcode_vconditional_would_retract(X2, Y2, s->depth2, speed, X1, Y1, s->depth);
+  return gcode_vconditional_would_retract(X1, Y1, s->depth, speed, X2, Y2, s->depth2);
+}
+
+/* nearest first from sortX/sortY; these sorts run once per emitted path, so they get profiled */
+static void sort_worklist(vector<class toolpath*> &worklist)
+{
+	profile_scope profile(PROFILE_SORT);
+
+	sort(worklist.begin(), worklist.end(), compare_path);
+}
+
+static void sort_segwork(vector<struct vsegment*> &segwork)
+{
+	profile_scope profile(PROFILE_SORT);
+
+	sort(segwork.begin(), segwork.end(), compare_segment);
+}
+
 void toollevel::output_gcode(void)
 {
+    profile_scope profile(PROFILE_EMIT);
     vector<class toolpath*> worklist;    
+    vector<struct vsegment*> segwork;
 
 	if (no_sort) {
 		if (name)
@@ -413,13 +394,13 @@ void toollevel::output_gcode(void)
 
 		for (i = 0; i < toolpaths.size(); i++)
 			toolpaths[i]->output_gcode();
+		for (i = 0; i < segments.size(); i++)
+			output_segment(&segments[i]);
 		return;
     }
 
 
-//	vprintf("Work size before consolidate  %i\n", (int)toolpaths.size());
 	consolidate();
-//	vprintf("Work size before trim_intersect  %i\n", (int)toolpaths.size());
 #if 1
 	if (!no_sort) {
 		trim_intersects(); /* This is unproven correct so far */
@@ -428,56 +409,50 @@ void toollevel::output_gcode(void)
 	}
 #endif
 
-
-//	vprintf("Work size after trim_intersect  %i\n", (int)toolpaths.size());
     worklist = toolpaths;
+	for (auto &s : segments)
+		segwork.push_back(&s);
 
-#if 0
-	for (unsigned int i = 0; i < worklist.size(); i++) {
-		class toolpath *tp = worklist[i];
-		for (auto p : tp->polygons) {
-			double x1,y1,x2,y2;
-			double ox, oy, len;
-			x1 = CGAL::to_double((*p)[0].x());
-			y1 = CGAL::to_double((*p)[0].y());
-			x2 = CGAL::to_double((*p)[1].x());
-			y2 = CGAL::to_double((*p)[1].y());
-			ox = x2-x1;
-			oy = y2-y1;
-			len = sqrt(ox*ox + oy*oy);
-			ox = ox / len;
-			oy = oy / len;
-			printf("%4i: %5.4f,%5.4f --> %5.4f, %5.4f     uv %5.8f,%5.8f  length %5.4f\n", i, x1, y1, x2, y2, ox, oy, len);
-		}
-    }
-#endif
 	if (name)
 	    gcode_write_comment(name);
     sortX = gcode_current_X();
     sortY = gcode_current_Y() + get_minY();
         
 	if (!no_sort)
-	    sort(worklist.begin(), worklist.end(), compare_path);
+	    sort_worklist(worklist);
     
     while (worklist.size() > 0) {
+		worklist[0]->output_gcode();
+        worklist.erase(worklist.begin());
+        sortX = gcode_current_X();
+        sortY = gcode_current_Y() + get_minY();
+        
+		if (!no_sort)
+    	    sort_worklist(worklist);
+    }
+
+	if (!no_sort)
+	    sort_segwork(segwork);
+
+    while (segwork.size() > 0) {
 		bool zero_retracts;
 
-		zero_retracts = worklist[0]->output_gcode_vcarve_would_retract();
-		if (!no_sort && worklist.size() > 1 && zero_retracts && !worklist[1]->output_gcode_vcarve_would_retract()) {
-			worklist[1]->output_gcode();
-	        worklist.erase(worklist.begin() + 1);
-		} if (!no_sort && worklist.size() > 2 && zero_retracts && !worklist[2]->output_gcode_vcarve_would_retract()) {
-			worklist[2]->output_gcode();
-	        worklist.erase(worklist.begin() + 2);
+		zero_retracts = segment_would_retract(segwork[0]);
+		if (!no_sort && segwork.size() > 1 && zero_retracts && !segment_would_retract(segwork[1])) {
+			output_segment(segwork[1]);
+	        segwork.erase(segwork.begin() + 1);
+		} if (!no_sort && segwork.size() > 2 && zero_retracts && !segment_would_retract(segwork[2])) {
+			output_segment(segwork[2]);
+	        segwork.erase(segwork.begin() + 2);
 		} else {
-			worklist[0]->output_gcode();
-	        worklist.erase(worklist.begin());
+			output_segment(segwork[0]);
+	        segwork.erase(segwork.begin());
 		}
 	        sortX = gcode_current_X();
 	        sortY = gcode_current_Y() + get_minY();
         
 		if (!no_sort)
-    	    sort(worklist.begin(), worklist.end(), compare_path);
+    	    sort_segwork(segwork);
     }
 }
 
@@ -525,40 +500,30 @@ void toollevel::add_poly(Polygon_2 *poly, bool is_hole)
     toolpaths.push_back(tp);    
 }
 
-void toollevel::add_poly_vcarve(Polygon_2 *poly, double depth1, double depth2, double prio, const char *color)
+void toollevel::add_vcarve_segment(double X1, double Y1, double X2, double Y2, double depth1, double depth2, double prio, const char *color)
 {
+    struct vsegment s;
+
     /* check if the same path is already there if we're slotting */
 #if 1
 	if (!no_sort) {
-		for (auto tp : toolpaths) {
-			if (tp->polygons.size() > 1) {
-				continue;
-			}
-            Polygon_2 *p2;
-            p2 = tp->polygons[0];
-            if ( (*p2)[0].x() == (*poly)[0].x() && (*p2)[0].y() == (*poly)[0].y() &&
-                (*p2)[1].x() == (*poly)[1].x() && (*p2)[1].y() == (*poly)[1].y())
+		for (auto &s2 : segments) {
+            if (s2.X1 == X1 && s2.Y1 == Y1 && s2.X2 == X2 && s2.Y2 == Y2)
                     return;
-            if ( (*p2)[0].x() == (*poly)[1].x() && (*p2)[0].y() == (*poly)[1].y() &&
-                (*p2)[1].x() == (*poly)[0].x() && (*p2)[1].y() == (*poly)[0].y())
+            if (s2.X1 == X2 && s2.Y1 == Y2 && s2.X2 == X1 && s2.Y2 == Y1)
                     return;
 	    }
 	}
 #endif
-    class toolpath *tp;
-    tp = new(class toolpath);
-    tp->add_polygon(poly);
-    tp->depth = depth1;
-    tp->depth2 = depth2;
-    tp->recalculate();
-    tp->toolnr = toolnr;
-    tp->is_vcarve = true;
-    tp->minY = minY;
-    tp->diameter = diameter;
-    tp->is_single = true;
-	tp->color = color;
-	tp->priority = prio;
-    toolpaths.push_back(tp);    
+    s.X1 = X1;
+    s.Y1 = Y1;
+    s.X2 = X2;
+    s.Y2 = Y2;
+    s.depth = depth1;
+    s.depth2 = depth2;
+    s.color = color;
+    s.priority = prio;
+    segments.push_back(s);
 	consolidate_quick();
 }
 
@@ -50,10 +50,6 @@ void toolpath::output_gcode(void)
   double lX = -100000;
   double lY = -100000;
   
-  if (is_vcarve) {
-    output_gcode_vcarve();
-    return;
-  }
   if (is_slotting) {
     output_gcode_slotting();
     return;
@@ -110,85 +106,6 @@ void toolpath::output_gcode(void)
 }
 
 
-void toolpath::output_gcode_vcarve(void)
-{
-  double speed = 1.0;
-    
-  for (auto poly : polygons) {
-    double d0, d1;
-    d0 = dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY());
-    d1 = dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY());
-//    printf("current X %5.4f   current Y %5.4f  \n", gcode_current_X(), gcode_current_Y());
-//    printf("poly[0]   %5.4f,            %5.4f  \n", (*poly)[0].x(), (*poly)[0].y());
-//    printf("poly[1]   %5.4f,            %5.4f  \n", (*poly)[1].x(), (*poly)[1].y());
-//    printf("get_minY  %5.9f\n", get_minY());
-    if (gcode_has_current() && dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY()) < 0.001) {
-      gcode_vconditional_travel_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-      gcode_vmill_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed);
-      continue;
-    }
-    if (gcode_has_current() && dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY()) < 0.001) {
-      gcode_vconditional_travel_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed, CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth);
-      gcode_vmill_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed);
-      continue;
-    }
-    if (depth > depth2) {
-      gcode_vconditional_travel_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-      gcode_vmill_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed);
-      continue;
-    }
-    if (gcode_has_current() && d0 > d1) {
-      gcode_vconditional_travel_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed, CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth);
-      gcode_vmill_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed);
-      continue;
-    }    
-
-#if 0
-    if (depth < depth2) {
-      gcode_vconditional_travel_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed, CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth);
-      gcode_vmill_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed);
-      continue;
-    }
-#endif
-  
-    
-//    printf("fallback\n");
-    gcode_vconditional_travel_to(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-    gcode_vmill_to(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed);
-    speed = 1.0;
-  }
-}
-
-int toolpath::output_gcode_vcarve_would_retract(void)
-{
-  double speed = 1.0;
-
-  if (!is_vcarve)
-		return 0;
-    
-  for (auto poly : polygons) {
-    double d0, d1;
-    d0 = dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY());
-    d1 = dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY());
-
-    if (dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY()) < 0.001) {
-      return gcode_vconditional_would_retract(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-    }
-    if (dist(gcode_current_X(), gcode_current_Y(), CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY()) < 0.001) {
-      return gcode_vconditional_would_retract(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed, CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth);
-    }
-    if (depth > depth2) {
-      return gcode_vconditional_would_retract(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-    }
-    
-    if (d0 > d1) {
-      return gcode_vconditional_would_retract(CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2, speed, CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth);
-    }    
-    return gcode_vconditional_would_retract(CGAL::to_double((*poly)[0].x()), CGAL::to_double((*poly)[0].y()) - get_minY(), depth, speed, CGAL::to_double((*poly)[1].x()), CGAL::to_double((*poly)[1].y()) - get_minY(), depth2);
-  }
-  return 0;
-}
-
 void toolpath::output_gcode_reverse(void)
 {
   double speed = 1.0;
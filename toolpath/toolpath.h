@@ -84,6 +84,7 @@ extern void gcode_reset_current(void);
 extern void gcode_set_roughing(int value);
 extern void gcode_want_separate_files(void);
 extern void gcode_want_adaptive(void);
+extern void gcode_want_low_retract(double clearance_mm);
 
 static inline double px_to_inch(double px) { return px / 96.0; };
 static inline double px_to_mm(double px) { return 25.4 * px / 96.0; };
@@ -98,6 +99,44 @@ static inline double depth_to_radius(double d, double angle) { return fabs(d) *
 extern int verbose;
 extern int quiet;
 
+/* --profile instrumentation, see profile.cpp */
+enum profile_routine {
+    PROFILE_SKELETON,
+    PROFILE_OFFSET,
+    PROFILE_CONSOLIDATE,
+    PROFILE_TRIM_INTERSECTS,
+    PROFILE_SORT,
+    PROFILE_GET_HEIGHT,
+    PROFILE_EMIT,
+    PROFILE_ROUTINES
+};
+
+struct profile_mark {
+    long long wall_ns, cpu_ns;
+    long long allocations, allocated_bytes;
+};
+
+extern int profiling;
+extern void enable_profiling(const char *filename);
+extern void profile_start(int routine, struct profile_mark *mark);
+extern void profile_stop(int routine, struct profile_mark *mark);
+extern void profile_phase_start(struct profile_mark *mark);
+extern void profile_phase_stop(const char *name, struct profile_mark *mark);
+extern void profile_add_input(const char *filename);
+extern void write_profile(void);
+
+#ifdef __cplusplus
+/* counts the rest of the enclosing block as one call of a routine */
+class profile_scope {
+public:
+    profile_scope(int _routine) { routine = _routine; if (profiling) profile_start(routine, &mark); };
+    ~profile_scope() { if (profiling) profile_stop(routine, &mark); };
+private:
+    int routine;
+    struct profile_mark mark;
+};
+#endif
+
 static inline int approx1(double A, double B) { if (fabs(A-B) < 0.1) return 1; return 0; }
 static inline int approx2(double A, double B) { if (fabs(A-B) < 0.02) return 1; return 0; }
 static inline int approx3(double A, double B) { if (fabs(A-B) < 0.002) return 1; return 0; }
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+extern "C" {
+#include "toolpath.h"
+}
+
+int verbose = 0;
+int quiet = 1;
+
+/*
+ * Low retract regression test: two 10mm pockets with a 0.25mm (one traverse cell)
+ * rib of stock left between them. Traversing from one pocket to the other must lift
+ * the tool over the rib, traversing within a pocket may stay below the stock top.
+ */
+
+#define CLEARANCE 0.5
+
+/* cuts a 10x10mm pocket at X0..X0+10 with the default 6mm tool */
+static void pocket(double X0)
+{
+    double Y;
+
+    gcode_travel_to(X0 + 3, 3);
+    gcode_plunge_to(-3, 1.0);
+    for (Y = 3; Y <= 7; Y += 2) {
+        gcode_mill_to(X0 + 3, Y, -3, 1.0);
+        gcode_mill_to(X0 + 7, Y, -3, 1.0);
+        gcode_mill_to(X0 + 3, Y, -3, 1.0);
+    }
+}
+
+/* the Z the tool is at when it starts the first G0 XY move after the comment */
+static double traverse_Z(const char *filename, const char *marker)
+{
+    char line[4096];
+    double Z = 1000;
+    int armed = 0;
+    FILE *file;
+
+    file = fopen(filename, "r");
+    if (!file)
+        return -1000;
+    while (fgets(line, sizeof(line), file)) {
+        char *c = strchr(line, 'Z');
+
+        if (strstr(line, marker))
+            armed = 1;
+        if (c)
+            Z = strtod(c + 1, NULL);
+        if (armed && strncmp(line, "G0", 2) == 0 && (strchr(line, 'X') || strchr(line, 'Y')))
+            break;
+    }
+    fclose(file);
+    return Z;
+}
+
+int main(void)
+{
+    const char *filename = "traverse_test.nc";
+    double Z;
+    int ret = 0;
+
+    gcode_want_low_retract(CLEARANCE);
+    write_gcode_header(filename);
+
+    pocket(0);
+    gcode_mill_to(5, 5, -3, 1.0);
+    gcode_write_comment("within pocket");
+    gcode_travel_to(5.5, 5);
+
+    /* the rib is X 10 .. 10.25, straight across it between the pocket centers */
+    pocket(10.25);
+    gcode_mill_to(15.25, 5, -3, 1.0);
+    gcode_write_comment("over rib");
+    gcode_travel_to(5, 5);
+
+    write_gcode_footer();
+
+    Z = traverse_Z(filename, "within pocket");
+    printf("traverse within pocket at Z %5.4f\n", Z);
+    if (Z >= 0) {
+        printf("FAIL: expected to stay below the stock top\n");
+        ret = 1;
+    }
+
+    Z = traverse_Z(filename, "over rib");
+    printf("traverse over rib at Z %5.4f\n", Z);
+    if (Z < CLEARANCE - 0.0001) {
+        printf("FAIL: expected to clear the rib by %5.2fmm\n", CLEARANCE);
+        ret = 1;
+    }
+
+    remove(filename);
+    if (ret == 0)
+        printf("PASS\n");
+    return ret;
+}
@@ -402,11 +402,15 @@ void make_buckets(void)
 
 double stl_image_X(void)
 {
+	if (heightmap_loaded())
+		return heightmap_X();
 	return maxX;
 }
 
 double stl_image_Y(void)
 {
+	if (heightmap_loaded())
+		return heightmap_Y();
 	return maxY;
 }
 
@@ -506,11 +510,14 @@ double get_height_old(double X, double Y)
 	return value;
 }
 
-double get_height(double X, double Y)
+static double get_height_buckets(double X, double Y)
 {
 	double value = 0;
 	int i, b, j, b2;
 
+	if (heightmap_loaded())
+		return heightmap_height(X, Y);
+
 	if (nrbuckets == 0)
 		make_buckets();
 
@@ -572,6 +579,20 @@ double get_height(double X, double Y)
 	return value;
 }
 
+double get_height(double X, double Y)
+{
+	struct profile_mark mark;
+	double value;
+
+	if (!profiling)
+		return get_height_buckets(X, Y);
+
+	profile_start(PROFILE_GET_HEIGHT, &mark);
+	value = get_height_buckets(X, Y);
+	profile_stop(PROFILE_GET_HEIGHT, &mark);
+	return value;
+}
+
 
 static struct line *lines;
 static struct line *outlines;
@@ -604,15 +625,114 @@ static void push_line(double X1, double Y1, double X2, double Y2, double nX, dou
 	linecount++;
 }
 
+/*
+ * Endpoint hash for do_outlines(): every line is entered under the grid cells of all
+ * four X/Y combinations of its end points (the match test below pairs X and Y of
+ * either end independently), so the 3x3 cells around a point hold every line that
+ * can possibly match it. Cells are much larger than the match tolerance.
+ */
+#define OUTLINE_CELL 0.01
+
+static int *hash_head;
+static int *hash_next;
+static int *hash_line;
+static int *hash_cX, *hash_cY;
+static int hash_size;
+static int *candidates;
+static long outline_probes;
+
+static unsigned int hash_cell(int cX, int cY)
+{
+	return ((unsigned int)cX * 73856093u ^ (unsigned int)cY * 19349663u) & (hash_size - 1);
+}
+
+static void hash_insert(int entry, double X, double Y, int line)
+{
+	int cX = floor(X / OUTLINE_CELL);
+	int cY = floor(Y / OUTLINE_CELL);
+	unsigned int h = hash_cell(cX, cY);
+
+	hash_cX[entry] = cX;
+	hash_cY[entry] = cY;
+	hash_line[entry] = line;
+	hash_next[entry] = hash_head[h];
+	hash_head[h] = entry;
+}
+
+static void build_endpoint_hash(void)
+{
+	int i;
+
+	hash_size = 16;
+	while (hash_size < 8 * linecount)
+		hash_size *= 2;
+
+	free(hash_head);
+	free(hash_next);
+	free(hash_line);
+	free(hash_cX);
+	free(hash_cY);
+	free(candidates);
+	hash_head = malloc(hash_size * sizeof(int));
+	hash_next = calloc(4 * linecount + 1, sizeof(int));
+	hash_line = calloc(4 * linecount + 1, sizeof(int));
+	hash_cX = calloc(4 * linecount + 1, sizeof(int));
+	hash_cY = calloc(4 * linecount + 1, sizeof(int));
+	candidates = calloc(4 * linecount + 1, sizeof(int));
+
+	for (i = 0; i < hash_size; i++)
+		hash_head[i] = -1;
+
+	for (i = 0; i < linecount; i++) {
+		hash_insert(4 * i + 0, lines[i].X1, lines[i].Y1, i);
+		hash_insert(4 * i + 1, lines[i].X1, lines[i].Y2, i);
+		hash_insert(4 * i + 2, lines[i].X2, lines[i].Y1, i);
+		hash_insert(4 * i + 3, lines[i].X2, lines[i].Y2, i);
+	}
+}
+
+static int compare_int(const void *A, const void *B)
+{
+	return *(const int *)A - *(const int *)B;
+}
+
+/*
+ * Fills candidates[] with the lines that have an end point combination near X/Y,
+ * in increasing order, so matches are visited in the same order as a full scan.
+ */
+static int find_candidates(double X, double Y)
+{
+	int cX = floor(X / OUTLINE_CELL);
+	int cY = floor(Y / OUTLINE_CELL);
+	int dX, dY, e;
+	int nr = 0, out = 0, k;
+
+	for (dX = -1; dX <= 1; dX++)
+		for (dY = -1; dY <= 1; dY++)
+			for (e = hash_head[hash_cell(cX + dX, cY + dY)]; e >= 0; e = hash_next[e])
+				if (hash_cX[e] == cX + dX && hash_cY[e] == cY + dY)
+					candidates[nr++] = hash_line[e];
+
+	qsort(candidates, nr, sizeof(int), compare_int);
+	for (k = 0; k < nr; k++)
+		if (out == 0 || candidates[out - 1] != candidates[k])
+			candidates[out++] = candidates[k];
+	return out;
+}
+
 static void do_outlines(double distance)
 {
 	int i;
+
+	build_endpoint_hash();
+	outline_probes = 0;
+
 	for (i = 0; i < linecount; i++) {
 		double mX, mY;
 		double vX,vY, len;
 		double l1,l2;
 		int match = 0;
-		int j;
+		int j, k, nr;
 
 		if (lines[i].valid != 1)
 			continue;
@@ -635,9 +755,12 @@ static void do_outlines(double distance)
 		double oldl1 = l1;
 
 		/* lets go find a match for X1/Y1 */
-		for (j = 0 ; j < linecount; j++) {
+		nr = find_candidates(lines[i].X1, lines[i].Y1);
+		for (k = 0; k < nr; k++) {
+			j = candidates[k];
 			if (lines[j].valid != 1 || i == j)
 				continue;
+			outline_probes++;
 			if ( (approx3(lines[i].X1,lines[j].X1) || approx3(lines[i].X1,lines[j].X2)) && 			
 				 (approx3(lines[i].Y1,lines[j].Y1) || approx3(lines[i].Y1,lines[j].Y2))) {
 				double m2X, m2Y, v2X, v2Y;
@@ -698,9 +821,12 @@ static void do_outlines(double distance)
 		double oldl2 = l2;
 
 		/* lets go find a match for X2/Y2 */
-		for (j = 0 ; j < linecount; j++) {
+		nr = find_candidates(lines[i].X2, lines[i].Y2);
+		for (k = 0; k < nr; k++) {
+			j = candidates[k];
 			if (!lines[j].valid || i == j)
 				continue;
+			outline_probes++;
 			if ( (approx4(lines[i].X2,lines[j].X1) || approx4(lines[i].X2,lines[j].X2)) && 			
 				 (approx4(lines[i].Y2,lines[j].Y1) || approx4(lines[i].Y2,lines[j].Y2))) {
 				double m2X, m2Y, v2X, v2Y;
@@ -860,6 +986,7 @@ struct line * stl_vertical_triangles(double radius)
 
 	do_outlines(radius);
 	cleanup_outlines();
+	vprintf("Outline stitching: %i lines, %li endpoint probes\n", linecount, outline_probes);
 
 	if (verbose) {
 		output = fopen("lines.svg", "w");